@@ -0,0 +1,192 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ * Allocation trace recorder for a per-thread allocator
+ *     - every allocate/deallocate/zombie operation is appended as a fixed-size
+ *       binary record (op, size, id) to a per-allocator (i.e. per-thread) file
+ *     - id is the address of the block as seen by the bucket allocator; replay
+ *       tools are expected to remap ids to dense slots (see test/trace_replay.cpp)
+ *     - records are collected in a buffer living in pages obtained directly from
+ *       the page allocator and written out with plain fwrite() when it fills up
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_ALLOCATION_TRACE_H
+#define IIBMALLOC_ALLOCATION_TRACE_H
+
+#include "iibmalloc_common.h"
+#include "page_management.h"
+
+#include <cstdio>
+
+namespace nodecpp::iibmalloc
+{
+
+enum class AllocationTraceOp : uint8_t
+{
+	none = 0,
+	alloc = 1, // size: requested size; id: returned block
+	dealloc = 2, // id: block being released
+	zombie = 3, // id: block being turned into a zombie (released at next 'kill')
+	kill = 4, // all zombies are released
+	release = 5, // id: zombie released early to keep within quarantine budget
+	reclaim = 6, // id: zombie released by reclaimZombies()
+	mark = 7, // all current zombies are queued for reclamation
+	budget = 8, // size: new zombie quarantine budget
+};
+
+struct AllocationTraceFileHeader
+{
+	static constexpr uint64_t expectedMagic = 0x3130435254424949ULL; // "IIBTRC01"
+	uint64_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+};
+
+struct AllocationTraceRecord
+{
+	uint64_t id;
+	uint64_t sizeAndOp; // ( size << 8 ) | op
+
+	AllocationTraceOp op() const { return (AllocationTraceOp)( sizeAndOp & 0xFF ); }
+	uint64_t size() const { return sizeAndOp >> 8; }
+};
+static_assert( sizeof(AllocationTraceRecord) == 16 );
+
+constexpr uint32_t allocation_trace_version = 2; // 2: release, reclaim, mark and budget records
+constexpr size_t allocation_trace_buffer_size_exp = 16;
+
+template<class BasePageAllocator>
+class AllocationTraceRecorder : public BasePageAllocator
+{
+	static constexpr size_t bufferBytes = ((size_t)1) << allocation_trace_buffer_size_exp;
+	static constexpr size_t bufferCapacity = bufferBytes / sizeof(AllocationTraceRecord);
+
+	FILE* f = nullptr;
+	AllocationTraceRecord* buffer = nullptr;
+	size_t recordCount = 0;
+	uint64_t totalRecordCount = 0;
+	bool failed = false;
+
+	NODECPP_NOINLINE void flush()
+	{
+		if ( recordCount && !failed && fwrite( buffer, sizeof(AllocationTraceRecord), recordCount, f ) != recordCount )
+			failed = true;
+		recordCount = 0;
+	}
+
+	NODECPP_FORCEINLINE void append( AllocationTraceOp op, void* ptr, size_t sz )
+	{
+		if ( f == nullptr ) // LIKELY
+			return;
+		AllocationTraceRecord& rec = buffer[recordCount];
+		rec.id = (uint64_t)(uintptr_t)(ptr);
+		rec.sizeAndOp = ( (uint64_t)sz << 8 ) | (uint8_t)op;
+		++totalRecordCount;
+		if ( ++recordCount == bufferCapacity )
+			flush();
+	}
+
+public:
+	bool isRecording() const { return f != nullptr; }
+	uint64_t getRecordCount() const { return totalRecordCount; }
+
+	NODECPP_FORCEINLINE void onAllocate( void* ptr, size_t sz ) { append( AllocationTraceOp::alloc, ptr, sz ); }
+	NODECPP_FORCEINLINE void onDeallocate( void* ptr ) { append( AllocationTraceOp::dealloc, ptr, 0 ); }
+	NODECPP_FORCEINLINE void onZombie( void* ptr ) { append( AllocationTraceOp::zombie, ptr, 0 ); }
+	NODECPP_FORCEINLINE void onKillAllZombies() { append( AllocationTraceOp::kill, nullptr, 0 ); }
+	NODECPP_FORCEINLINE void onZombieRelease( void* ptr ) { append( AllocationTraceOp::release, ptr, 0 ); }
+	NODECPP_FORCEINLINE void onZombieReclaim( void* ptr ) { append( AllocationTraceOp::reclaim, ptr, 0 ); }
+	NODECPP_FORCEINLINE void onMarkZombiesForReclamation() { append( AllocationTraceOp::mark, nullptr, 0 ); }
+	NODECPP_FORCEINLINE void onZombieQuarantineBudget( size_t bytes ) { append( AllocationTraceOp::budget, nullptr, bytes ); }
+
+	bool start( const char* fileName )
+	{
+		if ( f != nullptr )
+			stop();
+		if ( buffer == nullptr )
+		{
+			buffer = reinterpret_cast<AllocationTraceRecord*>( this->getFreeBlockNoCache( bufferBytes ) );
+			if ( buffer == nullptr )
+				return false;
+		}
+		FILE* file = fopen( fileName, "wb" );
+		if ( file == nullptr )
+			return false;
+		setvbuf( file, nullptr, _IONBF, 0 ); // records are already buffered
+		AllocationTraceFileHeader header;
+		header.magic = AllocationTraceFileHeader::expectedMagic;
+		header.version = allocation_trace_version;
+		header.recordSize = sizeof(AllocationTraceRecord);
+		if ( fwrite( &header, sizeof(header), 1, file ) != 1 )
+		{
+			fclose( file );
+			return false;
+		}
+		f = file;
+		recordCount = 0;
+		totalRecordCount = 0;
+		failed = false;
+		return true;
+	}
+
+	// returns false if any part of the trace could not be written
+	bool stop()
+	{
+		if ( f == nullptr )
+			return false;
+		flush();
+		bool ok = !failed;
+		if ( fclose( f ) != 0 )
+			ok = false;
+		f = nullptr;
+		return ok;
+	}
+
+	void initialize( uint8_t blockSizeExp )
+	{
+		BasePageAllocator::initialize( blockSizeExp );
+		f = nullptr;
+		buffer = nullptr;
+		recordCount = 0;
+		totalRecordCount = 0;
+		failed = false;
+	}
+
+	void deinitialize()
+	{
+		stop();
+		if ( buffer != nullptr )
+			this->freeChunkNoCache( buffer, bufferBytes );
+		buffer = nullptr;
+		BasePageAllocator::deinitialize();
+	}
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_ALLOCATION_TRACE_H
@@ -0,0 +1,90 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Epoch-based deferred reclamation ("postponed free")
+ *     - readers of shared structures wrap accesses into an epoch critical
+ *       section (SafeIibAllocator::enterEpoch()/exitEpoch() or EpochGuard);
+ *       entering announces the current global epoch (one store and one fence)
+ *     - a block unlinked from a shared structure is passed to
+ *       SafeIibAllocator::retire() by the thread that owns it and goes back to
+ *       its bucket once every thread that was inside a critical section has
+ *       moved past the epoch in which it was retired
+ *     - the global epoch advances when all active participants have
+ *       announced it; an attempt is made every few retire() calls
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_EPOCH_RECLAMATION_H
+#define IIBMALLOC_EPOCH_RECLAMATION_H
+
+#include "iibmalloc_common.h"
+#include <atomic>
+
+namespace nodecpp::iibmalloc
+{
+
+struct alignas(64) EpochParticipant
+{
+	std::atomic<uint64_t> state; // ( announced epoch << 1 ) | isInCriticalSection
+	std::atomic<bool> inUse;
+	EpochParticipant* next; // participants are never removed from the registry, released ones are reused
+};
+
+class EpochRegistry
+{
+	static std::atomic<uint64_t> globalEpoch;
+	static std::atomic<EpochParticipant*> participants;
+
+public:
+	// a block retired at epoch e can be released once the global epoch reaches e + safeEpochDistance
+	static constexpr uint64_t safeEpochDistance = 2;
+
+	static uint64_t currentEpoch() { return globalEpoch.load( std::memory_order_acquire ); }
+
+	static EpochParticipant* acquireParticipant();
+	static void releaseParticipant( EpochParticipant* p );
+
+	// advances the global epoch if every participant inside a critical section has announced the current one;
+	// returns false if someone is still behind
+	static bool tryAdvance();
+
+	static NODECPP_FORCEINLINE void enter( EpochParticipant* p )
+	{
+		p->state.store( ( globalEpoch.load( std::memory_order_relaxed ) << 1 ) | 1, std::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+	}
+
+	static NODECPP_FORCEINLINE void exit( EpochParticipant* p )
+	{
+		p->state.store( p->state.load( std::memory_order_relaxed ) & ~((uint64_t)1), std::memory_order_release );
+	}
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_EPOCH_RECLAMATION_H
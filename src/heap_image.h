@@ -0,0 +1,641 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Heap image: a whole per-thread heap written to a file and restored at the
+ * same addresses (see IibAllocatorBase::serialize()/deserialize())
+ *     - the file is a sequence of records; each record is a header
+ *       (HeapImageRecord) followed by record-specific meta data and, for
+ *       data records, by the content of the memory range, starting at a
+ *       page-aligned file offset
+ *     - allocator state (descriptors, list heads, user pointers) is kept in
+ *       meta records and rebuilt on restore; memory content is mapped back
+ *       (copy-on-write) right from the file, falling back to reading it
+ *     - since data is mapped, the image file must not be modified while a
+ *       restored heap is alive; the writer always creates a new file
+ *       (written under a temporary name and then renamed)
+ *     - pointers from the heap to anything outside it (static data, code,
+ *       other heaps) are not adjusted; it is up to the user to keep them valid
+ *     - where original addresses are not available, a heap can be restored
+ *       elsewhere (IibAllocatorBase::deserializeRelocating()): each reservation
+ *       is moved by a multiple of 8 MiB (sounding-address page placement depends
+ *       on address bits below that), allocator pointers are fixed, and so are
+ *       user pointers at locations recorded in 'pointerLocations' records or
+ *       given by the caller; HeapRelocation translates any other pointer
+ *     - checkpoints (IibAllocatorBase::checkpoint()) form a chain: a full base
+ *       image followed by deltas, which have the same structure, but keep the
+ *       content of pages not modified since the previous checkpoint as
+ *       'unchanged' ranges (see soft_dirty_pages.h); a chain is turned into a
+ *       single restorable image by compactHeapImages()
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_HEAP_IMAGE_H
+#define IIBMALLOC_HEAP_IMAGE_H
+
+#include "iibmalloc_common.h"
+#include "page_management.h"
+#include "soft_dirty_pages.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace nodecpp::iibmalloc
+{
+
+enum class HeapImageRecordKind : uint32_t
+{
+	none = 0,
+	header = 1, // meta: HeapImageHeader
+	meta = 2, // allocator state; meta: as written by the allocator
+	reservation = 3, // address space of [address, address + size); meta: as written by the allocator
+	data = 4, // committed memory of [address, address + size) with its content in the file
+	zero = 5, // committed memory of [address, address + size) with no meaningful content
+	end = 6,
+	unchanged = 7, // (deltas only) committed memory of [address, address + size) with content as in the previous image of the chain
+	inPlace = 8, // (persistent heaps only) committed memory of [address, address + size) with content already at its place (see persistent_heap.h)
+	pointerLocations = 9, // meta: addresses (uint64_t) of pointers in the heap to be fixed on relocation
+};
+
+struct HeapImageRecord
+{
+	uint32_t kind;
+	uint32_t metaSize;
+	uint64_t address;
+	uint64_t size;
+};
+static_assert( sizeof(HeapImageRecord) == 24 );
+
+struct HeapImageHeader
+{
+	static constexpr uint64_t expectedMagic = 0x3150414548424949ULL; // "IIBHEAP1"
+	uint64_t magic;
+	uint32_t version;
+	uint32_t pointerSize;
+	uint64_t layout; // allocator-defined; an image is restored only by an allocator with the same layout
+	uint64_t chainID; // 0 for images that are not checkpoints
+	uint64_t sequence; // position in the chain of checkpoints; 0 for full images
+};
+
+constexpr uint32_t heap_image_version = 2;
+constexpr size_t heap_image_data_alignment_exp = 12;
+constexpr uint64_t heap_image_data_alignment = ((uint64_t)1) << heap_image_data_alignment_exp;
+
+inline uint64_t heapImageDataOffset( uint64_t offset ) { return ( offset + heap_image_data_alignment - 1 ) & ~( heap_image_data_alignment - 1 ); }
+
+inline bool heapImageSeek( FILE* f, uint64_t offset )
+{
+#if defined NODECPP_WINDOWS
+	return _fseeki64( f, (__int64)offset, SEEK_SET ) == 0;
+#else
+	return fseeko( f, (off_t)offset, SEEK_SET ) == 0;
+#endif
+}
+
+constexpr size_t maxPointerLocationsPerRecord = 0x1000;
+
+class HeapImageWriter
+{
+	static constexpr size_t maxFileNameSize = 1024;
+
+	FILE* f = nullptr;
+	uint64_t offset = 0;
+	bool failed = false;
+	char fileName[maxFileNameSize];
+	char tmpFileName[maxFileNameSize + 4];
+
+	// adjacent data (or zero) ranges are merged into a single record
+	HeapImageRecordKind pendingKind = HeapImageRecordKind::none;
+	uint8_t* pendingAddress = nullptr;
+	size_t pendingSize = 0;
+
+	SoftDirtyPages* dirtyPages = nullptr; // if set, content of pages not modified since last clear is not written
+	bool contentInPlace = false; // if set, no content is written at all (see openStream())
+
+	// the last record, if written by writeDataFromFile() (and may be extended by the next call)
+	uint64_t copiedRecordOffset = 0;
+	HeapImageRecord copiedRecord = { (uint32_t)HeapImageRecordKind::none, 0, 0, 0 };
+
+	void write( const void* buff, size_t sz )
+	{
+		if ( sz && !failed && fwrite( buff, 1, sz, f ) != sz )
+			failed = true;
+		offset += sz;
+	}
+
+	void writeRecord( HeapImageRecordKind kind, const void* address, size_t size, const void* meta, size_t metaSize )
+	{
+		copiedRecord.kind = (uint32_t)HeapImageRecordKind::none;
+		HeapImageRecord rec;
+		rec.kind = (uint32_t)kind;
+		rec.metaSize = (uint32_t)metaSize;
+		rec.address = (uint64_t)(uintptr_t)address;
+		rec.size = size;
+		write( &rec, sizeof(rec) );
+		write( meta, metaSize );
+	}
+
+	void flushPending()
+	{
+		if ( pendingKind == HeapImageRecordKind::none )
+			return;
+		writeRecord( pendingKind, pendingAddress, pendingSize, nullptr, 0 );
+		if ( pendingKind == HeapImageRecordKind::data )
+		{
+			offset = heapImageDataOffset( offset );
+			if ( !failed && !heapImageSeek( f, offset ) ) // the gap, if any, is left for the file system to fill with zeros
+				failed = true;
+			write( pendingAddress, pendingSize );
+		}
+		pendingKind = HeapImageRecordKind::none;
+	}
+
+	void addRange( HeapImageRecordKind kind, void* address, size_t size )
+	{
+		if ( size == 0 )
+			return;
+		if ( pendingKind == kind && pendingAddress + pendingSize == address )
+		{
+			pendingSize += size;
+			return;
+		}
+		flushPending();
+		pendingKind = kind;
+		pendingAddress = reinterpret_cast<uint8_t*>( address );
+		pendingSize = size;
+	}
+
+public:
+	~HeapImageWriter()
+	{
+		if ( f != nullptr )
+		{
+			fclose( f );
+			if ( fileName[0] )
+				remove( tmpFileName );
+		}
+	}
+
+	bool open( const char* fileName_, uint64_t layout, uint64_t chainID = 0, uint64_t sequence = 0, SoftDirtyPages* dirtyPages_ = nullptr )
+	{
+		size_t len = strlen( fileName_ );
+		if ( len == 0 || len >= maxFileNameSize )
+			return false;
+		memcpy( fileName, fileName_, len + 1 );
+		memcpy( tmpFileName, fileName_, len );
+		memcpy( tmpFileName + len, ".tmp", 5 );
+		FILE* file = fopen( tmpFileName, "wb" );
+		if ( file == nullptr )
+			return false;
+		return start( file, layout, chainID, sequence, dirtyPages_, false );
+	}
+
+	// Writes to a stream (e.g. opened with fmemopen()) rather than to a file; the stream is closed by close().
+	// With contentInPlace, committed ranges are recorded as 'inPlace', with no content (see persistent_heap.h).
+	bool openStream( FILE* stream, uint64_t layout, bool contentInPlace_ )
+	{
+		fileName[0] = 0;
+		tmpFileName[0] = 0;
+		return start( stream, layout, 0, 0, nullptr, contentInPlace_ );
+	}
+
+	size_t getSize() const { return offset; }
+
+private:
+	bool start( FILE* file, uint64_t layout, uint64_t chainID, uint64_t sequence, SoftDirtyPages* dirtyPages_, bool contentInPlace_ )
+	{
+		f = file;
+		offset = 0;
+		failed = false;
+		pendingKind = HeapImageRecordKind::none;
+		dirtyPages = dirtyPages_;
+		contentInPlace = contentInPlace_;
+		copiedRecord.kind = (uint32_t)HeapImageRecordKind::none;
+		HeapImageHeader header;
+		header.magic = HeapImageHeader::expectedMagic;
+		header.version = heap_image_version;
+		header.pointerSize = sizeof(void*);
+		header.layout = layout;
+		header.chainID = chainID;
+		header.sequence = sequence;
+		writeRecord( HeapImageRecordKind::header, nullptr, 0, &header, sizeof(header) );
+		return !failed;
+	}
+
+public:
+
+	void writeMeta( const void* meta, size_t metaSize )
+	{
+		flushPending();
+		writeRecord( HeapImageRecordKind::meta, nullptr, 0, meta, metaSize );
+	}
+
+	// is to be followed by writeData()/writeZero() for all committed ranges of the reservation
+	void writeReservation( void* address, size_t size, const void* meta = nullptr, size_t metaSize = 0 )
+	{
+		flushPending();
+		writeRecord( HeapImageRecordKind::reservation, address, size, meta, metaSize );
+	}
+
+	void writeData( void* address, size_t size )
+	{
+		if ( contentInPlace )
+			addRange( HeapImageRecordKind::inPlace, address, size );
+		else if ( dirtyPages == nullptr )
+			addRange( HeapImageRecordKind::data, address, size );
+		else if ( !dirtyPages->doForEachRun( reinterpret_cast<uint8_t*>( address ), size, [this]( uint8_t* start, size_t sz, bool dirty ) { addRange( dirty ? HeapImageRecordKind::data : HeapImageRecordKind::unchanged, start, sz ); } ) )
+			failed = true;
+	}
+	void writeZero( void* address, size_t size ) { addRange( HeapImageRecordKind::zero, address, size ); }
+
+	// to be written after all reservations
+	void writePointerLocations( const void* const* locations, size_t count )
+	{
+		uint64_t buff[maxPointerLocationsPerRecord];
+		while ( count != 0 )
+		{
+			size_t cnt = count < maxPointerLocationsPerRecord ? count : maxPointerLocationsPerRecord;
+			for ( size_t i=0; i<cnt; ++i )
+				buff[i] = (uint64_t)(uintptr_t)( locations[i] );
+			writePointerLocations( buff, cnt );
+			locations += cnt;
+			count -= cnt;
+		}
+	}
+	void writePointerLocations( const uint64_t* locations, size_t count )
+	{
+		flushPending();
+		while ( count != 0 )
+		{
+			size_t cnt = count < maxPointerLocationsPerRecord ? count : maxPointerLocationsPerRecord;
+			writeRecord( HeapImageRecordKind::pointerLocations, nullptr, 0, locations, cnt * sizeof(uint64_t) );
+			locations += cnt;
+			count -= cnt;
+		}
+	}
+
+	// content is copied from another file (see compactHeapImages())
+	void writeDataFromFile( void* address, size_t size, FILE* src, uint64_t srcOffset )
+	{
+		if ( size == 0 )
+			return;
+		flushPending();
+		if ( copiedRecord.kind == (uint32_t)HeapImageRecordKind::data && copiedRecord.address + copiedRecord.size == (uint64_t)(uintptr_t)address )
+		{
+			// continuation of the previous range: its record is updated, and the data goes right after its data
+			copiedRecord.size += size;
+			if ( !failed && ( !heapImageSeek( f, copiedRecordOffset ) || fwrite( &copiedRecord, sizeof(copiedRecord), 1, f ) != 1 ) )
+				failed = true;
+		}
+		else
+		{
+			uint64_t recordOffset = offset;
+			writeRecord( HeapImageRecordKind::data, address, size, nullptr, 0 );
+			offset = heapImageDataOffset( offset );
+			copiedRecordOffset = recordOffset;
+			copiedRecord = { (uint32_t)HeapImageRecordKind::data, 0, (uint64_t)(uintptr_t)address, size };
+		}
+		if ( !failed && ( !heapImageSeek( f, offset ) || !heapImageSeek( src, srcOffset ) ) )
+			failed = true;
+		uint8_t buff[0x4000];
+		while ( size != 0 && !failed )
+		{
+			size_t sz = size < sizeof(buff) ? size : sizeof(buff);
+			if ( fread( buff, 1, sz, src ) != sz )
+				failed = true;
+			write( buff, sz );
+			size -= sz;
+		}
+	}
+
+	// returns false if any part of the image could not be written; in this case no file is created
+	bool close()
+	{
+		if ( f == nullptr )
+			return false;
+		flushPending();
+		writeRecord( HeapImageRecordKind::end, nullptr, 0, nullptr, 0 );
+		bool ok = !failed;
+		if ( fclose( f ) != 0 )
+			ok = false;
+		f = nullptr;
+		if ( !fileName[0] ) // a stream
+			return ok;
+		if ( ok )
+		{
+			// the existing file (if any) may be mapped by a restored heap, so it is replaced rather than overwritten
+#if defined NODECPP_WINDOWS
+			remove( fileName );
+#endif
+			ok = rename( tmpFileName, fileName ) == 0;
+		}
+		if ( !ok )
+			remove( tmpFileName );
+		return ok;
+	}
+};
+
+// Address translation for a heap restored elsewhere (see IibAllocatorBase::deserializeRelocating())
+class HeapRelocation
+{
+	struct Range
+	{
+		uintptr_t original;
+		size_t size;
+		intptr_t delta; // a multiple of 8 MiB
+	};
+	Range* ranges = nullptr; // sorted by original address
+	size_t count = 0;
+	size_t capacity = 0;
+
+	const Range* find( uintptr_t original ) const
+	{
+		size_t lo = 0, hi = count;
+		while ( lo < hi )
+		{
+			size_t mid = ( lo + hi ) / 2;
+			if ( ranges[mid].original + ranges[mid].size <= original )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo < count && ranges[lo].original <= original ? ranges + lo : nullptr;
+	}
+
+public:
+	HeapRelocation() {}
+	HeapRelocation( const HeapRelocation& ) = delete;
+	HeapRelocation& operator = ( const HeapRelocation& ) = delete;
+	~HeapRelocation() { free( ranges ); }
+
+	void clear() { count = 0; }
+	size_t rangeCount() const { return count; }
+
+	bool add( const void* original, size_t size, void* moved )
+	{
+		if ( count == capacity )
+		{
+			size_t newCapacity = capacity ? capacity * 2 : 64;
+			void* newRanges = realloc( ranges, newCapacity * sizeof(Range) );
+			if ( newRanges == nullptr )
+				return false;
+			ranges = reinterpret_cast<Range*>( newRanges );
+			capacity = newCapacity;
+		}
+		size_t pos = count;
+		while ( pos != 0 && ranges[pos - 1].original > (uintptr_t)original )
+		{
+			ranges[pos] = ranges[pos - 1];
+			--pos;
+		}
+		ranges[pos] = { (uintptr_t)original, size, (intptr_t)( (uintptr_t)moved - (uintptr_t)original ) };
+		++count;
+		return true;
+	}
+
+	bool isInOriginalHeap( const void* original ) const { return find( (uintptr_t)original ) != nullptr; }
+
+	// new address of anything in the original heap; any other address is returned as it is
+	template<class T>
+	T* translate( T* original ) const
+	{
+		const Range* r = find( (uintptr_t)original );
+		return r != nullptr ? reinterpret_cast<T*>( (uintptr_t)original + r->delta ) : original;
+	}
+	uintptr_t translate( uintptr_t original ) const { return (uintptr_t)translate( reinterpret_cast<void*>( original ) ); }
+
+	// for a pointer that is already at its new location; each pointer is to be fixed exactly once
+	template<class T>
+	void fixPointer( T*& ptr ) const { ptr = translate( ptr ); }
+};
+
+class HeapImageReader
+{
+	FILE* f = nullptr;
+	HeapImageRecord next; // the record to be processed next (its header is already read)
+	uint64_t offset = 0; // file offset right after the header of 'next'
+	bool failed = false;
+
+	bool readNext()
+	{
+		if ( failed || fread( &next, sizeof(next), 1, f ) != 1 )
+			return fail();
+		offset += sizeof(next);
+		return true;
+	}
+
+	bool fail()
+	{
+		failed = true;
+		next.kind = (uint32_t)HeapImageRecordKind::none;
+		return false;
+	}
+
+	bool readRecordMeta( HeapImageRecordKind kind, void* meta, size_t metaSize )
+	{
+		if ( failed || next.kind != (uint32_t)kind || next.metaSize != metaSize )
+			return fail();
+		if ( metaSize && fread( meta, 1, metaSize, f ) != metaSize )
+			return fail();
+		offset += metaSize;
+		return true;
+	}
+
+	template<class PageAllocatorT>
+	bool readRange( PageAllocatorT& alloc, uint8_t* address, size_t size )
+	{
+		if ( next.metaSize != 0 )
+			return fail();
+		if ( next.kind == (uint32_t)HeapImageRecordKind::zero )
+			return alloc.CommitMemory( address, size ) != (void*)(-1) && readNext();
+		if ( next.kind == (uint32_t)HeapImageRecordKind::inPlace )
+			return alloc.CommitMemoryInPlace( address, size ) && readNext();
+		uint64_t dataOffset = heapImageDataOffset( offset );
+		if ( !alloc.MapFileAt( address, size, fileno( f ), dataOffset ) )
+		{
+			if ( alloc.CommitMemory( address, size ) == (void*)(-1) )
+				return fail();
+			if ( !heapImageSeek( f, dataOffset ) || fread( address, 1, size, f ) != size )
+				return fail();
+		}
+		offset = dataOffset + size;
+		if ( !heapImageSeek( f, offset ) )
+			return fail();
+		return readNext();
+	}
+
+public:
+	~HeapImageReader()
+	{
+		if ( f != nullptr )
+			fclose( f );
+	}
+
+	// opens an image of any kind, e.g. a delta
+	bool openImage( const char* fileName, HeapImageHeader& header )
+	{
+		FILE* file = fopen( fileName, "rb" );
+		if ( file == nullptr )
+			return false;
+		return openImage( file, header );
+	}
+
+	// same as above, but for a stream (e.g. opened with fmemopen()); the stream is closed by close()
+	bool openImage( FILE* stream, HeapImageHeader& header )
+	{
+		f = stream;
+		offset = 0;
+		failed = false;
+		if ( !readNext() || !readRecordMeta( HeapImageRecordKind::header, &header, sizeof(header) ) )
+			return false;
+		if ( header.magic != HeapImageHeader::expectedMagic || header.version != heap_image_version || header.pointerSize != sizeof(void*) )
+			return fail();
+		return readNext();
+	}
+
+	// opens a full image to be restored
+	template<class SourceT> // file name or stream
+	bool open( SourceT source, uint64_t layout )
+	{
+		HeapImageHeader header;
+		if ( !openImage( source, header ) )
+			return false;
+		if ( header.layout != layout || header.sequence != 0 )
+			return fail();
+		return true;
+	}
+
+	// Generic iteration over records: returns the current one (meta is copied if it fits into maxMetaSize; dataOffset is
+	// valid for data records) and moves to the next one (except for the end record). Returns false on error.
+	bool nextRecord( HeapImageRecord& rec, void* meta, size_t maxMetaSize, uint64_t& dataOffset )
+	{
+		rec = next;
+		if ( failed || next.metaSize > maxMetaSize || !readRecordMeta( (HeapImageRecordKind)next.kind, meta, next.metaSize ) )
+			return fail();
+		if ( rec.kind == (uint32_t)HeapImageRecordKind::end )
+			return true;
+		if ( rec.kind == (uint32_t)HeapImageRecordKind::data )
+		{
+			dataOffset = heapImageDataOffset( offset );
+			offset = dataOffset + rec.size;
+			if ( !heapImageSeek( f, offset ) )
+				return fail();
+		}
+		return readNext();
+	}
+
+	bool readMeta( void* meta, size_t metaSize )
+	{
+		return readRecordMeta( HeapImageRecordKind::meta, meta, metaSize ) && readNext();
+	}
+
+	// Restores a reservation at its original address along with all its committed ranges; with relocation,
+	// at any address with the same offset within an 8 MiB slot (the move is added to relocation).
+	// size: expected size (0 if any), on return: actual size. Returns nullptr on failure (nothing remains reserved then).
+	template<class PageAllocatorT>
+	void* readReservation( PageAllocatorT& alloc, size_t& size, void* meta = nullptr, size_t metaSize = 0, HeapRelocation* relocation = nullptr )
+	{
+		uint64_t address = next.address;
+		uint64_t sz = next.size;
+		if ( next.kind != (uint32_t)HeapImageRecordKind::reservation || ( size != 0 && sz != size ) || sz == 0 || (uintptr_t)address != address || (size_t)sz != sz )
+		{
+			fail();
+			return nullptr;
+		}
+		if ( !readRecordMeta( HeapImageRecordKind::reservation, meta, metaSize ) || !readNext() )
+			return nullptr;
+		uint8_t* original = reinterpret_cast<uint8_t*>( (uintptr_t)address );
+		uint8_t* block = original;
+		size = (size_t)sz;
+		if ( relocation != nullptr )
+		{
+			block = reinterpret_cast<uint8_t*>( alloc.ReserveAddressSpaceLike( original, size ) );
+			if ( block != nullptr && !relocation->add( original, size, block ) )
+			{
+				alloc.freeReservationNoCache( block, size );
+				block = nullptr;
+			}
+			if ( block == nullptr )
+			{
+				fail();
+				return nullptr;
+			}
+		}
+		else if ( !alloc.ReserveAddressSpaceAt( block, size ) )
+		{
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "heap image: address range 0x{:x} (0x{:x} bytes) is not available", (uintptr_t)block, size );
+			fail();
+			return nullptr;
+		}
+		while ( next.kind == (uint32_t)HeapImageRecordKind::data || next.kind == (uint32_t)HeapImageRecordKind::zero || next.kind == (uint32_t)HeapImageRecordKind::inPlace )
+		{
+			uint8_t* rangeAddress = reinterpret_cast<uint8_t*>( (uintptr_t)next.address );
+			if ( rangeAddress < original || next.size > (uint64_t)( original + size - rangeAddress ) || !readRange( alloc, block + ( rangeAddress - original ), (size_t)next.size ) )
+			{
+				fail();
+				alloc.freeReservationNoCache( block, size );
+				return nullptr;
+			}
+		}
+		return block;
+	}
+
+	// calls f( location ) for each recorded location (see HeapImageWriter::writePointerLocations())
+	template<class F>
+	bool readPointerLocations( F&& f )
+	{
+		uint64_t locations[maxPointerLocationsPerRecord];
+		while ( next.kind == (uint32_t)HeapImageRecordKind::pointerLocations )
+		{
+			size_t metaSize = next.metaSize;
+			if ( metaSize > sizeof(locations) || ( metaSize % sizeof(uint64_t) ) != 0 || !readRecordMeta( HeapImageRecordKind::pointerLocations, locations, metaSize ) || !readNext() )
+				return fail();
+			for ( size_t i=0; i<metaSize / sizeof(uint64_t); ++i )
+				f( locations[i] );
+		}
+		return !failed;
+	}
+
+	// returns false if the image is not complete or any part of it could not be read
+	bool close()
+	{
+		bool ok = f != nullptr && !failed && next.kind == (uint32_t)HeapImageRecordKind::end;
+		if ( f != nullptr )
+			fclose( f );
+		f = nullptr;
+		return ok;
+	}
+};
+
+// Merges a chain of checkpoints (the base image first, then deltas in order) into a single full image
+// that can be restored with deserialize(); returns false if the chain is not valid or not complete
+bool compactHeapImages( const char* const* fileNames, size_t count, const char* outFileName );
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_HEAP_IMAGE_H
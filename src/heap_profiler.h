@@ -0,0 +1,371 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ * Sampling heap profiler for a per-thread allocator
+ *     - one allocation per (randomized) sampling interval of allocated bytes
+ *       is recorded together with its stack trace
+ *     - live and cumulative sampled allocations are aggregated per stack
+ *     - profile can be dumped in gperftools/pprof "heap_v2" text format
+ *       or as folded stacks (flamegraph.pl and similar tools)
+ *     - all tables live in pages obtained directly from the page allocator;
+ *       the profiler never calls malloc() or operator new on a hot path
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_HEAP_PROFILER_H
+#define IIBMALLOC_HEAP_PROFILER_H
+
+#include "iibmalloc_common.h"
+#include "page_management.h"
+
+#include <cmath>
+#include <cstdio>
+
+#if defined NODECPP_WINDOWS
+#include <Windows.h>
+#elif defined(NODECPP_LINUX) || defined(NODECPP_MAC)
+#include <execinfo.h>
+#endif
+
+namespace nodecpp::iibmalloc
+{
+
+constexpr size_t heap_profiler_max_stack_depth = 32;
+constexpr size_t heap_profiler_stack_table_size_exp = 12; // distinct stacks
+constexpr size_t heap_profiler_sample_table_size_exp = 16; // simultaneously live samples
+constexpr size_t heap_profiler_default_sampling_interval = 512 * 1024;
+
+template<class BasePageAllocator>
+class SamplingHeapProfiler : public BasePageAllocator
+{
+	static constexpr size_t stackTableSize = ((size_t)1) << heap_profiler_stack_table_size_exp;
+	static constexpr size_t sampleTableSize = ((size_t)1) << heap_profiler_sample_table_size_exp;
+	static constexpr size_t framesToSkip = 2; // capturing routines themselves
+
+	struct StackRecord
+	{
+		uint64_t hash;
+		uint32_t depth; // 0 means unused entry
+		void* frames[heap_profiler_max_stack_depth];
+		uint64_t liveCount;
+		uint64_t liveBytes;
+		uint64_t allocCount;
+		uint64_t allocBytes;
+	};
+
+	struct SampleRecord
+	{
+		void* ptr; // nullptr means unused entry
+		size_t size;
+		size_t stackIdx;
+	};
+
+	StackRecord* stacks = nullptr;
+	SampleRecord* samples = nullptr;
+	size_t stackCount = 0;
+	size_t liveSampleCount = 0;
+	uint64_t droppedSampleCount = 0;
+
+	int64_t bytesUntilSample = INT64_MAX;
+	size_t samplingInterval = heap_profiler_default_sampling_interval;
+	uint64_t rngState = 0x9E3779B97F4A7C15ULL;
+
+	static constexpr size_t stackTableBytes() { return alignUpExp( sizeof(StackRecord) * stackTableSize, 12 ); }
+	static constexpr size_t sampleTableBytes() { return alignUpExp( sizeof(SampleRecord) * sampleTableSize, 12 ); }
+
+	static NODECPP_FORCEINLINE size_t ptrToSampleSlot( void* ptr )
+	{
+		uint64_t h = (uint64_t)(uintptr_t)(ptr) * 0x9E3779B97F4A7C15ULL;
+		return (size_t)(h >> (64 - heap_profiler_sample_table_size_exp));
+	}
+
+	uint64_t nextRandom()
+	{
+		// xorshift64*
+		rngState ^= rngState >> 12;
+		rngState ^= rngState << 25;
+		rngState ^= rngState >> 27;
+		return rngState * 2685821657736338717ULL;
+	}
+
+	void pickNextSamplingPoint()
+	{
+		if ( samplingInterval == 0 )
+		{
+			bytesUntilSample = INT64_MAX;
+			return;
+		}
+		// exponentially distributed intervals with a given mean avoid aliasing with periodic allocation patterns
+		double u = ( (double)( nextRandom() >> 11 ) + 1. ) / (double)( ((uint64_t)1) << 53 );
+		double next = -std::log( u ) * (double)samplingInterval;
+		bytesUntilSample = next < (double)(INT64_MAX / 2) ? (int64_t)next : INT64_MAX / 2;
+	}
+
+	bool ensureTables()
+	{
+		if ( stacks != nullptr )
+			return true;
+		stacks = reinterpret_cast<StackRecord*>( this->getFreeBlockNoCache( stackTableBytes() ) );
+		samples = reinterpret_cast<SampleRecord*>( this->getFreeBlockNoCache( sampleTableBytes() ) );
+		// fresh pages are zero-filled, which is what 'unused' means for both tables
+		return stacks != nullptr && samples != nullptr;
+	}
+
+	NODECPP_NOINLINE static size_t captureStack( void** frames )
+	{
+#if defined NODECPP_WINDOWS
+		return CaptureStackBackTrace( framesToSkip, heap_profiler_max_stack_depth, frames, nullptr );
+#elif defined(NODECPP_LINUX) || defined(NODECPP_MAC)
+		void* tmp[heap_profiler_max_stack_depth + framesToSkip];
+		int cnt = backtrace( tmp, (int)(heap_profiler_max_stack_depth + framesToSkip) );
+		if ( cnt <= (int)framesToSkip )
+			return 0;
+		size_t depth = cnt - framesToSkip;
+		memcpy( frames, tmp + framesToSkip, depth * sizeof(void*) );
+		return depth;
+#else
+		return 0;
+#endif
+	}
+
+	size_t findOrAddStack( void** frames, size_t depth )
+	{
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for ( size_t i=0; i<depth; ++i )
+			hash = ( hash ^ (uint64_t)(uintptr_t)(frames[i]) ) * 0x100000001b3ULL;
+		hash |= 1; // to distinguish from an empty entry
+		size_t idx = (size_t)( hash >> (64 - heap_profiler_stack_table_size_exp) );
+		for ( size_t i=0; i<stackTableSize; ++i, idx = ( idx + 1 ) & ( stackTableSize - 1 ) )
+		{
+			StackRecord& rec = stacks[idx];
+			if ( rec.depth == 0 )
+			{
+				if ( stackCount >= stackTableSize - stackTableSize / 8 )
+					return SIZE_MAX; // keep some room for probing to terminate quickly
+				rec.hash = hash;
+				rec.depth = (uint32_t)depth;
+				memcpy( rec.frames, frames, depth * sizeof(void*) );
+				++stackCount;
+				return idx;
+			}
+			if ( rec.hash == hash && rec.depth == depth && memcmp( rec.frames, frames, depth * sizeof(void*) ) == 0 )
+				return idx;
+		}
+		return SIZE_MAX;
+	}
+
+	NODECPP_NOINLINE void recordSample( void* ptr, size_t sz )
+	{
+		pickNextSamplingPoint();
+		if ( ptr == nullptr || !ensureTables() )
+			return;
+		if ( liveSampleCount >= sampleTableSize - sampleTableSize / 4 )
+		{
+			++droppedSampleCount;
+			return;
+		}
+
+		void* frames[heap_profiler_max_stack_depth];
+		size_t depth = captureStack( frames );
+		if ( depth == 0 ) // no unwinding available; still keep totals
+			frames[depth++] = nullptr;
+		size_t stackIdx = findOrAddStack( frames, depth );
+		if ( stackIdx == SIZE_MAX )
+		{
+			++droppedSampleCount;
+			return;
+		}
+		StackRecord& rec = stacks[stackIdx];
+		++(rec.allocCount);
+		rec.allocBytes += sz;
+		++(rec.liveCount);
+		rec.liveBytes += sz;
+
+		size_t slot = ptrToSampleSlot( ptr );
+		while ( samples[slot].ptr != nullptr )
+			slot = ( slot + 1 ) & ( sampleTableSize - 1 );
+		samples[slot].ptr = ptr;
+		samples[slot].size = sz;
+		samples[slot].stackIdx = stackIdx;
+		++liveSampleCount;
+	}
+
+	NODECPP_NOINLINE void forgetSample( void* ptr )
+	{
+		size_t slot = ptrToSampleSlot( ptr );
+		while ( samples[slot].ptr != ptr )
+		{
+			if ( samples[slot].ptr == nullptr )
+				return; // not sampled
+			slot = ( slot + 1 ) & ( sampleTableSize - 1 );
+		}
+		StackRecord& rec = stacks[samples[slot].stackIdx];
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, rec.liveCount != 0 && rec.liveBytes >= samples[slot].size );
+		--(rec.liveCount);
+		rec.liveBytes -= samples[slot].size;
+		--liveSampleCount;
+
+		// backward-shift deletion keeps linear probing chains intact without tombstones
+		size_t hole = slot;
+		size_t next = ( hole + 1 ) & ( sampleTableSize - 1 );
+		while ( samples[next].ptr != nullptr )
+		{
+			size_t home = ptrToSampleSlot( samples[next].ptr );
+			if ( ( ( next - home ) & ( sampleTableSize - 1 ) ) >= ( ( next - hole ) & ( sampleTableSize - 1 ) ) )
+			{
+				samples[hole] = samples[next];
+				hole = next;
+			}
+			next = ( next + 1 ) & ( sampleTableSize - 1 );
+		}
+		samples[hole].ptr = nullptr;
+	}
+
+public:
+	void initialize( uint8_t blockSizeExp )
+	{
+		BasePageAllocator::initialize( blockSizeExp );
+		stacks = nullptr;
+		samples = nullptr;
+		stackCount = 0;
+		liveSampleCount = 0;
+		droppedSampleCount = 0;
+		setSamplingInterval( samplingInterval );
+	}
+
+	void deinitialize()
+	{
+		if ( stacks != nullptr )
+			this->freeChunkNoCache( stacks, stackTableBytes() );
+		if ( samples != nullptr )
+			this->freeChunkNoCache( samples, sampleTableBytes() );
+		stacks = nullptr;
+		samples = nullptr;
+		stackCount = 0;
+		liveSampleCount = 0;
+		BasePageAllocator::deinitialize();
+	}
+
+	// mean number of allocated bytes between two samples; 0 turns sampling off
+	void setSamplingInterval( size_t bytes )
+	{
+		samplingInterval = bytes;
+		pickNextSamplingPoint();
+	}
+	size_t getSamplingInterval() const { return samplingInterval; }
+	uint64_t getDroppedSampleCount() const { return droppedSampleCount; }
+
+	NODECPP_FORCEINLINE void onAllocate( void* ptr, size_t sz )
+	{
+		bytesUntilSample -= (int64_t)sz;
+		if ( bytesUntilSample < 0 ) // UNLIKELY
+			recordSample( ptr, sz );
+	}
+
+	NODECPP_FORCEINLINE void onDeallocate( void* ptr )
+	{
+		if ( liveSampleCount ) // likely false unless there are live sampled objects
+			forgetSample( ptr );
+	}
+
+	// gperftools 'heap_v2' format understood by pprof; counts are raw samples, pprof unsamples them using the rate in the header
+	bool dumpPprof( const char* fileName ) const
+	{
+		FILE* f = fopen( fileName, "w" );
+		if ( f == nullptr )
+			return false;
+		uint64_t liveCnt = 0, liveBytes = 0, allocCnt = 0, allocBytes = 0;
+		for ( size_t i=0; stacks && i<stackTableSize; ++i )
+			if ( stacks[i].depth )
+			{
+				liveCnt += stacks[i].liveCount;
+				liveBytes += stacks[i].liveBytes;
+				allocCnt += stacks[i].allocCount;
+				allocBytes += stacks[i].allocBytes;
+			}
+		fprintf( f, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n", (unsigned long long)liveCnt, (unsigned long long)liveBytes, (unsigned long long)allocCnt, (unsigned long long)allocBytes, samplingInterval );
+		for ( size_t i=0; stacks && i<stackTableSize; ++i )
+		{
+			const StackRecord& rec = stacks[i];
+			if ( rec.depth == 0 )
+				continue;
+			fprintf( f, "%llu: %llu [%llu: %llu] @", (unsigned long long)rec.liveCount, (unsigned long long)rec.liveBytes, (unsigned long long)rec.allocCount, (unsigned long long)rec.allocBytes );
+			for ( size_t j=0; j<rec.depth; ++j )
+				fprintf( f, " 0x%zx", (size_t)(uintptr_t)(rec.frames[j]) );
+			fprintf( f, "\n" );
+		}
+#if defined(NODECPP_LINUX) || defined(NODECPP_ANDROID)
+		fprintf( f, "\nMAPPED_LIBRARIES:\n" );
+		FILE* maps = fopen( "/proc/self/maps", "r" );
+		if ( maps != nullptr )
+		{
+			char buff[4096];
+			size_t rd;
+			while ( ( rd = fread( buff, 1, sizeof(buff), maps ) ) != 0 )
+				fwrite( buff, 1, rd, f );
+			fclose( maps );
+		}
+#endif
+		fclose( f );
+		return true;
+	}
+
+	// one line per stack, outermost frame first, followed by a number of live (or cumulatively allocated) sampled bytes
+	bool dumpFolded( const char* fileName, bool live = true ) const
+	{
+		FILE* f = fopen( fileName, "w" );
+		if ( f == nullptr )
+			return false;
+		for ( size_t i=0; stacks && i<stackTableSize; ++i )
+		{
+			const StackRecord& rec = stacks[i];
+			uint64_t bytes = live ? rec.liveBytes : rec.allocBytes;
+			if ( rec.depth == 0 || bytes == 0 )
+				continue;
+#if defined(NODECPP_LINUX) || defined(NODECPP_MAC)
+			char** names = backtrace_symbols( rec.frames, (int)rec.depth );
+#else
+			char** names = nullptr;
+#endif
+			for ( size_t j=rec.depth; j>0; --j )
+			{
+				if ( names != nullptr )
+					fprintf( f, "%s%s", names[j-1], j > 1 ? ";" : "" );
+				else
+					fprintf( f, "0x%zx%s", (size_t)(uintptr_t)(rec.frames[j-1]), j > 1 ? ";" : "" );
+			}
+			fprintf( f, " %llu\n", (unsigned long long)bytes );
+			free( names );
+		}
+		fclose( f );
+		return true;
+	}
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_HEAP_PROFILER_H
@@ -0,0 +1,149 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Background heap snapshots
+ *     - the process is forked, and the child writes a heap image (see
+ *       heap_image.h) of the allocator as it was at the moment of fork(),
+ *       while the parent goes on; isolation is provided by copy-on-write
+ *       (so clone() with CLONE_VM is not an option)
+ *     - like serialize(), the child streams page ranges right from allocator
+ *       descriptors (sounding-address blocks, bulk blocks, large chunks)
+ *     - the result is passed back through a pipe: bytes written and
+ *       copy-on-write overhead, that is, memory duplicated because the parent
+ *       modified shared pages while the child was running (estimated as the
+ *       growth of private memory of the child, see /proc/self/smaps_rollup)
+ *     - Linux only
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_HEAP_SNAPSHOT_H
+#define IIBMALLOC_HEAP_SNAPSHOT_H
+
+#include "iibmalloc_common.h"
+#include <cerrno>
+#include <cstring>
+
+#if defined NODECPP_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+namespace nodecpp::iibmalloc
+{
+
+class HeapSnapshot
+{
+public:
+	struct Result
+	{
+		bool ok = false;
+		uint64_t bytesWritten = 0; // size of the image
+		uint64_t cowBytes = 0; // copy-on-write overhead (0 if not known)
+		uint64_t durationUs = 0; // of writing, in the child
+	};
+
+private:
+#if defined NODECPP_LINUX
+	pid_t pid = -1;
+	int resultFd = -1;
+#endif
+	Result result;
+
+	static uint64_t getPrivateBytes(); // of the calling process; 0 if not known
+	static uint64_t getTimeUs();
+	bool collect( bool block );
+
+public:
+	HeapSnapshot() {}
+	HeapSnapshot( const HeapSnapshot& ) = delete;
+	HeapSnapshot& operator = ( const HeapSnapshot& ) = delete;
+	~HeapSnapshot() { wait(); }
+
+	// Forks; in the child, calls write( bytesWritten ) returning true on success, and reports the result.
+	// Returns false if the child could not be started (or another snapshot of this object is still running).
+	template<class F>
+	bool start( F&& write )
+	{
+#if defined NODECPP_LINUX
+		if ( isRunning() )
+			return false;
+		result = Result();
+		int fds[2];
+		if ( pipe( fds ) != 0 )
+			return false;
+		pid_t child = fork();
+		if ( child < 0 )
+		{
+			::close( fds[0] );
+			::close( fds[1] );
+			return false;
+		}
+		if ( child == 0 )
+		{
+			::close( fds[0] );
+			Result r;
+			uint64_t privateBefore = getPrivateBytes();
+			uint64_t start = getTimeUs();
+			r.ok = write( r.bytesWritten );
+			r.durationUs = getTimeUs() - start;
+			uint64_t privateAfter = getPrivateBytes();
+			r.cowBytes = privateAfter > privateBefore ? privateAfter - privateBefore : 0;
+			bool reported = ::write( fds[1], &r, sizeof(r) ) == (ssize_t)sizeof(r);
+			_exit( r.ok && reported ? 0 : 1 ); // no atexit handlers or destructors of the parent's objects
+		}
+		::close( fds[1] );
+		pid = child;
+		resultFd = fds[0];
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool isRunning() const
+	{
+#if defined NODECPP_LINUX
+		return pid > 0;
+#else
+		return false;
+#endif
+	}
+
+	// non-blocking; true if the snapshot is complete (then result is set; result.ok tells whether it succeeded)
+	bool poll( Result& r ) { bool done = collect( false ); r = result; return done; }
+	// blocking; returns result.ok
+	bool wait( Result& r ) { collect( true ); r = result; return result.ok; }
+	bool wait() { collect( true ); return result.ok; }
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_HEAP_SNAPSHOT_H
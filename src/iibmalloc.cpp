@@ -44,10 +44,728 @@ namespace nodecpp::iibmalloc
 
 #else
 
+#include <malloc_based_allocator.h>
+#include <algorithm>
+
 namespace nodecpp::iibmalloc
 {
 	std::atomic<uint16_t> SafeIibAllocator::allocatorIDBase;
 
+	std::atomic<uint64_t> EpochRegistry::globalEpoch( 0 );
+	std::atomic<EpochParticipant*> EpochRegistry::participants( nullptr );
+
+	EpochParticipant* EpochRegistry::acquireParticipant()
+	{
+		for ( EpochParticipant* p = participants.load( std::memory_order_acquire ); p != nullptr; p = p->next )
+		{
+			bool expected = false;
+			if ( !p->inUse.load( std::memory_order_relaxed ) && p->inUse.compare_exchange_strong( expected, true, std::memory_order_acq_rel ) )
+				return p;
+		}
+		// participants are never freed; they are not allocated with operator new since it may be routed to a per-thread heap
+		void* mem = nodecpp::StdRawAllocator::allocate<alignof(EpochParticipant)>( sizeof(EpochParticipant) );
+		if ( mem == nullptr )
+			throw std::bad_alloc();
+		EpochParticipant* p = new(mem) EpochParticipant;
+		p->state.store( 0, std::memory_order_relaxed );
+		p->inUse.store( true, std::memory_order_relaxed );
+		p->next = participants.load( std::memory_order_relaxed );
+		while ( !participants.compare_exchange_weak( p->next, p, std::memory_order_release, std::memory_order_relaxed ) )
+			;
+		return p;
+	}
+
+	void EpochRegistry::releaseParticipant( EpochParticipant* p )
+	{
+		p->state.store( 0, std::memory_order_relaxed );
+		p->inUse.store( false, std::memory_order_release );
+	}
+
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+	std::atomic<StatsSlot*> StatsRegistry::slots( nullptr );
+
+	StatsSlot* StatsRegistry::acquireSlot()
+	{
+		for ( StatsSlot* slot = slots.load( std::memory_order_acquire ); slot != nullptr; slot = slot->next )
+		{
+			bool expected = false;
+			if ( !slot->inUse.load( std::memory_order_relaxed ) && slot->inUse.compare_exchange_strong( expected, true, std::memory_order_acq_rel ) )
+				return slot; // its sequence goes on, so that a reader of the previous owner does not mix up snapshots
+		}
+		// as participants of EpochRegistry, slots are never freed and are not allocated with operator new
+		void* mem = nodecpp::StdRawAllocator::allocate<alignof(StatsSlot)>( sizeof(StatsSlot) );
+		if ( mem == nullptr )
+			throw std::bad_alloc();
+		StatsSlot* slot = new(mem) StatsSlot;
+		slot->sequence.store( 0, std::memory_order_relaxed );
+		for ( size_t i=0; i<StatsSlot::wordCount; ++i )
+			slot->words[i].store( 0, std::memory_order_relaxed );
+		slot->inUse.store( true, std::memory_order_relaxed );
+		slot->next = slots.load( std::memory_order_relaxed );
+		while ( !slots.compare_exchange_weak( slot->next, slot, std::memory_order_release, std::memory_order_relaxed ) )
+			;
+		return slot;
+	}
+
+	void StatsRegistry::releaseSlot( StatsSlot* slot )
+	{
+		slot->inUse.store( false, std::memory_order_release );
+	}
+
+	size_t StatsRegistry::collect( PublishedStats* out, size_t maxCount )
+	{
+		size_t cnt = 0;
+		for ( StatsSlot* slot = slots.load( std::memory_order_acquire ); slot != nullptr; slot = slot->next )
+		{
+			if ( !slot->inUse.load( std::memory_order_acquire ) )
+				continue;
+			PublishedStats stats;
+			if ( !read( slot, stats ) )
+				continue; // being published all the time; unlikely
+			if ( cnt < maxCount )
+				out[cnt] = stats;
+			++cnt;
+		}
+		return cnt;
+	}
+#endif // NODECPP_IIBMALLOC_STATS_REGISTRY
+
+	bool EpochRegistry::tryAdvance()
+	{
+		uint64_t e = globalEpoch.load( std::memory_order_acquire );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		for ( EpochParticipant* p = participants.load( std::memory_order_acquire ); p != nullptr; p = p->next )
+		{
+			uint64_t s = p->state.load( std::memory_order_acquire );
+			if ( ( s & 1 ) && ( s >> 1 ) != e )
+				return false;
+		}
+		globalEpoch.compare_exchange_strong( e, e + 1, std::memory_order_acq_rel ); // failure means someone else has advanced it
+		return true;
+	}
+
+	std::atomic<uintptr_t> ReservationArena::base( 0 );
+	std::atomic<uint32_t> ReservationArena::slots[ReservationArena::slotCount];
+	std::atomic<bool> ReservationArena::overflowed( false );
+	ReservationArena::ExternalRange ReservationArena::externalRanges[ReservationArena::maxExternalRanges];
+	std::atomic<size_t> ReservationArena::externalRangeCount( 0 );
+	std::mutex ReservationArena::mx;
+	size_t ReservationArena::searchStart = 0;
+	bool ReservationArena::reservationAttempted = false;
+
+	bool ReservationArena::reserveArena()
+	{
+		reservationAttempted = true;
+		// one extra slot to be able to align the arena by slot size
+		void* mem = VirtualMemory::AllocateAddressSpace( arenaSize + slotSize );
+		if ( mem == nullptr || mem == (void*)(-1) )
+		{
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Reserving 0x{:x} bytes for reservation arena failed; falling back to per-block reservations", arenaSize + slotSize );
+			return false;
+		}
+		uintptr_t b = ( reinterpret_cast<uintptr_t>( mem ) + slotSize - 1 ) & ~( slotSize - 1 );
+		base.store( b, std::memory_order_release );
+		return true;
+	}
+
+	void* ReservationArena::acquire( size_t size, uint16_t ownerID )
+	{
+		size_t count = ( size + slotSize - 1 ) >> slotSizeExp;
+		if ( count == 0 || count > slotCount )
+			return nullptr;
+		std::lock_guard<std::mutex> lock( mx );
+		if ( base.load( std::memory_order_relaxed ) == 0 )
+		{
+			if ( reservationAttempted || !reserveArena() )
+				return nullptr;
+		}
+		// next fit: from the last position to the end, then from the beginning
+		for ( size_t pass = 0; pass < 2; ++pass )
+		{
+			size_t from = pass == 0 ? searchStart : 0;
+			size_t to = pass == 0 ? slotCount : searchStart + count - 1;
+			if ( to > slotCount )
+				to = slotCount;
+			size_t runLength = 0;
+			for ( size_t i = from; i < to; ++i )
+			{
+				if ( slots[i].load( std::memory_order_relaxed ) & slotInUse )
+				{
+					runLength = 0;
+					continue;
+				}
+				if ( ++runLength == count )
+				{
+					size_t first = i + 1 - count;
+					for ( size_t j = first; j <= i; ++j )
+						slots[j].store( slotInUse | ownerID, std::memory_order_release );
+					searchStart = i + 1 == slotCount ? 0 : i + 1;
+					return reinterpret_cast<void*>( base.load( std::memory_order_relaxed ) + ( first << slotSizeExp ) );
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	bool ReservationArena::acquireAt( void* ptr, size_t size, uint16_t ownerID )
+	{
+		size_t count = ( size + slotSize - 1 ) >> slotSizeExp;
+		std::lock_guard<std::mutex> lock( mx );
+		uintptr_t b = base.load( std::memory_order_relaxed );
+		uintptr_t offset = reinterpret_cast<uintptr_t>( ptr ) - b;
+		if ( b == 0 || offset >= arenaSize || ( offset & ( slotSize - 1 ) ) != 0 || count > slotCount - ( offset >> slotSizeExp ) )
+			return false;
+		size_t first = offset >> slotSizeExp;
+		for ( size_t j = first; j < first + count; ++j )
+			if ( slots[j].load( std::memory_order_relaxed ) & slotInUse )
+				return false;
+		for ( size_t j = first; j < first + count; ++j )
+			slots[j].store( slotInUse | ownerID, std::memory_order_release );
+		return true;
+	}
+
+	void ReservationArena::release( void* ptr, size_t size )
+	{
+		size_t count = ( size + slotSize - 1 ) >> slotSizeExp;
+		size_t first = ( reinterpret_cast<uintptr_t>( ptr ) - base.load( std::memory_order_relaxed ) ) >> slotSizeExp;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, contains( ptr ) && first + count <= slotCount, "0x{:x}, 0x{:x} bytes", (uintptr_t)ptr, size );
+		std::lock_guard<std::mutex> lock( mx );
+		for ( size_t j = first; j < first + count; ++j )
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, slots[j].load( std::memory_order_relaxed ) & slotInUse, "slot {} is not in use", j );
+			slots[j].store( 0, std::memory_order_release );
+		}
+	}
+
+	bool ReservationArena::registerExternalRange( void* ptr, size_t size, uint16_t ownerID )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, size != 0 );
+		std::lock_guard<std::mutex> lock( mx );
+		for ( size_t i = 0; i < maxExternalRanges; ++i )
+		{
+			if ( externalRanges[i].size.load( std::memory_order_relaxed ) != 0 )
+				continue;
+			externalRanges[i].begin.store( reinterpret_cast<uintptr_t>( ptr ), std::memory_order_relaxed );
+			externalRanges[i].ownerID.store( ownerID, std::memory_order_relaxed );
+			externalRanges[i].size.store( size, std::memory_order_release );
+			if ( externalRangeCount.load( std::memory_order_relaxed ) <= i )
+				externalRangeCount.store( i + 1, std::memory_order_release );
+			return true;
+		}
+		return false;
+	}
+
+	void ReservationArena::unregisterExternalRange( void* ptr )
+	{
+		std::lock_guard<std::mutex> lock( mx );
+		size_t count = externalRangeCount.load( std::memory_order_relaxed );
+		for ( size_t i = 0; i < count; ++i )
+			if ( externalRanges[i].size.load( std::memory_order_relaxed ) != 0 && externalRanges[i].begin.load( std::memory_order_relaxed ) == reinterpret_cast<uintptr_t>( ptr ) )
+				externalRanges[i].size.store( 0, std::memory_order_release );
+		while ( count != 0 && externalRanges[count - 1].size.load( std::memory_order_relaxed ) == 0 )
+			--count;
+		externalRangeCount.store( count, std::memory_order_release );
+	}
+
+	int32_t ReservationArena::externalOwnerOf( const void* ptr )
+	{
+		size_t count = externalRangeCount.load( std::memory_order_acquire );
+		for ( size_t i = 0; i < count; ++i )
+		{
+			size_t size = externalRanges[i].size.load( std::memory_order_acquire );
+			if ( size != 0 && reinterpret_cast<uintptr_t>( ptr ) - externalRanges[i].begin.load( std::memory_order_relaxed ) < size )
+				return (int32_t)externalRanges[i].ownerID.load( std::memory_order_relaxed );
+		}
+		return noOwner;
+	}
+
+	bool PersistentPageSource::map( void* addr, size_t sz )
+	{
+#if defined NODECPP_LINUX
+		void* ret;
+		if ( addr != nullptr )
+		{
+			ret = mmap( addr, sz, PROT_NONE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0 );
+			if ( ret == MAP_FAILED )
+				return false;
+			if ( ret != addr ) // pre-4.17 Linux kernels take MAP_FIXED_NOREPLACE as a hint
+			{
+				munmap( ret, sz );
+				return false;
+			}
+		}
+		else
+		{
+			// one extra slot to be able to align the mapping by slot size
+			void* mem = mmap( nullptr, sz + slotSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+			if ( mem == MAP_FAILED )
+				return false;
+			uint8_t* aligned = reinterpret_cast<uint8_t*>( ( reinterpret_cast<uintptr_t>( mem ) + slotSize - 1 ) & ~( slotSize - 1 ) );
+			if ( aligned != mem )
+				munmap( mem, aligned - reinterpret_cast<uint8_t*>( mem ) );
+			munmap( aligned + sz, reinterpret_cast<uint8_t*>( mem ) + sz + slotSize - ( aligned + sz ) );
+			ret = mmap( aligned, sz, PROT_NONE, MAP_SHARED | MAP_FIXED, fd, 0 );
+			if ( ret != aligned )
+			{
+				munmap( aligned, sz );
+				return false;
+			}
+		}
+		base = reinterpret_cast<uint8_t*>( ret );
+		size = sz;
+		if ( mprotect( base, headerRegionSize, PROT_READ | PROT_WRITE ) != 0 )
+		{
+			munmap( base, size );
+			base = nullptr;
+			return false;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool PersistentPageSource::open( int fd_, bool ownFd, size_t capacity, uint64_t layout, bool& existing )
+	{
+		close();
+		fd = fd_;
+		ownsFd = ownFd;
+		detached = false;
+		searchStart = 0;
+#if defined NODECPP_LINUX
+		struct stat st;
+		if ( fstat( fd, &st ) != 0 )
+		{
+			close();
+			return false;
+		}
+		existing = st.st_size != 0;
+		if ( !existing )
+		{
+			size_t sz = headerRegionSize + ( ( capacity + slotSize - 1 ) & ~( slotSize - 1 ) );
+			if ( capacity == 0 || ftruncate( fd, (off_t)sz ) != 0 || !map( nullptr, sz ) )
+			{
+				close();
+				return false;
+			}
+			PersistentHeapHeader* header = reinterpret_cast<PersistentHeapHeader*>( base );
+			header->magic = PersistentHeapHeader::expectedMagic;
+			header->version = persistent_heap_version;
+			header->pointerSize = sizeof(void*);
+			header->layout = layout;
+			header->baseAddress = reinterpret_cast<uintptr_t>( base );
+			header->size = sz;
+			header->clean = 0;
+			header->imageSize = 0;
+		}
+		else
+		{
+			PersistentHeapHeader header;
+			if ( pread( fd, &header, sizeof(header), 0 ) != sizeof(header) || header.magic != PersistentHeapHeader::expectedMagic || header.version != persistent_heap_version || header.pointerSize != sizeof(void*) || header.layout != layout || header.size != (uint64_t)st.st_size || header.size <= headerRegionSize || ( header.baseAddress & ( slotSize - 1 ) ) != 0 )
+			{
+				nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "persistent heap: file is not a heap of this executable" );
+				close();
+				return false;
+			}
+			if ( header.clean != 1 )
+			{
+				nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "persistent heap: file has not been synced after its last modification" );
+				close();
+				return false;
+			}
+			if ( header.imageSize > headerRegionSize - sizeof(PersistentHeapHeader) || !map( reinterpret_cast<void*>( (uintptr_t)header.baseAddress ), (size_t)header.size ) )
+			{
+				nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "persistent heap: address range 0x{:x} (0x{:x} bytes) is not available", header.baseAddress, header.size );
+				close();
+				return false;
+			}
+		}
+		slotCount = ( size - headerRegionSize ) >> slotSizeExp;
+		slots = reinterpret_cast<uint8_t*>( calloc( slotCount, 1 ) );
+		if ( slots == nullptr )
+		{
+			close();
+			return false;
+		}
+		return true;
+#else
+		close();
+		return false;
+#endif
+	}
+
+	bool PersistentPageSource::open( const char* fileName, size_t capacity, uint64_t layout, bool& existing )
+	{
+#if defined NODECPP_LINUX
+		int f = ::open( fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0600 );
+		if ( f < 0 )
+			return false;
+		return open( f, true, capacity, layout, existing );
+#else
+		return false;
+#endif
+	}
+
+	void PersistentPageSource::close()
+	{
+#if defined NODECPP_LINUX
+		if ( base != nullptr )
+			munmap( base, size );
+		if ( fd >= 0 && ownsFd )
+			::close( fd );
+#endif
+		free( slots );
+		slots = nullptr;
+		slotCount = 0;
+		base = nullptr;
+		size = 0;
+		fd = -1;
+		ownsFd = false;
+	}
+
+	void* PersistentPageSource::acquire( size_t sz )
+	{
+		size_t count = ( sz + slotSize - 1 ) >> slotSizeExp;
+		if ( count == 0 || count > slotCount )
+			return nullptr;
+		// next fit, as in ReservationArena::acquire()
+		for ( size_t pass = 0; pass < 2; ++pass )
+		{
+			size_t from = pass == 0 ? searchStart : 0;
+			size_t to = pass == 0 ? slotCount : searchStart + count - 1;
+			if ( to > slotCount )
+				to = slotCount;
+			size_t runLength = 0;
+			for ( size_t i = from; i < to; ++i )
+			{
+				if ( slots[i] )
+				{
+					runLength = 0;
+					continue;
+				}
+				if ( ++runLength == count )
+				{
+					size_t first = i + 1 - count;
+					memset( slots + first, 1, count );
+					searchStart = i + 1 == slotCount ? 0 : i + 1;
+					return base + headerRegionSize + ( first << slotSizeExp );
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	bool PersistentPageSource::acquireAt( void* ptr, size_t sz )
+	{
+		size_t count = ( sz + slotSize - 1 ) >> slotSizeExp;
+		uintptr_t offset = reinterpret_cast<uintptr_t>( ptr ) - reinterpret_cast<uintptr_t>( base + headerRegionSize );
+		if ( !contains( ptr ) || ( offset & ( slotSize - 1 ) ) != 0 || count > slotCount - ( offset >> slotSizeExp ) )
+			return false;
+		size_t first = offset >> slotSizeExp;
+		for ( size_t j = first; j < first + count; ++j )
+			if ( slots[j] )
+				return false;
+		memset( slots + first, 1, count );
+		return true;
+	}
+
+	void PersistentPageSource::release( void* ptr, size_t sz )
+	{
+		size_t count = ( sz + slotSize - 1 ) >> slotSizeExp;
+		size_t first = ( reinterpret_cast<uintptr_t>( ptr ) - reinterpret_cast<uintptr_t>( base + headerRegionSize ) ) >> slotSizeExp;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, contains( ptr ) && first + count <= slotCount, "0x{:x}, 0x{:x} bytes", (uintptr_t)ptr, sz );
+		decommit( ptr, count << slotSizeExp );
+		memset( slots + first, 0, count );
+	}
+
+	bool PersistentPageSource::markClean( size_t imageSize )
+	{
+#if defined NODECPP_LINUX
+		PersistentHeapHeader* header = reinterpret_cast<PersistentHeapHeader*>( base );
+		header->imageSize = imageSize;
+		if ( msync( base, size, MS_SYNC ) != 0 ) // all content and metadata first
+			return false;
+		header->clean = 1;
+		return msync( base, headerRegionSize, MS_SYNC ) == 0;
+#else
+		return false;
+#endif
+	}
+
+	bool PersistentPageSource::markInUse()
+	{
+#if defined NODECPP_LINUX
+		PersistentHeapHeader* header = reinterpret_cast<PersistentHeapHeader*>( base );
+		header->clean = 0;
+		return msync( base, headerRegionSize, MS_SYNC ) == 0;
+#else
+		return false;
+#endif
+	}
+
+	std::atomic<uint64_t> SoftDirtyPages::clearCount( 0 );
+	std::atomic<int> SoftDirtyPages::supported( -1 );
+	static std::mutex softDirtyClearMx; // to keep order of clears and clearCount increments the same
+
+	bool SoftDirtyPages::checkSupport()
+	{
+#if defined NODECPP_LINUX
+		// pages of a new mapping are soft-dirty from the very beginning (if the kernel tracks the bits at all)
+		long pageSize = sysconf( _SC_PAGESIZE );
+		void* page = mmap( nullptr, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+		if ( page == MAP_FAILED )
+			return false;
+		*reinterpret_cast<volatile uint8_t*>( page ) = 1;
+		uint64_t entry = 0;
+		int fd = ::open( "/proc/self/pagemap", O_RDONLY | O_CLOEXEC );
+		bool ret = fd >= 0 && pread( fd, &entry, sizeof(entry), (off_t)( ( (uintptr_t)page / pageSize ) * sizeof(entry) ) ) == sizeof(entry) && ( entry & softDirtyBit ) != 0;
+		if ( fd >= 0 )
+			::close( fd );
+		munmap( page, pageSize );
+		return ret && access( "/proc/self/clear_refs", W_OK ) == 0;
+#else
+		return false;
+#endif
+	}
+
+	uint64_t SoftDirtyPages::clear()
+	{
+#if defined NODECPP_LINUX
+		if ( !isSupported() )
+			return 0;
+		std::lock_guard<std::mutex> lock( softDirtyClearMx );
+		int fd = ::open( "/proc/self/clear_refs", O_WRONLY | O_CLOEXEC );
+		if ( fd < 0 )
+			return 0;
+		bool ok = write( fd, "4", 1 ) == 1;
+		::close( fd );
+		return ok ? clearCount.fetch_add( 1, std::memory_order_acq_rel ) + 1 : 0;
+#else
+		return 0;
+#endif
+	}
+
+	uint64_t HeapSnapshot::getPrivateBytes()
+	{
+#if defined NODECPP_LINUX
+		// no stdio or allocations here: it is called in a child of a (maybe) multithreaded process
+		int fd = ::open( "/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC );
+		if ( fd < 0 )
+			return 0;
+		char buff[4096];
+		ssize_t sz = ::read( fd, buff, sizeof(buff) - 1 );
+		::close( fd );
+		if ( sz <= 0 )
+			return 0;
+		buff[sz] = 0;
+		uint64_t kb = 0;
+		for ( const char* line = buff; line != nullptr && *line; )
+		{
+			if ( strncmp( line, "Private_", 8 ) == 0 ) // Private_Clean, Private_Dirty
+			{
+				const char* p = strchr( line, ':' );
+				if ( p != nullptr )
+				{
+					for ( ++p; *p == ' '; ++p );
+					uint64_t val = 0;
+					for ( ; *p >= '0' && *p <= '9'; ++p )
+						val = val * 10 + ( *p - '0' );
+					kb += val;
+				}
+			}
+			line = strchr( line, '\n' );
+			if ( line != nullptr )
+				++line;
+		}
+		return kb * 1024;
+#else
+		return 0;
+#endif
+	}
+
+	uint64_t HeapSnapshot::getTimeUs()
+	{
+#if defined NODECPP_LINUX
+		timespec ts;
+		clock_gettime( CLOCK_MONOTONIC, &ts );
+		return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+		return 0;
+#endif
+	}
+
+	bool HeapSnapshot::collect( bool block )
+	{
+#if defined NODECPP_LINUX
+		if ( pid <= 0 )
+			return true;
+		int status = 0;
+		pid_t ret;
+		do {
+			ret = waitpid( pid, &status, block ? 0 : WNOHANG );
+		} while ( ret < 0 && errno == EINTR );
+		if ( ret == 0 )
+			return false; // still running
+		Result r;
+		bool reported = ret == pid && ::read( resultFd, &r, sizeof(r) ) == (ssize_t)sizeof(r);
+		::close( resultFd );
+		resultFd = -1;
+		pid = -1;
+		if ( !reported )
+			r = Result();
+		else if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+			r.ok = false;
+		result = r;
+		if ( !result.ok )
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "heap snapshot: writing failed" );
+		return true;
+#else
+		return true;
+#endif
+	}
+
+	namespace {
+	struct HeapImageRange
+	{
+		uint64_t address;
+		uint64_t size;
+		uint64_t dataOffset;
+		uint32_t kind;
+		bool operator < ( const HeapImageRange& other ) const { return address < other.address; }
+	};
+
+	struct HeapImageIndex
+	{
+		HeapImageRange* ranges = nullptr; // sorted by address
+		size_t count = 0;
+		FILE* f = nullptr;
+	};
+
+	bool addToHeapImageIndex( HeapImageIndex& index, size_t& capacity, const HeapImageRecord& rec, uint64_t dataOffset )
+	{
+		if ( index.count == capacity )
+		{
+			size_t newCapacity = capacity ? capacity * 2 : 1024;
+			void* newRanges = realloc( index.ranges, newCapacity * sizeof(HeapImageRange) );
+			if ( newRanges == nullptr )
+				return false;
+			index.ranges = reinterpret_cast<HeapImageRange*>( newRanges );
+			capacity = newCapacity;
+		}
+		index.ranges[index.count++] = { rec.address, rec.size, dataOffset, rec.kind };
+		return true;
+	}
+
+	// writes content of [address, address + size) as it is in image k of the chain
+	void writeResolvedRange( HeapImageWriter& w, HeapImageIndex* indexes, size_t k, uint64_t address, uint64_t size )
+	{
+		HeapImageIndex& index = indexes[k];
+		HeapImageRange key = { address, 0, 0, 0 };
+		HeapImageRange* r = std::upper_bound( index.ranges, index.ranges + index.count, key );
+		if ( r != index.ranges && (r - 1)->address + (r - 1)->size > address )
+			--r;
+		uint64_t end = address + size;
+		for ( ; address < end; ++r )
+		{
+			if ( r == index.ranges + index.count || r->address >= end )
+			{
+				w.writeZero( reinterpret_cast<void*>( (uintptr_t)address ), end - address ); // not committed at that point, i.e. never written
+				break;
+			}
+			if ( r->address > address )
+			{
+				w.writeZero( reinterpret_cast<void*>( (uintptr_t)address ), r->address - address );
+				address = r->address;
+			}
+			uint64_t partEnd = std::min( end, r->address + r->size );
+			if ( r->kind == (uint32_t)HeapImageRecordKind::data )
+				w.writeDataFromFile( reinterpret_cast<void*>( (uintptr_t)address ), partEnd - address, index.f, r->dataOffset + ( address - r->address ) );
+			else if ( r->kind == (uint32_t)HeapImageRecordKind::unchanged && k != 0 )
+				writeResolvedRange( w, indexes, k - 1, address, partEnd - address );
+			else
+				w.writeZero( reinterpret_cast<void*>( (uintptr_t)address ), partEnd - address );
+			address = partEnd;
+		}
+	}
+	} // anonymous namespace
+
+	bool compactHeapImages( const char* const* fileNames, size_t count, const char* outFileName )
+	{
+		if ( count == 0 )
+			return false;
+		// all images but the last one are indexed; the last one is copied with its unchanged ranges resolved via indexes
+		HeapImageIndex* indexes = reinterpret_cast<HeapImageIndex*>( calloc( count, sizeof(HeapImageIndex) ) );
+		if ( indexes == nullptr )
+			return false;
+		constexpr size_t maxMetaSize = 0x10000;
+		void* meta = malloc( maxMetaSize );
+		bool ok = meta != nullptr;
+		HeapImageHeader first{};
+		HeapImageWriter w;
+		HeapImageReader last;
+		for ( size_t k=0; ok && k<count; ++k )
+		{
+			HeapImageReader r;
+			HeapImageHeader header;
+			HeapImageReader& reader = k + 1 < count ? r : last;
+			ok = reader.openImage( fileNames[k], header );
+			if ( k == 0 )
+				first = header;
+			ok = ok && header.chainID != 0 && header.chainID == first.chainID && header.layout == first.layout && header.sequence == k;
+			if ( !ok || k + 1 == count )
+				break;
+			indexes[k].f = fopen( fileNames[k], "rb" );
+			ok = indexes[k].f != nullptr;
+			size_t capacity = 0;
+			HeapImageRecord rec;
+			uint64_t dataOffset = 0;
+			while ( ok && ( ok = r.nextRecord( rec, meta, maxMetaSize, dataOffset ) ) && rec.kind != (uint32_t)HeapImageRecordKind::end )
+				if ( rec.kind == (uint32_t)HeapImageRecordKind::data || rec.kind == (uint32_t)HeapImageRecordKind::zero || rec.kind == (uint32_t)HeapImageRecordKind::unchanged )
+					ok = addToHeapImageIndex( indexes[k], capacity, rec, dataOffset );
+			ok = ok && r.close();
+			if ( ok )
+				std::sort( indexes[k].ranges, indexes[k].ranges + indexes[k].count );
+		}
+		FILE* lastFile = ok ? fopen( fileNames[count - 1], "rb" ) : nullptr;
+		ok = ok && lastFile != nullptr && w.open( outFileName, first.layout, first.chainID, 0 );
+		while ( ok )
+		{
+			HeapImageRecord rec;
+			uint64_t dataOffset = 0;
+			if ( !last.nextRecord( rec, meta, maxMetaSize, dataOffset ) )
+				ok = false;
+			else if ( rec.kind == (uint32_t)HeapImageRecordKind::end )
+				break;
+			else if ( rec.kind == (uint32_t)HeapImageRecordKind::meta )
+				w.writeMeta( meta, rec.metaSize );
+			else if ( rec.kind == (uint32_t)HeapImageRecordKind::reservation )
+				w.writeReservation( reinterpret_cast<void*>( (uintptr_t)rec.address ), rec.size, meta, rec.metaSize );
+			else if ( rec.kind == (uint32_t)HeapImageRecordKind::data )
+				w.writeDataFromFile( reinterpret_cast<void*>( (uintptr_t)rec.address ), rec.size, lastFile, dataOffset );
+			else if ( rec.kind == (uint32_t)HeapImageRecordKind::zero )
+				w.writeZero( reinterpret_cast<void*>( (uintptr_t)rec.address ), rec.size );
+			else if ( rec.kind == (uint32_t)HeapImageRecordKind::pointerLocations )
+				w.writePointerLocations( reinterpret_cast<const uint64_t*>( meta ), rec.metaSize / sizeof(uint64_t) );
+			else if ( rec.kind == (uint32_t)HeapImageRecordKind::unchanged && count > 1 )
+				writeResolvedRange( w, indexes, count - 2, rec.address, rec.size );
+			else
+				ok = false;
+		}
+		ok = last.close() && ok;
+		ok = ok && w.close(); // otherwise the writer removes its temporary file
+		if ( lastFile != nullptr )
+			fclose( lastFile );
+		for ( size_t k=0; k<count; ++k )
+		{
+			if ( indexes[k].f != nullptr )
+				fclose( indexes[k].f );
+			free( indexes[k].ranges );
+		}
+		free( indexes );
+		free( meta );
+		return ok;
+	}
+
 	thread_local ThreadLocalAllocatorT* g_CurrentAllocManager = nullptr;
 
 	ThreadLocalAllocatorT* setCurrneAllocator( ThreadLocalAllocatorT* allocator )
@@ -56,6 +774,183 @@ namespace nodecpp::iibmalloc
 		g_CurrentAllocManager = allocator;
 		return ret;
 	}
+
+	std::atomic<bool> ThreadHeaps::enabled( false );
+
+	namespace {
+	// orphans are kept in a plain malloc()-ed array, as operator new may lead here
+	std::mutex orphanMx;
+	ThreadLocalAllocatorT** orphans = nullptr;
+	size_t orphanCount_ = 0;
+	size_t orphanCapacity = 0;
+	// blocks deleted while their heap was not an orphan (and not current for the deleting thread); they are
+	// deallocated when the heap becomes an orphan (see pushOrphan()); kept out of band, as the heap may be gone by then
+	void** deferredBlocks = nullptr;
+	size_t deferredCount = 0;
+	size_t deferredCapacity = 0;
+
+	static_assert( alignof(ThreadLocalAllocatorT) <= alignof(std::max_align_t) );
+
+	// returns a new detached heap
+	ThreadLocalAllocatorT* createHeap()
+	{
+		void* mem = malloc( sizeof(ThreadLocalAllocatorT) );
+		if ( mem == nullptr )
+			throw std::bad_alloc();
+		ThreadLocalAllocatorT* heap = new(mem) ThreadLocalAllocatorT;
+		heap->detachFromThread();
+		return heap;
+	}
+
+	// returns a detached orphan, or nullptr; called under orphanMx
+	ThreadLocalAllocatorT* removeOrphan( size_t i )
+	{
+		ThreadLocalAllocatorT* ret = orphans[i];
+		orphans[i] = orphans[--orphanCount_];
+		return ret;
+	}
+
+	// returns a detached orphan, or nullptr
+	ThreadLocalAllocatorT* popOrphan()
+	{
+		std::lock_guard<std::mutex> lock( orphanMx );
+		return orphanCount_ != 0 ? removeOrphan( orphanCount_ - 1 ) : nullptr;
+	}
+
+	// returns the detached orphan with ownerID; if there is none, ptr is deferred (see deferredBlocks), and nullptr is returned
+	ThreadLocalAllocatorT* popOwnerOrDefer( int32_t ownerID, void* ptr )
+	{
+		std::lock_guard<std::mutex> lock( orphanMx );
+		for ( size_t i=0; i<orphanCount_; ++i )
+			if ( orphans[i]->allocatorID() == ownerID )
+				return removeOrphan( i );
+		if ( deferredCount == deferredCapacity )
+		{
+			size_t newCapacity = deferredCapacity ? deferredCapacity * 2 : 64;
+			void** newDeferred = reinterpret_cast<void**>( realloc( deferredBlocks, newCapacity * sizeof(void*) ) );
+			if ( newDeferred == nullptr )
+				return nullptr; // the block is leaked
+			deferredBlocks = newDeferred;
+			deferredCapacity = newCapacity;
+		}
+		deferredBlocks[deferredCount++] = ptr;
+		return nullptr;
+	}
+
+	// moves up to maxCount deferred blocks of a given heap to 'blocks'; returns their number; called under orphanMx
+	size_t takeDeferred( int32_t ownerID, void** blocks, size_t maxCount )
+	{
+		size_t count = 0;
+		for ( size_t i=0; i<deferredCount && count<maxCount; )
+			if ( getOwnerAllocatorID( deferredBlocks[i] ) == ownerID )
+			{
+				blocks[count++] = deferredBlocks[i];
+				deferredBlocks[i] = deferredBlocks[--deferredCount];
+			}
+			else
+				++i;
+		return count;
+	}
+
+	// heap must be detached; it becomes an orphan only when there are no deferred blocks of it any more
+	void pushOrphan( ThreadLocalAllocatorT* heap )
+	{
+		std::unique_lock<std::mutex> lock( orphanMx );
+		constexpr size_t maxBatch = 64;
+		void* blocks[maxBatch];
+		for ( size_t count = takeDeferred( heap->allocatorID(), blocks, maxBatch ); count != 0; count = takeDeferred( heap->allocatorID(), blocks, maxBatch ) )
+		{
+			lock.unlock();
+			heap->attachToThread( false );
+			for ( size_t i=0; i<count; ++i )
+				heap->deallocate( blocks[i] );
+			heap->detachFromThread();
+			lock.lock();
+		}
+		if ( orphanCount_ == orphanCapacity )
+		{
+			size_t newCapacity = orphanCapacity ? orphanCapacity * 2 : 16;
+			ThreadLocalAllocatorT** newOrphans = reinterpret_cast<ThreadLocalAllocatorT**>( realloc( orphans, newCapacity * sizeof(ThreadLocalAllocatorT*) ) );
+			if ( newOrphans == nullptr )
+			{
+				// the heap is leaked rather than destroyed; see ThreadHeaps
+				nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "thread heaps: out of memory for orphan list" );
+				return;
+			}
+			orphans = newOrphans;
+			orphanCapacity = newCapacity;
+		}
+		orphans[orphanCount_++] = heap;
+	}
+
+	struct ThreadHeapHolder
+	{
+		ThreadLocalAllocatorT* heap = nullptr;
+		bool acquiring = false;
+		~ThreadHeapHolder()
+		{
+			acquiring = true; // no new heap for deallocations by destructors of other thread_local objects
+			if ( heap == nullptr )
+				return;
+			heap->detachFromThread();
+			pushOrphan( heap );
+			heap = nullptr;
+		}
+	};
+	thread_local ThreadHeapHolder threadHeapHolder;
+	} // anonymous namespace
+
+	ThreadLocalAllocatorT* ThreadHeaps::acquireForCurrentThread()
+	{
+		if ( !isEnabled() )
+			return nullptr;
+		ThreadHeapHolder& holder = threadHeapHolder;
+		if ( holder.acquiring || holder.heap != nullptr ) // recursion while making a heap, or the thread has reset its current allocator
+			return nullptr;
+		holder.acquiring = true;
+		ThreadLocalAllocatorT* heap = popOrphan();
+		if ( heap == nullptr )
+			heap = createHeap();
+		heap->attachToThread( true );
+		holder.heap = heap;
+		holder.acquiring = false;
+		return heap;
+	}
+
+	void ThreadHeaps::deallocateToOrphan( void* ptr ) noexcept
+	{
+		int32_t ownerID = getOwnerAllocatorID( ptr );
+		if ( ownerID == ReservationArena::noOwner ) // the heap is gone together with its memory
+			return;
+		// a block only goes back to its own heap; if that one is in use by some thread, the block waits for it to become an orphan
+		ThreadLocalAllocatorT* heap = popOwnerOrDefer( ownerID, ptr );
+		if ( heap == nullptr )
+			return;
+		heap->attachToThread( false );
+		heap->deallocate( ptr );
+		heap->detachFromThread();
+		pushOrphan( heap );
+	}
+
+	ThreadLocalAllocatorT* ThreadHeaps::adoptOrphan()
+	{
+		ThreadLocalAllocatorT* heap = popOrphan();
+		if ( heap != nullptr )
+			heap->attachToThread( false );
+		return heap;
+	}
+
+	void ThreadHeaps::abandon( ThreadLocalAllocatorT* heap )
+	{
+		heap->detachFromThread();
+		pushOrphan( heap );
+	}
+
+	size_t ThreadHeaps::orphanCount()
+	{
+		std::lock_guard<std::mutex> lock( orphanMx );
+		return orphanCount_;
+	}
 }
 
 using namespace nodecpp::iibmalloc;
@@ -70,7 +965,7 @@ using namespace nodecpp::iibmalloc;
 
 void* operator new(std::size_t count)
 {
-	if ( g_CurrentAllocManager )
+	if ( g_CurrentAllocManager || ThreadHeaps::acquireForCurrentThread() )
 	{
 		return g_CurrentAllocManager->allocateAligned<__STDCPP_DEFAULT_NEW_ALIGNMENT__>(count);
 	}
@@ -91,7 +986,7 @@ void* operator new(std::size_t count)
 void* operator new(std::size_t count, std::align_val_t al)
 {
 	void* ret;
-	if ( g_CurrentAllocManager )
+	if ( g_CurrentAllocManager || ThreadHeaps::acquireForCurrentThread() )
 	{
 		NODECPP_ASSERT( nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::pedantic, (size_t)al <= ThreadLocalAllocatorT::maximalSupportedAlignment, "{} vs. {}", (size_t)al, ThreadLocalAllocatorT::maximalSupportedAlignment );
 		ret = g_CurrentAllocManager->allocateAligned<NODECPP_MAX_SUPPORTED_ALIGNMENT_FOR_NEW>(count);
@@ -107,7 +1002,7 @@ void* operator new(std::size_t count, std::align_val_t al)
 
 void* operator new[](std::size_t count)
 {
-	if ( g_CurrentAllocManager )
+	if ( g_CurrentAllocManager || ThreadHeaps::acquireForCurrentThread() )
 		return g_CurrentAllocManager->allocateAligned<__STDCPP_DEFAULT_NEW_ALIGNMENT__>(count);
 	else
 	{
@@ -121,7 +1016,7 @@ void* operator new[](std::size_t count)
 void* operator new[](std::size_t count, std::align_val_t al)
 {
 	void* ret;
-	if ( g_CurrentAllocManager )
+	if ( g_CurrentAllocManager || ThreadHeaps::acquireForCurrentThread() )
 	{
 		NODECPP_ASSERT( nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::pedantic, (size_t)al <= ThreadLocalAllocatorT::maximalSupportedAlignment, "{} vs. {}", (size_t)al, ThreadLocalAllocatorT::maximalSupportedAlignment );
 		ret = g_CurrentAllocManager->allocateAligned<NODECPP_MAX_SUPPORTED_ALIGNMENT_FOR_NEW>(count);
@@ -135,11 +1030,52 @@ void* operator new[](std::size_t count, std::align_val_t al)
 	return ret; 
 }
 
+// memory allocated before an allocator was set for this thread comes from malloc();
+// unless some reservation has missed the arena, arena membership tells one from another
+static NODECPP_FORCEINLINE
+bool isIibmallocPointer(void* ptr) noexcept
+{
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+	return ReservationArena::contains(ptr) || ReservationArena::hasOverflowed();
+#else
+	return true;
+#endif
+}
+
+// with automatic thread heaps (see ThreadHeaps), a thread may have no heap (yet, or any more) while deleting a block of another one
+static NODECPP_FORCEINLINE
+bool isOrphanedIibmallocPointer(void* ptr) noexcept
+{
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+	return ThreadHeaps::isEnabled() && ReservationArena::contains(ptr);
+#else
+	return false;
+#endif
+}
+
+// ...and a thread that does have one may still be deleting a block of another (live or orphaned) heap
+static NODECPP_FORCEINLINE
+bool isForeignIibmallocPointer(void* ptr) noexcept
+{
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+	return ThreadHeaps::isForeignBlock(g_CurrentAllocManager, ptr);
+#else
+	return false;
+#endif
+}
+
 static NODECPP_FORCEINLINE
 void operator_delete_impl(void* ptr) noexcept
 {
-	if ( g_CurrentAllocManager )
-		g_CurrentAllocManager->deallocate(ptr);
+	if ( g_CurrentAllocManager && isIibmallocPointer(ptr) )
+	{
+		if ( isForeignIibmallocPointer(ptr) )
+			ThreadHeaps::deallocateToOrphan(ptr);
+		else
+			g_CurrentAllocManager->deallocate(ptr);
+	}
+	else if ( isOrphanedIibmallocPointer(ptr) )
+		ThreadHeaps::deallocateToOrphan(ptr);
 	else
 		free(ptr);
 }
@@ -147,11 +1083,16 @@ void operator_delete_impl(void* ptr) noexcept
 static NODECPP_FORCEINLINE
 void operator_delete_impl(void* ptr, std::align_val_t al) noexcept
 {
-	if ( g_CurrentAllocManager )
+	if ( g_CurrentAllocManager && isIibmallocPointer(ptr) )
 	{
 		NODECPP_ASSERT( nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::pedantic, (size_t)al <= ThreadLocalAllocatorT::maximalSupportedAlignment, "{} vs. {}", (size_t)al, ThreadLocalAllocatorT::maximalSupportedAlignment );
-		g_CurrentAllocManager->deallocate(ptr);
+		if ( isForeignIibmallocPointer(ptr) )
+			ThreadHeaps::deallocateToOrphan(ptr);
+		else
+			g_CurrentAllocManager->deallocate(ptr);
 	}
+	else if ( isOrphanedIibmallocPointer(ptr) )
+		ThreadHeaps::deallocateToOrphan(ptr);
 	else
 	{
 		NODECPP_ASSERT( nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::pedantic, (size_t)al <= NODECPP_MAX_SUPPORTED_ALIGNMENT_FOR_NEW, "{} vs. {}", (size_t)al, NODECPP_MAX_SUPPORTED_ALIGNMENT_FOR_NEW );
@@ -216,62 +1157,4 @@ void operator delete[]( void* ptr, std::size_t sz, std::align_val_t al ) noexcep
 //void operator delete[](void* ptr, std::align_val_t al) noexcept;
 #endif
 
-
-
-
-//void SerializableAllocatorBase::deserialize(const std::string& fileName)
-//{
-//	assert(false);//TODO
-//	/* On replay we avoid using heap before mmap
-//		* so we have the best chances that heap address
-//		* we need does not get used.
-//		* So we read the header on the stack
-//		*/
-//	assert(!heap);
-//	allocLog("SerializableAllocatorBase::deserialize fileName='{}'", fileName);
-//
-//	//int fd = open(fileName.c_str(), O_RDONLY);
-//	//assert(fd != -1);
-//	std::wstring wsTmp(fileName.begin(), fileName.end());
-//	HANDLE fHandle = CreateFile(wsTmp.c_str(),
-//		GENERIC_READ,
-//		0,
-//		NULL,
-//		OPEN_EXISTING,
-//		FILE_ATTRIBUTE_NORMAL,
-//		NULL);
-//	assert(fHandle != INVALID_HANDLE_VALUE);
-//	
-//	//First read header to a temporary location
-//	Heap tmp;
-//	//ssize_t c = read(fd, &tmp, sizeof(tmp));
-//	//assert(c == sizeof(tmp));
-//	DWORD readed = 0;
-//	BOOL r = ReadFile(fHandle, &tmp, sizeof(tmp), &readed, NULL);
-//	assert(r && readed == sizeof(tmp));
-//	assert(tmp.magic == SerializableAllocatorMagic.asUint);
-//// 		assert(tmp->usedSize <= bufferSize);
-//	
-//	//void* ptr = mmap(tmp.begin, tmp.allocSize, PROT_READ|PROT_WRITE,
-//	//					MAP_PRIVATE|MAP_NORESERVE/*|MAP_FIXED*/, fd, 0);
-//
-//	//Now we can reserve all memory
-////	void* ptr = VirtualMemory::reserve(reinterpret_cast<void*>(tmp.begin), tmp.getReservedSize());
-//	
-//	//Last, reset file and re-read everything
-//	DWORD p = SetFilePointer(fHandle, 0, 0, FILE_BEGIN);
-//	assert(p != INVALID_SET_FILE_POINTER);
-//
-//	
-//	//BOOL rf = ReadFile(fHandle, ptr, static_cast<DWORD>(tmp.getReservedSize()), &readed, NULL);
-//	//assert(rf && static_cast<size_t>(readed) == tmp.getReservedSize());
-//
-//	CloseHandle(fHandle);
-//
-////	heap = reinterpret_cast<Heap*>(ptr);
-//	//allocLog("Aslr anchorPoint {}", (void*)&anchorPoint);
-//	//arena->fixAslrVtables(&anchorPoint);
-//	//arenaEnd = reinterpret_cast<uint8_t*>(ptr) + tmp.getReservedSize();
-//}
-
 #endif // NODECPP_NOT_USING_IIBMALLOC
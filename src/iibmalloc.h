@@ -46,11 +46,28 @@
 
 #include "iibmalloc_common.h"
 #include "page_management.h"
-
+#include "heap_image.h"
+#include "heap_snapshot.h"
+#include <chrono>
+#include <thread>
+
+//#define NODECPP_IIBMALLOC_HEAP_PROFILER // sampling heap profiler; see heap_profiler.h
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+#include "heap_profiler.h"
+#endif
+//#define NODECPP_IIBMALLOC_ALLOCATION_TRACE // binary allocation trace recorder; see allocation_trace.h
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+#include "allocation_trace.h"
+#endif
+//#define NODECPP_IIBMALLOC_STATS_REGISTRY // stats published for reading from other threads; see stats_registry.h
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+#include "stats_registry.h"
+#endif
+//#define NODECPP_IIBMALLOC_OUT_OF_BAND_ZOMBIE_LINKS // zombieable blocks without prefix; see zombie_list.h
+#include "zombie_list.h"
+#include "epoch_reclamation.h"
 #ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
-#include <allocator_template.h>
-#include <malloc_based_allocator.h>
-#include <map>
+#include "zombie_set.h"
 #endif
 
 
@@ -160,6 +177,61 @@ public:
 	}
 };
 
+// dense array of trivially copyable items; grows by doubling, order is not preserved on removal
+template<class BasePageAllocator, class ItemT>
+class ArrayInPages : public BasePageAllocator
+{
+	ItemT* items = nullptr;
+	size_t count = 0;
+	size_t capacity = 0;
+
+	void grow()
+	{
+		size_t newCapacity = capacity ? capacity * 2 : PAGE_SIZE_BYTES / sizeof( ItemT );
+		ItemT* newItems = reinterpret_cast<ItemT*>( this->getFreeBlockNoCache( newCapacity * sizeof( ItemT ) ) );
+		if ( count )
+			memcpy( newItems, items, count * sizeof( ItemT ) );
+		if ( items )
+			this->freeChunkNoCache( items, capacity * sizeof( ItemT ) );
+		items = newItems;
+		capacity = newCapacity;
+	}
+
+public:
+	void initialize( uint8_t blockSizeExp )
+	{
+		BasePageAllocator::initialize( blockSizeExp );
+		items = nullptr;
+		count = 0;
+		capacity = 0;
+	}
+	size_t size() const { return count; }
+	ItemT& operator[]( size_t idx ) { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, idx < count ); return items[idx]; }
+	// returns index of the new item
+	size_t pushBack( ItemT item )
+	{
+		if ( count == capacity )
+			grow();
+		items[count] = item;
+		return count++;
+	}
+	// the last item takes place of the removed one
+	void swapRemove( size_t idx )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, idx < count );
+		items[idx] = items[--count];
+	}
+	void deinitialize()
+	{
+		if ( items )
+			this->freeChunkNoCache( items, capacity * sizeof( ItemT ) );
+		items = nullptr;
+		count = 0;
+		capacity = 0;
+		BasePageAllocator::deinitialize();
+	}
+};
+
 template<class BasePageAllocator, size_t bucket_cnt_exp, size_t reservation_size_exp, size_t commit_page_cnt_exp, size_t multipage_page_cnt_exp>
 class SoundingAddressPageAllocator : public BasePageAllocator
 {
@@ -192,12 +264,24 @@ class SoundingAddressPageAllocator : public BasePageAllocator
 	};
 	CollectionInPages<BasePageAllocator,PageBlockDescriptor> pageBlockDescriptors;
 	PageBlockDescriptor pageBlockListStart;
+
+	// serialized state (see serialize())
+	struct PageBlockListImage
+	{
+		uint64_t blockCount;
+		uint64_t indexHead[ bucket_cnt ]; // position in the list of blocks; 0 stands for pageBlockListStart
+	};
+	struct PageBlockImage
+	{
+		uint16_t nextToUse[ bucket_cnt ];
+		uint16_t nextToCommit[ bucket_cnt ];
+	};
 	PageBlockDescriptor* pageBlockListCurrent = nullptr;
 	PageBlockDescriptor* indexHead[bucket_cnt] = {nullptr};
 
 	void* getNextBlock()
 	{
-		void* pages = this->AllocateAddressSpace( reservation_size );
+		void* pages = this->ReserveAddressSpace( reservation_size );
 		return pages;
 	}
 
@@ -289,8 +373,12 @@ public:
 		resetLists();
 	}
 
-	void commitRangeOfPageIndexes( void* blockptr, size_t bucketIdx, size_t pageIdx, size_t rangeSize )
+	// calls f( start, size ) for each run of adjacent pages among given pages of a bucket
+	template<class F>
+	static void doForEachSegment( void* blockptr, size_t bucketIdx, size_t pageIdx, size_t rangeSize, F&& f )
 	{
+		if ( rangeSize == 0 )
+			return;
 		uint8_t* start = reinterpret_cast<uint8_t*>( idxToPageAddr( blockptr, bucketIdx, pageIdx ) );
 		uint8_t* prevNext = start;
 		uint8_t* next;
@@ -304,12 +392,17 @@ public:
 			}
 			else
 			{
-				this->CommitMemory( start, prevNext - start + PAGE_SIZE_BYTES );
+				f( start, prevNext - start + PAGE_SIZE_BYTES );
 				start = next;
 				prevNext = next;
 			}
 		}
-		this->CommitMemory( start, prevNext - start + PAGE_SIZE_BYTES );
+		f( start, prevNext - start + PAGE_SIZE_BYTES );
+	}
+
+	void commitRangeOfPageIndexes( void* blockptr, size_t bucketIdx, size_t pageIdx, size_t rangeSize )
+	{
+		doForEachSegment( blockptr, bucketIdx, pageIdx, rangeSize, [this]( uint8_t* start, size_t sz ) { this->CommitMemory( start, sz ); } );
 	}
 
 	void* getPage( size_t idx )
@@ -413,6 +506,71 @@ public:
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, mpData.sz1 + mpData.sz2 == ( multipage_page_cnt << PAGE_SIZE_EXP ) );
 	}
 
+	const BlockStats& getDescriptorStats() const { return pageBlockDescriptors.getStats(); }
+
+	// per block: reservation with (used, committed) page counts of each bucket; pages in use are written with their content
+	void serialize( HeapImageWriter& w )
+	{
+		PageBlockListImage listImage;
+		listImage.blockCount = 0;
+		for ( PageBlockDescriptor* pb = pageBlockListStart.next; pb; pb = pb->next )
+			++(listImage.blockCount);
+		for ( size_t i=0; i<bucket_cnt; ++i )
+		{
+			listImage.indexHead[i] = 0;
+			for ( PageBlockDescriptor* pb = &pageBlockListStart; pb != indexHead[i]; pb = pb->next )
+				++(listImage.indexHead[i]);
+		}
+		w.writeMeta( &listImage, sizeof(listImage) );
+		for ( PageBlockDescriptor* pb = pageBlockListStart.next; pb; pb = pb->next )
+		{
+			PageBlockImage blockImage;
+			memcpy( blockImage.nextToUse, pb->nextToUse, sizeof( uint16_t) * bucket_cnt );
+			memcpy( blockImage.nextToCommit, pb->nextToCommit, sizeof( uint16_t) * bucket_cnt );
+			w.writeReservation( pb->blockAddress, reservation_size, &blockImage, sizeof(blockImage) );
+			for ( size_t i=0; i<bucket_cnt; ++i )
+			{
+				doForEachSegment( pb->blockAddress, i, 0, pb->nextToUse[i], [&w]( uint8_t* start, size_t sz ) { w.writeData( start, sz ); } );
+				doForEachSegment( pb->blockAddress, i, pb->nextToUse[i], pb->nextToCommit[i] - pb->nextToUse[i], [&w]( uint8_t* start, size_t sz ) { w.writeZero( start, sz ); } );
+			}
+		}
+	}
+
+	// to be called on a just initialized allocator; with relocation, reservations are placed anywhere (see HeapImageReader::readReservation())
+	bool deserialize( HeapImageReader& r, HeapRelocation* relocation = nullptr )
+	{
+		PageBlockListImage listImage;
+		if ( !r.readMeta( &listImage, sizeof(listImage) ) )
+			return false;
+		for ( uint64_t k=0; k<listImage.blockCount; ++k )
+		{
+			PageBlockImage blockImage;
+			size_t sz = reservation_size;
+			void* block = r.readReservation( *this, sz, &blockImage, sizeof(blockImage), relocation );
+			if ( block == nullptr )
+				return false;
+			PageBlockDescriptor* pb = pageBlockDescriptors.createNew();
+			pb->blockAddress = block;
+			memcpy( pb->nextToUse, blockImage.nextToUse, sizeof( uint16_t) * bucket_cnt );
+			memcpy( pb->nextToCommit, blockImage.nextToCommit, sizeof( uint16_t) * bucket_cnt );
+			pb->next = nullptr;
+			pageBlockListCurrent->next = pb;
+			pageBlockListCurrent = pb;
+			for ( size_t i=0; i<bucket_cnt; ++i )
+				if ( pb->nextToUse[i] > pb->nextToCommit[i] || pb->nextToCommit[i] > pages_per_bucket )
+					return false;
+		}
+		for ( size_t i=0; i<bucket_cnt; ++i )
+		{
+			if ( listImage.indexHead[i] > listImage.blockCount )
+				return false;
+			indexHead[i] = &pageBlockListStart;
+			for ( uint64_t k=0; k<listImage.indexHead[i]; ++k )
+				indexHead[i] = indexHead[i]->next;
+		}
+		return true;
+	}
+
 	void freePage( MemoryBlockListItem* chk )
 	{
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, false );
@@ -426,7 +584,7 @@ public:
 		{
 //nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "in block 0x{:x} about to delete 0x{:x} of size 0x{:x}", (size_t)( next ), (size_t)( next->blockAddress ), PAGE_SIZE_BYTES * bucket_cnt );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, next->blockAddress );
-			this->freeChunkNoCache( reinterpret_cast<MemoryBlockListItem*>( next->blockAddress ), reservation_size );
+			this->freeReservationNoCache( next->blockAddress, reservation_size );
 			PageBlockDescriptor* tmp = next->next;
 //			delete next;
 			next = tmp;
@@ -464,6 +622,9 @@ public:
 		void setPrevInBlock( AnyChunkHeader* prev_ ) { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ((uintptr_t)prev_ & PAGE_SIZE_MASK) == 0 ); prev = ( (uintptr_t)prev_ & ~(uintptr_t)(PAGE_SIZE_MASK) ) + (prev & ((uintptr_t)(PAGE_SIZE_MASK))); }
 		uint16_t getPageCount() const { return prev & ((uintptr_t)(PAGE_SIZE_MASK)); }
 		bool isFree() const { return next & ((uintptr_t)(PAGE_SIZE_MASK)); }
+		// chunks that are not in a block (page count 0) keep their size in 'prev' and their position in the list of such chunks in 'next'
+		size_t getLargeChunkIndex() const { return next >> PAGE_SIZE_EXP; }
+		void setLargeChunkIndex( size_t idx ) { next = ((uintptr_t)idx) << PAGE_SIZE_EXP; }
 		void set( AnyChunkHeader* prevInBlock_, AnyChunkHeader* nextInBlock_, uint16_t pageCount, bool isFree )
 		{
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ((uintptr_t)prevInBlock_ & PAGE_SIZE_MASK) == 0 );
@@ -481,6 +642,7 @@ public:
 private:
 //	std::vector<AnyChunkHeader*> blockList;
 	CollectionInPages<BasePageAllocator,AnyChunkHeader*> blocks;
+	ArrayInPages<BasePageAllocator,AnyChunkHeader*> largeChunks; // chunks above max_pages, each one in a separate reservation
 
 	struct FreeChunkHeader : public AnyChunkHeader
 	{
@@ -489,6 +651,14 @@ private:
 	};
 	FreeChunkHeader* freeListBegin[ max_pages + 1 ] = {nullptr};
 
+	// serialized state (see serialize())
+	struct BulkImage
+	{
+		uint64_t blockCount;
+		uint64_t largeChunkCount;
+		FreeChunkHeader* freeListBegin[ max_pages + 1 ];
+	};
+
 	void removeFromFreeList( FreeChunkHeader* item )
 	{
 		if ( item->prevFree )
@@ -552,8 +722,8 @@ private:
 #ifdef BULKALLOCATOR_HEAVY_DEBUG
 	void dbgValidateAllBlocks()
 	{
-		class F { private: BulkAllocator<BasePageAllocator, commited_block_size, max_pages>* me; public: F(BulkAllocator<BasePageAllocator, commited_block_size, max_pages>*me_) {me = me_;} void f(AnyChunkHeader* h) {NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, blockList[i] != nullptr ); me->dbgValidateBlock( h ); } }; F f(this);
-		blocks.doForEachBlock( f );
+		class F { private: BulkAllocator<BasePageAllocator, commited_block_size, max_pages>* me; public: F(BulkAllocator<BasePageAllocator, commited_block_size, max_pages>*me_) {me = me_;} void f(AnyChunkHeader* h) {NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h != nullptr ); me->dbgValidateBlock( h ); } }; F f(this);
+		blocks.doForEach( f );
 /*		for ( size_t i=0; i<blockList.size(); ++i )
 		{
 			AnyChunkHeader* start = reinterpret_cast<AnyChunkHeader*>( blockList[i] );
@@ -603,6 +773,7 @@ public:
 			freeListBegin[i] = nullptr;
 //		new ( &blockList ) std::vector<AnyChunkHeader*>;
 		blocks.initialize( PAGE_SIZE_EXP );
+		largeChunks.initialize( PAGE_SIZE_EXP );
 #ifdef BULKALLOCATOR_HEAVY_DEBUG
 		dbgValidateAllBlocks();
 		dbgValidateAllFreeLists();
@@ -629,7 +800,7 @@ public:
 			{
 				if ( freeListBegin[ max_pages ] == nullptr )
 				{
-					FreeChunkHeader* h = reinterpret_cast<FreeChunkHeader*>( this->getFreeBlockNoCache( commited_block_size ) );
+					FreeChunkHeader* h = reinterpret_cast<FreeChunkHeader*>( this->getFreeReservationNoCache( commited_block_size ) );
 					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h!= nullptr );
 //					blockList.push_back( h );
 					*(blocks.createNew()) = h;
@@ -651,6 +822,8 @@ public:
 				updatedBegin->set( ret, ret->nextInBlock(), ret->getPageCount() - (uint16_t)pageCount, true );
 				updatedBegin->prevFree = nullptr;
 				updatedBegin->nextFree = nullptr;
+				if ( updatedBegin->nextInBlock() != nullptr )
+					updatedBegin->nextInBlock()->setPrevInBlock( updatedBegin );
 
 				ret->set( ret->prevInBlock(), updatedBegin, (uint16_t)pageCount, false );
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, freeListBegin[ max_pages ] != updatedBegin );
@@ -679,13 +852,15 @@ public:
 				freeListBegin[pageCount - 1] = freeListBegin[pageCount - 1]->nextFree;
 				if ( freeListBegin[pageCount - 1] != nullptr )
 					freeListBegin[pageCount - 1]->prevFree = nullptr;
+				ret->set( ret->prevInBlock(), ret->nextInBlock(), ret->getPageCount(), false );
 			}
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ret->getPageCount() <= max_pages );
 		}
 		else
 		{
-			ret = reinterpret_cast<FreeChunkHeader*>( this->getFreeBlockNoCache( pageCount << PAGE_SIZE_EXP ) );
+			ret = reinterpret_cast<FreeChunkHeader*>( this->getFreeReservationNoCache( pageCount << PAGE_SIZE_EXP ) );
 			ret->set( (FreeChunkHeader*)(void*)(pageCount<<PAGE_SIZE_EXP), nullptr, 0, false );
+			ret->setLargeChunkIndex( largeChunks.pushBack( ret ) );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ret->getPageCount() == 0 );
 		}
 
@@ -714,10 +889,12 @@ public:
 			{
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, prev->prevInBlock() == nullptr || !prev->prevInBlock()->isFree() );
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, prev->nextInBlock() == h );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<uint8_t*>(prev->prevInBlock()) + ((uintptr_t)(prev->prevInBlock()->getPageCount()) << PAGE_SIZE_EXP) == reinterpret_cast<uint8_t*>( h ) );
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<uint8_t*>(prev) + ((uintptr_t)(prev->getPageCount()) << PAGE_SIZE_EXP) == reinterpret_cast<uint8_t*>( h ) );
 				removeFromFreeList( static_cast<FreeChunkHeader*>(prev) );
 				prev->set( prev->prevInBlock(), h->nextInBlock(), prev->getPageCount() + h->getPageCount(), true );
 				h = prev;
+				if ( h->nextInBlock() != nullptr )
+					h->nextInBlock()->setPrevInBlock( h );
 			}
 			AnyChunkHeader* next = h->nextInBlock();
 			if ( next && next->isFree() )
@@ -727,8 +904,11 @@ public:
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<uint8_t*>(h) + ((uintptr_t)(h->getPageCount()) << PAGE_SIZE_EXP) == reinterpret_cast<uint8_t*>( next ) );
 				removeFromFreeList( static_cast<FreeChunkHeader*>(next) );
 				h->set( h->prevInBlock(), next->nextInBlock(), h->getPageCount() + next->getPageCount(), true );
+				if ( h->nextInBlock() != nullptr )
+					h->nextInBlock()->setPrevInBlock( h );
 			}
 
+			h->set( h->prevInBlock(), h->nextInBlock(), h->getPageCount(), true ); // if there was no merge
 			FreeChunkHeader* hfree = static_cast<FreeChunkHeader*>(h);
 			uint16_t idx = hfree->getPageCount() - 1;
 			if ( idx >= max_pages )
@@ -747,9 +927,119 @@ public:
 		else
 		{
 			size_t deallocSize = (size_t)(h->prevInBlock());
-			this->freeChunkNoCache( ptr, deallocSize );
+			size_t idx = h->getLargeChunkIndex();
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, idx < largeChunks.size() && largeChunks[idx] == h );
+			largeChunks.swapRemove( idx );
+			if ( idx < largeChunks.size() )
+				largeChunks[idx]->setLargeChunkIndex( idx );
+			this->freeReservationNoCache( ptr, deallocSize );
+		}
+
+	}
+
+	const BlockStats& getBlockListStats() const { return blocks.getStats(); }
+	const BlockStats& getLargeChunkListStats() const { return largeChunks.getStats(); }
+
+	// blocks and large chunks as reservations; free chunks are written without content, except for their headers
+	void serialize( HeapImageWriter& w )
+	{
+		BulkImage image;
+		image.blockCount = 0;
+		class C { private: uint64_t* cnt; public: C(uint64_t* cnt_) {cnt = cnt_;} void f(AnyChunkHeader*) { ++(*cnt); } }; C c(&(image.blockCount));
+		blocks.doForEach(c);
+		image.largeChunkCount = largeChunks.size();
+		memcpy( image.freeListBegin, freeListBegin, sizeof( freeListBegin ) );
+		w.writeMeta( &image, sizeof(image) );
+		class F
+		{
+		private:
+			HeapImageWriter* w;
+		public:
+			F(HeapImageWriter* w_) {w = w_;}
+			void f(AnyChunkHeader* h)
+			{
+				w->writeReservation( h, commited_block_size );
+				for ( ; h != nullptr; h = h->nextInBlock() )
+				{
+					size_t sz = ((size_t)(h->getPageCount())) << PAGE_SIZE_EXP;
+					if ( h->isFree() )
+					{
+						w->writeData( h, PAGE_SIZE_BYTES );
+						w->writeZero( reinterpret_cast<uint8_t*>(h) + PAGE_SIZE_BYTES, sz - PAGE_SIZE_BYTES );
+					}
+					else
+						w->writeData( h, sz );
+				}
+			}
+		};
+		F f(&w);
+		blocks.doForEach(f);
+		for ( size_t i=0; i<largeChunks.size(); ++i )
+		{
+			size_t sz = (size_t)(largeChunks[i]->prevInBlock());
+			w.writeReservation( largeChunks[i], sz );
+			w.writeData( largeChunks[i], sz );
+		}
+	}
+
+	// to be called on a just initialized allocator; with relocation, pointers are to be fixed then (see relocate())
+	bool deserialize( HeapImageReader& r, HeapRelocation* relocation = nullptr )
+	{
+		BulkImage image;
+		if ( !r.readMeta( &image, sizeof(image) ) )
+			return false;
+		for ( uint64_t k=0; k<image.blockCount; ++k )
+		{
+			size_t sz = commited_block_size;
+			void* block = r.readReservation( *this, sz, nullptr, 0, relocation );
+			if ( block == nullptr )
+				return false;
+			*(blocks.createNew()) = reinterpret_cast<AnyChunkHeader*>( block );
+		}
+		for ( uint64_t k=0; k<image.largeChunkCount; ++k )
+		{
+			size_t sz = 0;
+			AnyChunkHeader* h = reinterpret_cast<AnyChunkHeader*>( r.readReservation( *this, sz, nullptr, 0, relocation ) );
+			if ( h == nullptr )
+				return false;
+			if ( h->getPageCount() != 0 || (size_t)(h->prevInBlock()) != sz || h->getLargeChunkIndex() != largeChunks.size() )
+			{
+				this->freeReservationNoCache( h, sz );
+				return false;
+			}
+			largeChunks.pushBack( h );
 		}
+		memcpy( freeListBegin, image.freeListBegin, sizeof( freeListBegin ) );
+		return true;
+	}
 
+	// fixes pointers in chunk headers and free lists after deserialize() with relocation (large chunks have none)
+	void relocate( const HeapRelocation& relocation )
+	{
+		for ( size_t i=0; i<=max_pages; ++i )
+			relocation.fixPointer( freeListBegin[i] );
+		class F
+		{
+		private:
+			const HeapRelocation* relocation;
+		public:
+			F(const HeapRelocation* relocation_) {relocation = relocation_;}
+			void f(AnyChunkHeader* h)
+			{
+				for ( ; h != nullptr; h = h->nextInBlock() )
+				{
+					h->set( relocation->translate( h->prevInBlock() ), relocation->translate( h->nextInBlock() ), h->getPageCount(), h->isFree() );
+					if ( h->isFree() )
+					{
+						FreeChunkHeader* hfree = static_cast<FreeChunkHeader*>(h);
+						relocation->fixPointer( hfree->prevFree );
+						relocation->fixPointer( hfree->nextFree );
+					}
+				}
+			}
+		};
+		F f(&relocation);
+		blocks.doForEach(f);
 	}
 
 	size_t getAllocatedSize( void* ptr )
@@ -770,9 +1060,12 @@ public:
 
 	void deinitialize()
 	{
-		class F { private: BasePageAllocator* alloc; public: F(BasePageAllocator*alloc_) {alloc = alloc_;} void f(AnyChunkHeader* h) {NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h != nullptr ); alloc->freeChunkNoCache( h, commited_block_size ); } }; F f(this);
+		class F { private: BasePageAllocator* alloc; public: F(BasePageAllocator*alloc_) {alloc = alloc_;} void f(AnyChunkHeader* h) {NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h != nullptr ); alloc->freeReservationNoCache( h, commited_block_size ); } }; F f(this);
 		blocks.doForEach(f);
 		blocks.deinitialize();
+		for ( size_t i=0; i<largeChunks.size(); ++i )
+			this->freeReservationNoCache( largeChunks[i], (size_t)(largeChunks[i]->prevInBlock()) );
+		largeChunks.deinitialize();
 /*		for ( size_t i=0; i<blockList.size(); ++i )
 		{
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, blockList[i] != nullptr );
@@ -788,10 +1081,34 @@ public:
 	}
 };
 
+//#define NODECPP_IIBMALLOC_BUCKET_STATS // per-bucket counters; when not defined all related calls compile to nothing
+
+struct BucketStats
+{
+	uint64_t allocCount = 0;
+	uint64_t deallocCount = 0;
+	uint64_t highWater = 0; // max number of simultaneously live items
+	uint64_t refillCount = 0; // number of times a bucket had to be refilled from fresh pages
+
+	uint64_t liveCount() const { return allocCount - deallocCount; }
+
+	NODECPP_FORCEINLINE void registerAlloc()
+	{
+		++allocCount;
+		uint64_t live = allocCount - deallocCount;
+		if ( live > highWater )
+			highWater = live;
+	}
+	NODECPP_FORCEINLINE void registerDealloc() { ++deallocCount; }
+	NODECPP_FORCEINLINE void registerRefill() { ++refillCount; }
+};
+
 //#define USE_EXP_BUCKET_SIZES
 #define USE_HALF_EXP_BUCKET_SIZES
 //#define USE_QUAD_EXP_BUCKET_SIZES
 
+//#define NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS // small buckets keep free blocks and live counts per page (see PageLocalHeader)
+
 class IibAllocatorBase
 {
 protected:
@@ -807,6 +1124,219 @@ protected:
 	typedef SoundingAddressPageAllocator<PageAllocatorWithCaching, BucketCountExp, reservation_size_exp, 4, 3> PageAllocatorT;
 	PageAllocatorT pageAllocator;
 
+	static constexpr size_t UserPtrCount = 32;
+	void* userPtrs[UserPtrCount]; // roots of user data, kept in heap images (see serialize())
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+	static constexpr uint64_t heapImageLayoutFlags = 1; // pages of small buckets start with a PageLocalHeader
+#else
+	static constexpr uint64_t heapImageLayoutFlags = 0;
+#endif
+	static constexpr uint64_t heapImageLayout = BucketCountExp | ( reservation_size_exp << 8 ) | ( PAGE_SIZE_EXP << 16 ) | ( UserPtrCount << 24 ) | ( ((uint64_t)sizeof(void*)) << 32 ) | ( heapImageLayoutFlags << 40 );
+
+	PersistentPageSource persistentHeap; // open if the heap lives in a file (see openPersistentHeap())
+
+	// state of the current chain of checkpoints (see checkpoint())
+	uint64_t checkpointChainID;
+	uint64_t checkpointSequence; // of the next checkpoint; 0: next one is a base image
+	uint64_t checkpointClearCount; // of soft-dirty bits, right after the last checkpoint
+
+	std::thread::id ownerThread; // the one that may use the allocator; none while detached (see detachFromThread())
+
+	void* regionPageCache; // free pages of regions (see Region), linked through the first word
+
+//#define NODECPP_IIBMALLOC_PAGE_COLOURING // first blocks of new runs of bucket pages are shifted over the slack at the run end (see pageColourOffset())
+#ifdef NODECPP_IIBMALLOC_PAGE_COLOURING
+	size_t nextPageColour;
+#endif
+
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+	BucketStats bucketStats[BucketCount];
+	BucketStats largeChunkStats;
+#endif
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+	StatsSlot* statsSlot = nullptr;
+	uint64_t statsPublishCount;
+#endif
+
+	NODECPP_FORCEINLINE void statsRegisterBucketAlloc( size_t idx )
+	{
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+		bucketStats[idx].registerAlloc();
+#else
+		(void)idx;
+#endif
+	}
+	NODECPP_FORCEINLINE void statsRegisterBucketDealloc( size_t idx )
+	{
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+		bucketStats[idx].registerDealloc();
+#else
+		(void)idx;
+#endif
+	}
+	NODECPP_FORCEINLINE void statsRegisterBucketRefill( size_t idx )
+	{
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+		bucketStats[idx].registerRefill();
+#else
+		(void)idx;
+#endif
+	}
+	NODECPP_FORCEINLINE void statsRegisterLargeAlloc()
+	{
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+		largeChunkStats.registerAlloc();
+#endif
+	}
+	NODECPP_FORCEINLINE void statsRegisterLargeDealloc()
+	{
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+		largeChunkStats.registerDealloc();
+#endif
+	}
+
+	// on slow paths only
+	NODECPP_FORCEINLINE void statsPublish()
+	{
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+		publishStats();
+#endif
+	}
+
+//#define NODECPP_IIBMALLOC_OWNER_THREAD_CHECK // allocations and deallocations by a thread other than the owner one are asserted against
+	NODECPP_FORCEINLINE void checkOwnerThread() const
+	{
+#ifdef NODECPP_IIBMALLOC_OWNER_THREAD_CHECK
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ownerThread == std::this_thread::get_id(), "allocator is used by a thread that does not own it (or while detached)" );
+#endif
+	}
+
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+	SamplingHeapProfiler<PageAllocatorWithCaching> heapProfiler;
+#endif
+
+	NODECPP_FORCEINLINE void profilerRegisterAlloc( void* ptr, size_t sz )
+	{
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+		heapProfiler.onAllocate( ptr, sz );
+#else
+		(void)ptr;
+		(void)sz;
+#endif
+	}
+	NODECPP_FORCEINLINE void profilerRegisterDealloc( void* ptr )
+	{
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+		heapProfiler.onDeallocate( ptr );
+#else
+		(void)ptr;
+#endif
+	}
+
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+	AllocationTraceRecorder<PageAllocatorWithCaching> traceRecorder;
+#endif
+
+	NODECPP_FORCEINLINE void traceRegisterAlloc( void* ptr, size_t sz )
+	{
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.onAllocate( ptr, sz );
+#else
+		(void)ptr;
+		(void)sz;
+#endif
+	}
+	NODECPP_FORCEINLINE void traceRegisterDealloc( void* ptr )
+	{
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.onDeallocate( ptr );
+#else
+		(void)ptr;
+#endif
+	}
+	NODECPP_FORCEINLINE void traceRegisterZombie( void* ptr )
+	{
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.onZombie( ptr );
+#else
+		(void)ptr;
+#endif
+	}
+	NODECPP_FORCEINLINE void traceRegisterKillAllZombies()
+	{
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.onKillAllZombies();
+#endif
+	}
+	NODECPP_FORCEINLINE void traceRegisterZombieRelease( void* ptr )
+	{
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.onZombieRelease( ptr );
+#else
+		(void)ptr;
+#endif
+	}
+	NODECPP_FORCEINLINE void traceRegisterZombieReclaim( void* ptr )
+	{
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.onZombieReclaim( ptr );
+#else
+		(void)ptr;
+#endif
+	}
+	NODECPP_FORCEINLINE void traceRegisterMarkZombiesForReclamation()
+	{
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.onMarkZombiesForReclamation();
+#endif
+	}
+	NODECPP_FORCEINLINE void traceRegisterZombieQuarantineBudget( size_t bytes )
+	{
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.onZombieQuarantineBudget( bytes );
+#else
+		(void)bytes;
+#endif
+	}
+
+public:
+	// all stats of an allocator in one place; bucket-level part is present only with NODECPP_IIBMALLOC_BUCKET_STATS
+	struct AllocatorStats
+	{
+		BlockStats pageTier; // pages for buckets
+		BlockStats bulkTier; // chunks above MaxBucketSize
+		BlockStats metadataTier; // pages for internal descriptors
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+		BucketStats buckets[BucketCount];
+		BucketStats largeChunks;
+#endif
+
+		BlockStats total() const
+		{
+			BlockStats ret = pageTier;
+			ret.add( bulkTier );
+			ret.add( metadataTier );
+			return ret;
+		}
+
+		void printStats() const
+		{
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Page tier:" );
+			pageTier.printStats();
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Bulk tier:" );
+			bulkTier.printStats();
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Metadata:" );
+			metadataTier.printStats();
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "bucket (size): allocs, deallocs, live, high-water, refills" );
+			for ( size_t i=0; i<BucketCount; ++i )
+				if ( buckets[i].allocCount )
+					nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "{} ({}): {}, {}, {}, {}, {}", i, bucketIndexToSize( i ), buckets[i].allocCount, buckets[i].deallocCount, buckets[i].liveCount(), buckets[i].highWater, buckets[i].refillCount );
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "large: {}, {}, {}, {}", largeChunks.allocCount, largeChunks.deallocCount, largeChunks.liveCount(), largeChunks.highWater );
+#endif
+		}
+	};
+
 public:
 #ifdef USE_EXP_BUCKET_SIZES
 	static constexpr
@@ -834,6 +1364,20 @@ public:
 #error "Undefined bucket size schema"
 #endif
 
+	static constexpr
+	NODECPP_FORCEINLINE size_t bucketIndexToSize(size_t ix)
+	{
+#ifdef USE_EXP_BUCKET_SIZES
+		return indexToBucketSize( ix );
+#elif defined USE_HALF_EXP_BUCKET_SIZES
+		return indexToBucketSizeHalfExp( ix );
+#elif defined USE_QUAD_EXP_BUCKET_SIZES
+		return indexToBucketSizeQuarterExp( ix );
+#else
+#error Undefined bucket size schema
+#endif
+	}
+
 template<uint64_t n>
 static NODECPP_FORCEINLINE constexpr unsigned long UpperNonZeroBitPos() {
 	static_assert( n != 0 );
@@ -1017,49 +1561,282 @@ public:
 	IibAllocatorBase& operator=(IibAllocatorBase&&) = default;
 
 	static constexpr size_t maximalSupportedAlignment = 32 > NODECPP_MAX_SUPPORTED_ALIGNMENT_FOR_NEW ? 32 : NODECPP_MAX_SUPPORTED_ALIGNMENT_FOR_NEW;
+	// offset of a large chunk in its first page (no block of a bucket starts there, which is how deallocate() tells
+	// one from another); it is maximally aligned, thus so is any large chunk, and allocateAligned() needs no special case
+	static constexpr size_t largeChunkOffset = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), sizeToExp( maximalSupportedAlignment ) );
 
-	bool formatAllocatedPageAlignedBlock( uint8_t* block, size_t blockSz, size_t bucketSz, uint8_t bucketidx )
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+protected:
+	// Pages of buckets of up to PageLocalMaxBucketSize are formatted one by one, each starting with this header.
+	// Blocks of one page per bucket (the current one) are in buckets[] and are served and released as usual;
+	// blocks released to any other page go to its own free list. When buckets[] gets empty, the fullest page
+	// with free blocks becomes the current one, thus hot objects stay packed, and pages with no live blocks
+	// are known (see getEmptyPageCount()) and are reused last.
+	struct PageLocalHeader
+	{
+		void* freeList; // blocks released while the page is not current
+		PageLocalHeader* next; // in a list of pages of similar fullness; not used while the page is full or current
+		PageLocalHeader* prev;
+		uint32_t liveCount; // blocks not in freeList (for the current page: all of them)
+		uint32_t capacity;
+	};
+	static constexpr size_t PageLocalMaxBucketSize = PAGE_SIZE_BYTES / 4;
+	static constexpr size_t PartialPageBinCount = 4; // partially used pages are kept by fullness, in quarters
+	static constexpr size_t pageLocalBucketCount()
+	{
+		size_t cnt = 0;
+		while ( cnt < BucketCount && bucketIndexToSize( cnt ) <= PageLocalMaxBucketSize )
+			++cnt;
+		return cnt;
+	}
+	struct PageLocalLists // by bucket index; only first pageLocalBucketCount() items are used
+	{
+		PageLocalHeader* current[BucketCount]; // the page which blocks are in buckets[]
+		PageLocalHeader* partial[BucketCount][PartialPageBinCount];
+		PageLocalHeader* empty[BucketCount]; // including newly formatted ones
+		uint64_t emptyCount[BucketCount];
+	};
+	PageLocalLists pageLocal;
+
+	static NODECPP_FORCEINLINE bool isPageLocalBucket( size_t idx )
+	{
+		constexpr size_t cnt = pageLocalBucketCount();
+		static_assert( cnt > 0 && cnt < BucketCount - 1 ); // not including regions (see Region)
+		return idx < cnt;
+	}
+
+	PageLocalHeader*& pageListHead( size_t idx, uint32_t liveCount, uint32_t capacity )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, liveCount < capacity );
+		return liveCount == 0 ? pageLocal.empty[idx] : pageLocal.partial[idx][ (size_t)liveCount * PartialPageBinCount / capacity ];
+	}
+
+	static void pushPage( PageLocalHeader*& head, PageLocalHeader* page )
+	{
+		page->prev = nullptr;
+		page->next = head;
+		if ( head != nullptr )
+			head->prev = page;
+		head = page;
+	}
+
+	static void unlinkPage( PageLocalHeader*& head, PageLocalHeader* page )
+	{
+		if ( page->prev != nullptr )
+			page->prev->next = page->next;
+		else
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, head == page );
+			head = page->next;
+		}
+		if ( page->next != nullptr )
+			page->next->prev = page->prev;
+		page->next = nullptr;
+		page->prev = nullptr;
+	}
+
+	static size_t pageLocalFirstBlockOffset( size_t bucketSz )
+	{
+		constexpr size_t memForbidden = largeChunkOffset;
+		size_t alignment = bucketSz & ( 0 - bucketSz );
+		if ( alignment > maximalSupportedAlignment )
+			alignment = maximalSupportedAlignment;
+		size_t offset = sizeof( PageLocalHeader ) > memForbidden ? sizeof( PageLocalHeader ) : memForbidden + 1; // no block may start at memForbidden
+		return ( offset + alignment - 1 ) / alignment * alignment;
+	}
+
+	void formatPageLocalPages( uint8_t* block, size_t blockSz, size_t bucketSz, uint8_t bucketidx )
 	{
-		constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
 		if ( block == nullptr )
-			return false;
+			return;
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( ((uintptr_t)block) & PAGE_SIZE_MASK ) == 0 );
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( blockSz & PAGE_SIZE_MASK ) == 0 );
-		if( ( bucketSz & (memForbidden*2-1) ) == 0 ) // that is, (K * bucketSz) % PAGE_SIZE_BYTES != memForbidden for any K
+		size_t headerSz = pageLocalFirstBlockOffset( bucketSz );
+		for ( uint8_t* page = block; page < block + blockSz; page += PAGE_SIZE_BYTES )
 		{
-			size_t itemCnt = blockSz / bucketSz;
-			if ( itemCnt )
+			uint8_t* first = page + headerSz + pageColourOffset( PAGE_SIZE_BYTES - headerSz, bucketSz );
+			size_t itemCnt = ( page + PAGE_SIZE_BYTES - first ) / bucketSz;
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, itemCnt >= 2 );
+			for ( size_t i=0; i<(itemCnt-1)*bucketSz; i+=bucketSz )
+				*reinterpret_cast<void**>(first + i) = first + i + bucketSz;
+			*reinterpret_cast<void**>(first + (itemCnt-1)*bucketSz) = nullptr;
+			PageLocalHeader* h = reinterpret_cast<PageLocalHeader*>( page );
+			h->freeList = first;
+			h->liveCount = 0;
+			h->capacity = (uint32_t)itemCnt;
+			pushPage( pageLocal.empty[bucketidx], h );
+			++(pageLocal.emptyCount[bucketidx]);
+		}
+	}
+
+	PageLocalHeader* takeFullestPage( uint8_t idx )
+	{
+		for ( size_t bin=PartialPageBinCount; bin--; )
+			if ( pageLocal.partial[idx][bin] != nullptr )
 			{
-				for ( size_t i=0; i<(itemCnt-1)*bucketSz; i+=bucketSz )
-				{
-					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ((i + bucketSz) & PAGE_SIZE_MASK) != memForbidden );
-					*reinterpret_cast<void**>(block + i) = block + i + bucketSz;
-				}
-				*reinterpret_cast<void**>(block + (itemCnt-1)*bucketSz) = nullptr;
-				buckets[bucketidx] = block;
-				return true;
+				PageLocalHeader* h = pageLocal.partial[idx][bin];
+				unlinkPage( pageLocal.partial[idx][bin], h );
+				return h;
 			}
-			else
-				return false;
-		}
-		else
+		PageLocalHeader* h = pageLocal.empty[idx];
+		if ( h != nullptr )
 		{
-			size_t itemCnt = blockSz / bucketSz;
-			if ( itemCnt )
-			{
+			unlinkPage( pageLocal.empty[idx], h );
+			--(pageLocal.emptyCount[idx]);
+		}
+		return h;
+	}
+
+	// buckets[idx] is empty, that is, all blocks of the current page are in use
+	void switchCurrentPage( size_t bucketSz, uint8_t idx )
+	{
+		PageLocalHeader* h = takeFullestPage( idx );
+		if ( h == nullptr )
+		{
+			PageAllocatorT::MultipageData mpData;
+			pageAllocator.getMultipage( idx, mpData );
+			formatPageLocalPages( reinterpret_cast<uint8_t*>( mpData.ptr1 ), mpData.sz1, bucketSz, idx );
+			formatPageLocalPages( reinterpret_cast<uint8_t*>( mpData.ptr2 ), mpData.sz2, bucketSz, idx );
+			h = takeFullestPage( idx );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h != nullptr );
+		}
+		pageLocal.current[idx] = h; // the previous one is full and is not in any list until a block of it is released
+		buckets[idx] = h->freeList;
+		h->freeList = nullptr;
+		h->liveCount = h->capacity;
+	}
+
+	NODECPP_NOINLINE void deallocateToPage( void* ptr, size_t idx )
+	{
+		PageLocalHeader* h = reinterpret_cast<PageLocalHeader*>( PageAllocatorT::ptrToPageStart( ptr ) );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h != pageLocal.current[idx] && h->liveCount != 0 && h->liveCount <= h->capacity );
+		*reinterpret_cast<void**>( ptr ) = h->freeList;
+		h->freeList = ptr;
+		if ( h->liveCount == h->capacity ) // was full
+		{
+			--(h->liveCount);
+			pushPage( pageListHead( idx, h->liveCount, h->capacity ), h );
+		}
+		else
+		{
+			PageLocalHeader*& oldHead = pageListHead( idx, h->liveCount, h->capacity );
+			--(h->liveCount);
+			PageLocalHeader*& newHead = pageListHead( idx, h->liveCount, h->capacity );
+			if ( &oldHead != &newHead )
+			{
+				unlinkPage( oldHead, h );
+				pushPage( newHead, h );
+			}
+		}
+		if ( h->liveCount == 0 )
+			++(pageLocal.emptyCount[idx]);
+	}
+
+	static void relocatePageList( const HeapRelocation& relocation, PageLocalHeader*& head )
+	{
+		relocation.fixPointer( head );
+		for ( PageLocalHeader* h = head; h != nullptr; h = h->next )
+		{
+			relocation.fixPointer( h->next );
+			relocation.fixPointer( h->prev );
+			relocation.fixPointer( h->freeList );
+			for ( void* item = h->freeList; item != nullptr; item = *reinterpret_cast<void**>( item ) )
+				relocation.fixPointer( *reinterpret_cast<void**>( item ) );
+		}
+	}
+
+	void relocatePageLocalLists( const HeapRelocation& relocation )
+	{
+		for ( size_t i=0; i<pageLocalBucketCount(); ++i )
+		{
+			relocation.fixPointer( pageLocal.current[i] );
+			for ( size_t bin=0; bin<PartialPageBinCount; ++bin )
+				relocatePageList( relocation, pageLocal.partial[i][bin] );
+			relocatePageList( relocation, pageLocal.empty[i] );
+		}
+	}
+
+public:
+	// pages of small buckets with no live blocks (committed and ready for reuse)
+	size_t getEmptyPageCount() const
+	{
+		size_t ret = 0;
+		for ( size_t i=0; i<pageLocalBucketCount(); ++i )
+			ret += pageLocal.emptyCount[i];
+		return ret;
+	}
+#endif // NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+
+	// Offset of the first block in a run of pages of a bucket. With colouring, it is rotated over the slack left at
+	// the end of the run, so that blocks of the same position in different runs fall into different cache sets;
+	// steps are of a cache line, or of block alignment if the slack is less than that.
+	size_t pageColourOffset( size_t blockSz, size_t bucketSz )
+	{
+#ifdef NODECPP_IIBMALLOC_PAGE_COLOURING
+		constexpr size_t memForbidden = largeChunkOffset;
+		constexpr size_t cacheLineSize = 64;
+		size_t slack = blockSz % bucketSz;
+		size_t alignmentStep = bucketSz & ( 0 - bucketSz ); // blocks of a bucket are aligned as its size is
+		if ( alignmentStep > maximalSupportedAlignment )
+			alignmentStep = maximalSupportedAlignment;
+		if ( alignmentStep < ALIGNMENT )
+			alignmentStep = ALIGNMENT;
+		size_t step = alignmentStep < cacheLineSize && slack >= cacheLineSize ? cacheLineSize : alignmentStep;
+		size_t offset = ( nextPageColour++ % ( slack / step + 1 ) ) * step;
+		return ( offset & PAGE_SIZE_MASK ) != memForbidden ? offset : 0;
+#else
+		(void)blockSz;
+		(void)bucketSz;
+		return 0;
+#endif
+	}
+
+	bool formatAllocatedPageAlignedBlock( uint8_t* block, size_t blockSz, size_t bucketSz, uint8_t bucketidx )
+	{
+		constexpr size_t memForbidden = largeChunkOffset;
+		if ( block == nullptr )
+			return false;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( ((uintptr_t)block) & PAGE_SIZE_MASK ) == 0 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( blockSz & PAGE_SIZE_MASK ) == 0 );
+		size_t offset = pageColourOffset( blockSz, bucketSz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( offset & PAGE_SIZE_MASK ) != memForbidden && offset <= blockSz % bucketSz );
+		uint8_t* first = block + offset;
+		// blocks of this run are added in front of those already in the bucket (e.g. of the other part of a multipage)
+		if( ( bucketSz & (memForbidden*2-1) ) == 0 && ( offset & (memForbidden*2-1) ) == 0 ) // that is, (offset + K * bucketSz) % PAGE_SIZE_BYTES != memForbidden for any K
+		{
+			size_t itemCnt = ( blockSz - offset ) / bucketSz;
+			if ( itemCnt )
+			{
 				for ( size_t i=0; i<(itemCnt-1)*bucketSz; i+=bucketSz )
 				{
-					if ( ((i + bucketSz) & PAGE_SIZE_MASK) != memForbidden )
-						*reinterpret_cast<void**>(block + i) = block + i + bucketSz;
+					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ((offset + i + bucketSz) & PAGE_SIZE_MASK) != memForbidden );
+					*reinterpret_cast<void**>(first + i) = first + i + bucketSz;
+				}
+				*reinterpret_cast<void**>(first + (itemCnt-1)*bucketSz) = buckets[bucketidx];
+				buckets[bucketidx] = first;
+				return true;
+			}
+			else
+				return false;
+		}
+		else
+		{
+			size_t itemCnt = ( blockSz - offset ) / bucketSz;
+			if ( itemCnt )
+			{
+				for ( size_t i=0; i<(itemCnt-1)*bucketSz; i+=bucketSz )
+				{
+					if ( ((offset + i + bucketSz) & PAGE_SIZE_MASK) != memForbidden )
+						*reinterpret_cast<void**>(first + i) = first + i + bucketSz;
 					else
 					{ 
 						NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, i != itemCnt - 2 ); // for small buckets such a bucket could not happen at the end anyway
-						*reinterpret_cast<void**>(block + i) = block + i + bucketSz + bucketSz;
+						*reinterpret_cast<void**>(first + i) = first + i + bucketSz + bucketSz;
 						i += bucketSz;
 					}
 				}
-				*reinterpret_cast<void**>(block + (itemCnt-1)*bucketSz) = nullptr;
-				buckets[bucketidx] = block;
+				*reinterpret_cast<void**>(first + (itemCnt-1)*bucketSz) = buckets[bucketidx];
+				buckets[bucketidx] = first;
 				return true;
 			}
 			else
@@ -1079,26 +1856,44 @@ public:
 #error Undefined bucket size schema
 #endif
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, bucketSz >= sizeof( void* ) );
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+		if ( isPageLocalBucket( szidx ) )
+			switchCurrentPage( bucketSz, szidx );
+		else
+#endif
+		{
 		PageAllocatorT::MultipageData mpData;
 //		uint8_t* block = reinterpret_cast<uint8_t*>( pageAllocator.getPage( szidx ) );
 		pageAllocator.getMultipage( szidx, mpData );
 		formatAllocatedPageAlignedBlock( reinterpret_cast<uint8_t*>( mpData.ptr1 ), mpData.sz1, bucketSz, szidx );
 		formatAllocatedPageAlignedBlock( reinterpret_cast<uint8_t*>( mpData.ptr2 ), mpData.sz2, bucketSz, szidx );
+		}
+		statsRegisterBucketRefill( szidx );
+		statsRegisterBucketAlloc( szidx );
+		statsPublish();
 		void* ret = buckets[szidx];
 		buckets[szidx] = *reinterpret_cast<void**>(buckets[szidx]);
+		profilerRegisterAlloc( ret, sz );
+		traceRegisterAlloc( ret, sz );
 		return ret;
 	}
 
 	NODECPP_NOINLINE void* allocateInCaseTooLargeForBucket(size_t sz)
 	{
-		constexpr size_t memStart = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+		constexpr size_t memStart = largeChunkOffset;
 		void* block = bulkAllocator.allocate( sz + memStart );
+		statsRegisterLargeAlloc();
+		statsPublish();
+		void* ret = reinterpret_cast<uint8_t*>(block) + memStart;
+		profilerRegisterAlloc( ret, sz );
+		traceRegisterAlloc( ret, sz );
 
-		return reinterpret_cast<uint8_t*>(block) + memStart;
+		return ret;
 	}
 
 	NODECPP_FORCEINLINE void* allocate(size_t sz)
 	{
+		checkOwnerThread();
 		if ( sz <= MaxBucketSize )
 		{
 #ifdef USE_EXP_BUCKET_SIZES
@@ -1115,6 +1910,9 @@ public:
 			{
 				void* ret = buckets[szidx];
 				buckets[szidx] = *reinterpret_cast<void**>(buckets[szidx]);
+				statsRegisterBucketAlloc( szidx );
+				profilerRegisterAlloc( ret, sz );
+				traceRegisterAlloc( ret, sz );
 				return ret;
 			}
 			else
@@ -1129,6 +1927,7 @@ public:
 	template<size_t sz>
 	NODECPP_FORCEINLINE void* allocate()
 	{
+		checkOwnerThread();
 		if constexpr ( sz <= MaxBucketSize )
 		{
 #ifdef USE_EXP_BUCKET_SIZES
@@ -1145,6 +1944,9 @@ public:
 			{
 				void* ret = buckets[szidx];
 				buckets[szidx] = *reinterpret_cast<void**>(buckets[szidx]);
+				statsRegisterBucketAlloc( szidx );
+				profilerRegisterAlloc( ret, sz );
+				traceRegisterAlloc( ret, sz );
 				return ret;
 			}
 			else
@@ -1156,6 +1958,37 @@ public:
 		return nullptr;
 	}
 
+	// same as count calls to allocate<sz>() (for small sizes only)
+	template<size_t sz>
+	NODECPP_FORCEINLINE void allocateMany( void** out, size_t count )
+	{
+		static_assert( sz <= MaxBucketSize );
+#ifdef USE_EXP_BUCKET_SIZES
+		constexpr uint8_t szidx = sizeToIndexConstexpr< sz >();
+#elif defined USE_HALF_EXP_BUCKET_SIZES
+		constexpr uint8_t szidx = sizeToIndexHalfExpConstexpr< sz >();
+#elif defined USE_QUAD_EXP_BUCKET_SIZES
+		constexpr uint8_t szidx = sizeToIndexQuarterExpConstexpr< sz >();
+#else
+#error Undefined bucket size schema
+#endif
+		checkOwnerThread();
+		for ( size_t i=0; i<count; ++i )
+		{
+			void* ret = buckets[szidx];
+			if ( ret )
+			{
+				buckets[szidx] = *reinterpret_cast<void**>(ret);
+				statsRegisterBucketAlloc( szidx );
+				profilerRegisterAlloc( ret, sz );
+				traceRegisterAlloc( ret, sz );
+				out[i] = ret;
+			}
+			else
+				out[i] = allocateInCaseNoFreeBucket( sz, szidx );
+		}
+	}
+
 	template<size_t alignment>
 	NODECPP_FORCEINLINE void* allocateAligned(size_t sz)
 	{
@@ -1189,52 +2022,114 @@ public:
 		return ret;
 	}
 
+	// true if a block of sz bytes comes from a bucket (rather than being a large chunk)
+	static constexpr bool isBucketSize( size_t sz ) { return sz <= MaxBucketSize; }
+
+	// size to request from allocate<>() for a block of sz bytes to be aligned (blocks of a bucket are aligned as its size)
 	template<size_t sz, size_t alignment>
-	NODECPP_FORCEINLINE void* allocateAligned()
+	static constexpr size_t alignedRequestSize()
 	{
 		static_assert( alignment <= maximalSupportedAlignment );
 		static_assert( sz >= alignment );
-		void* ret = nullptr;
 #ifdef USE_EXP_BUCKET_SIZES
-		ret = allocate< sz >();
+		return sz;
 #elif defined USE_HALF_EXP_BUCKET_SIZES
-		if constexpr ( alignment <= 8 ) 
-			ret = allocate< sz >();
-		if constexpr ( sz > 16 && sz <= 24 )
-			ret = allocate< 32 >();
-		else if constexpr ( alignment <= 16 ) 
-			ret = allocate< sz >();
-		else if constexpr ( sz > 33 && sz <= 48 )
-			ret = allocate< 64 >();
+		if constexpr ( alignment > 8 && sz > 16 && sz <= 24 )
+			return 32;
+		else if constexpr ( alignment > 16 && sz > 32 && sz <= 48 )
+			return 64;
 		else
-			ret = allocate< sz >();
+			return sz;
 #elif defined USE_QUAD_EXP_BUCKET_SIZES
 #error Not implemented
 #else
 #error Undefined bucket size schema
 #endif
+	}
+
+	template<size_t sz, size_t alignment>
+	NODECPP_FORCEINLINE void* allocateAligned()
+	{
+		void* ret = allocate< alignedRequestSize<sz, alignment>() >();
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::pedantic, ((uintptr_t)ret & (alignment - 1)) == 0, "ret = 0x{:x}, alignment = {}", (uintptr_t)ret, alignment );
 		return ret;
 	}
 
+protected:
+	// makes a block of a bucket available for allocation again (with a page-local free list, possibly at its page)
+	NODECPP_FORCEINLINE void releaseToBucket( void* ptr, size_t idx )
+	{
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+		if ( isPageLocalBucket( idx ) && PageAllocatorT::ptrToPageStart( ptr ) != pageLocal.current[idx] )
+			deallocateToPage( ptr, idx );
+		else
+#endif
+		{
+			*reinterpret_cast<void**>( ptr ) = buckets[idx];
+			buckets[idx] = ptr;
+		}
+	}
+
+public:
 	NODECPP_FORCEINLINE void deallocate(void* ptr)
 	{
+		checkOwnerThread();
 		if(ptr)
 		{
+			profilerRegisterDealloc( ptr );
+			traceRegisterDealloc( ptr );
 			size_t offsetInPage = PageAllocatorT::getOffsetInPage( ptr );
-			constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+			constexpr size_t memForbidden = largeChunkOffset;
 			if ( offsetInPage != memForbidden )
 			{
 				size_t idx = PageAllocatorT::addressToIdx( ptr );
-				*reinterpret_cast<void**>( ptr ) = buckets[idx];
-				buckets[idx] = ptr;
+				releaseToBucket( ptr, idx );
+				statsRegisterBucketDealloc( idx );
 			}
 			else
 			{
 				void* pageStart = PageAllocatorT::ptrToPageStart( ptr );
 				bulkAllocator.deallocate( pageStart );
+				statsRegisterLargeDealloc();
+				statsPublish();
+			}
+		}
+	}
+
+	// same as deallocate(), for a block obtained with allocate<sz>(); the bucket is known at compile time
+	template<size_t sz>
+	NODECPP_FORCEINLINE void deallocate(void* ptr)
+	{
+		if constexpr ( sz <= MaxBucketSize )
+		{
+#ifdef USE_EXP_BUCKET_SIZES
+			constexpr uint8_t idx = sizeToIndexConstexpr< sz >();
+#elif defined USE_HALF_EXP_BUCKET_SIZES
+			constexpr uint8_t idx = sizeToIndexHalfExpConstexpr< sz >();
+#elif defined USE_QUAD_EXP_BUCKET_SIZES
+			constexpr uint8_t idx = sizeToIndexQuarterExpConstexpr< sz >();
+#else
+#error Undefined bucket size schema
+#endif
+			checkOwnerThread();
+			if(ptr)
+			{
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::pedantic, PageAllocatorT::addressToIdx( ptr ) == idx, "0x{:x} is not a block of {} bytes", (uintptr_t)ptr, sz );
+				profilerRegisterDealloc( ptr );
+				traceRegisterDealloc( ptr );
+				releaseToBucket( ptr, idx );
+				statsRegisterBucketDealloc( idx );
 			}
 		}
+		else
+			deallocate( ptr );
+	}
+
+	// same as deallocate(), for a block obtained with allocateAligned<sz, alignment>()
+	template<size_t sz, size_t alignment>
+	NODECPP_FORCEINLINE void deallocateAligned(void* ptr)
+	{
+		deallocate< alignedRequestSize<sz, alignment>() >( ptr );
 	}
 
 	NODECPP_FORCEINLINE size_t getAllocatedSize(void* ptr)
@@ -1242,7 +2137,7 @@ public:
 		if(ptr)
 		{
 			size_t offsetInPage = PageAllocatorT::getOffsetInPage( ptr );
-			constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+			constexpr size_t memForbidden = largeChunkOffset;
 			if ( offsetInPage != memForbidden )
 			{
 				size_t idx = PageAllocatorT::addressToIdx( ptr );
@@ -1266,30 +2161,456 @@ public:
 			return 0;
 	}
 	
-	const BlockStats& getStats() const { return pageAllocator.getStats(); }
+	const BlockStats& getStats() const { return pageAllocator.getStats(); } // page tier only; see getAllocatorStats()
+
+	AllocatorStats getAllocatorStats() const
+	{
+		AllocatorStats ret;
+		ret.pageTier = pageAllocator.getStats();
+		ret.bulkTier = bulkAllocator.getStats();
+		ret.metadataTier = pageAllocator.getDescriptorStats();
+		ret.metadataTier.add( bulkAllocator.getBlockListStats() );
+		ret.metadataTier.add( bulkAllocator.getLargeChunkListStats() );
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+		for ( size_t i=0; i<BucketCount; ++i )
+			ret.buckets[i] = bucketStats[i];
+		ret.largeChunks = largeChunkStats;
+#endif
+		return ret;
+	}
 	
 	void printStats() const 
 	{
-		pageAllocator.printStats();
+		getAllocatorStats().printStats();
 	}
 
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+	// makes current stats visible to other threads (see StatsRegistry); is also done on slow paths
+	NODECPP_NOINLINE void publishStats()
+	{
+		PublishedStats ps;
+		ps.allocatorID = pageAllocator.getOwnerID();
+		ps.publishCount = ++statsPublishCount;
+		ps.pageTier.set( pageAllocator.getStats(), pageAllocator.getCachedSize() );
+		ps.bulkTier.set( bulkAllocator.getStats(), bulkAllocator.getCachedSize() );
+		BlockStats metadata = pageAllocator.getDescriptorStats();
+		metadata.add( bulkAllocator.getBlockListStats() );
+		metadata.add( bulkAllocator.getLargeChunkListStats() );
+		ps.metadataTier.set( metadata, 0 );
+		StatsRegistry::publish( statsSlot, ps );
+	}
+#endif
+
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+	void setHeapProfilerSamplingInterval( size_t bytes ) { heapProfiler.setSamplingInterval( bytes ); }
+	bool dumpHeapProfile( const char* fileName ) const { return heapProfiler.dumpPprof( fileName ); }
+	bool dumpHeapProfileFolded( const char* fileName, bool live = true ) const { return heapProfiler.dumpFolded( fileName, live ); }
+#endif
+
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+	// one file per allocator (thread); starting a trace on an already recording allocator restarts it with a new file
+	bool startAllocationTrace( const char* fileName ) { return traceRecorder.start( fileName ); }
+	bool stopAllocationTrace() { return traceRecorder.stop(); }
+#endif
+
 	void initialize(size_t size)
 	{
 		initialize();
 	}
 
+	// owner ID recorded for address space taken from the reservation arena from now on (see reservation_arena.h)
+	void setOwnerID( uint16_t id )
+	{
+		pageAllocator.setOwnerID( id );
+		bulkAllocator.setOwnerID( id );
+		statsPublish();
+	}
+
+	void setUserPtr( size_t idx, void* ptr )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, idx < UserPtrCount );
+		userPtrs[idx] = ptr;
+	}
+	void* getUserPtr( size_t idx ) const
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, idx < UserPtrCount );
+		return userPtrs[idx];
+	}
+
+	// Writes the whole heap (all memory in use, allocator state and user pointers) to a file; see heap_image.h.
+	// The allocator is not changed; it must not be used (e.g. by operator new) until the call returns.
+	bool serialize( const char* fileName ) { return writeImage( fileName, 0, 0, nullptr ); }
+	// same as above, with addresses of pointers (in the heap, to objects in the heap) to be fixed if the heap
+	// is restored elsewhere (see deserializeRelocating())
+	bool serialize( const char* fileName, const void* const* pointerLocations, size_t pointerLocationCount )
+	{
+		return writeImage( fileName, 0, 0, nullptr, pointerLocations, pointerLocationCount );
+	}
+
+	// Writes the next checkpoint of a chain: the first one (and the first one after resetCheckpoints()) is a full
+	// image; each of the next ones is a delta with only pages modified since the previous checkpoint (where
+	// soft-dirty bits are available; otherwise, the delta has all the data). To restore, the chain (in order)
+	// is merged by compactHeapImages() into a single image. The same constraints as for serialize() apply.
+	bool checkpoint( const char* fileName )
+	{
+		if ( checkpointSequence == 0 )
+		{
+			checkpointChainID = ( (uint64_t)std::chrono::system_clock::now().time_since_epoch().count() << 16 ) ^ (uintptr_t)this;
+			if ( checkpointChainID == 0 )
+				checkpointChainID = 1;
+			checkpointClearCount = SoftDirtyPages::clear(); // anything modified from now on goes to the next delta
+			if ( !writeImage( fileName, checkpointChainID, 0, nullptr ) )
+				return false;
+		}
+		else
+		{
+			SoftDirtyPages dirtyPages;
+			// if bits were cleared by someone else since the last checkpoint, some of our modified pages may look clean
+			bool useDirtyPages = SoftDirtyPages::getClearCount() == checkpointClearCount && checkpointClearCount != 0 && dirtyPages.open();
+			if ( !writeImage( fileName, checkpointChainID, checkpointSequence, useDirtyPages ? &dirtyPages : nullptr ) )
+				return false;
+			if ( useDirtyPages && SoftDirtyPages::getClearCount() != checkpointClearCount ) // the same, but while writing
+				if ( !writeImage( fileName, checkpointChainID, checkpointSequence, nullptr ) )
+					return false;
+			checkpointClearCount = SoftDirtyPages::clear();
+		}
+		++checkpointSequence;
+		return true;
+	}
+
+	// the next checkpoint starts a new chain
+	void resetCheckpoints() { checkpointSequence = 0; }
+
+	// Replaces the whole heap with one written by serialize() (in this or another process of the same executable),
+	// at exactly the same addresses. Returns false (leaving the heap empty) if an image is not valid, or any of
+	// its address ranges is already in use.
+	bool deserialize( const char* fileName )
+	{
+		resetHeap();
+		bool ok = readImage( fileName );
+		if ( !ok )
+			resetHeap();
+		return ok;
+	}
+
+	// Same as deserialize(), but for any free address space: each reservation is moved by a multiple of 8 MiB,
+	// and allocator pointers, user pointers (see setUserPtr()) and pointers at locations recorded with the image
+	// or given here (as addresses in the original heap) are fixed. relocation is then to be used for any other
+	// pointer into the heap. Returns false (leaving the heap empty) if a pointer location is not in the heap, too.
+	bool deserializeRelocating( const char* fileName, HeapRelocation& relocation, const void* const* pointerLocations = nullptr, size_t pointerLocationCount = 0 )
+	{
+		resetHeap();
+		relocation.clear();
+		bool ok = readImage( fileName, &relocation );
+		for ( size_t i=0; ok && i<pointerLocationCount; ++i )
+			ok = fixPointerAt( relocation, (uint64_t)(uintptr_t)( pointerLocations[i] ) );
+		if ( !ok )
+		{
+			resetHeap();
+			relocation.clear();
+		}
+		return ok;
+	}
+
+	// Moves the heap to a file (see persistent_heap.h). The current heap is dropped; then, if the file is empty,
+	// a new heap of at most capacity bytes is started in it; otherwise, the heap last closed in the file (by this
+	// or another process of the same executable) is taken over with all its objects at their addresses.
+	// Returns false (with the file untouched and the heap empty) if the file is not a properly closed heap, or its
+	// address range is already in use.
+	bool openPersistentHeap( const char* fileName, size_t capacity )
+	{
+		closePersistentHeap();
+		resetHeap();
+		bool existing = false;
+		return persistentHeap.open( fileName, capacity, heapImageLayout, existing ) && attachPersistentHeap( existing );
+	}
+	// same as above, but for an open file (e.g. memfd); fd is closed with the heap if ownFd
+	bool openPersistentHeap( int fd, bool ownFd, size_t capacity )
+	{
+		closePersistentHeap();
+		resetHeap();
+		bool existing = false;
+		return persistentHeap.open( fd, ownFd, capacity, heapImageLayout, existing ) && attachPersistentHeap( existing );
+	}
+
+	// Writes metadata of the heap to its file, and unmaps it (the heap is empty then); returns false if metadata could
+	// not be written, and the file cannot be reopened then. Is called on destruction of the allocator, too.
+	// Note: the file is reopened only after closing; so content created after opening is lost on a crash.
+	bool closePersistentHeap()
+	{
+		if ( !persistentHeap.isOpen() )
+			return false;
+		FILE* stream = persistentHeap.openImageStream( true );
+		bool ok = false;
+		if ( stream != nullptr )
+		{
+			HeapImageWriter w;
+			if ( w.openStream( stream, heapImageLayout, true ) )
+			{
+				writeHeap( w );
+				ok = w.close() && persistentHeap.markClean( w.getSize() );
+			}
+		}
+		if ( !ok )
+			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "persistent heap: writing metadata failed" );
+		detachPersistentHeap();
+		return ok;
+	}
+	bool isPersistentHeapOpen() const { return persistentHeap.isOpen(); }
+
+	// Writes the heap, as it is at the moment of the call, to a file (the same image as by serialize()) in the
+	// background: in a forked process, while the allocator goes on being used (see heap_snapshot.h). Returns false
+	// if the process could not be started, or the heap is persistent (its pages would be shared with the child
+	// rather than copied on write, so the image would not be consistent).
+	// Note: fork() copies page tables of the whole process; for huge processes this may take a while.
+	bool startSnapshot( const char* fileName, HeapSnapshot& snapshot )
+	{
+		return startSnapshot( fileName, snapshot, [](){} );
+	}
+
+protected:
+	// same as above; prepareInChild() is called in the forked process before the heap is written
+	template<class F>
+	bool startSnapshot( const char* fileName, HeapSnapshot& snapshot, F&& prepareInChild )
+	{
+		if ( persistentHeap.isOpen() )
+			return false;
+		return snapshot.start( [this, fileName, &prepareInChild]( uint64_t& bytesWritten ) {
+			prepareInChild();
+			HeapImageWriter w;
+			if ( !w.open( fileName, heapImageLayout, 0, 0, nullptr ) )
+				return false;
+			writeHeap( w );
+			bool ok = w.close();
+			bytesWritten = w.getSize();
+			return ok;
+		} );
+	}
+
+public:
+	// Handing the heap over to another thread: the allocator is bound to the thread that initialized it; the owner
+	// thread calls detachFromThread(), then the allocator is passed to another thread (with proper synchronization,
+	// e.g. via a queue), and that one calls attachToThread(). In between, the allocator must not be used at all.
+	// Blocks allocated before detaching stay valid and are to be deallocated by the new owner.
+	void detachFromThread()
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !isDetached(), "allocator is already detached" );
+		checkOwnerThread();
+		ownerThread = std::thread::id();
+	}
+	void attachToThread()
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isDetached(), "to attachToThread() allocator must be detached first" );
+		ownerThread = std::this_thread::get_id();
+	}
+	bool isDetached() const { return ownerThread == std::thread::id(); }
+	bool isOwnedByCurrentThread() const { return ownerThread == std::this_thread::get_id(); }
+
+	// Pages of regions (see Region) are sounding-address pages of a bucket index no size maps to; so deallocate()
+	// of a block of a region puts it to a free list that is never used for allocation (and is dropped with the pages).
+	// Objects start past the offset that deallocate() takes for a large chunk, maximally aligned.
+	static constexpr size_t RegionBucketIdx = BucketCount - 1;
+	static constexpr size_t regionPageDataOffset = alignUpExp( largeChunkOffset + 1, sizeToExp( maximalSupportedAlignment ) );
+	static constexpr size_t regionPageSize = PAGE_SIZE_BYTES;
+
+	void* getRegionPage()
+	{
+#ifdef USE_EXP_BUCKET_SIZES
+		static_assert( sizeToIndexConstexpr<MaxBucketSize>() < RegionBucketIdx );
+#elif defined USE_HALF_EXP_BUCKET_SIZES
+		static_assert( sizeToIndexHalfExpConstexpr<MaxBucketSize>() < RegionBucketIdx );
+#elif defined USE_QUAD_EXP_BUCKET_SIZES
+		static_assert( sizeToIndexQuarterExpConstexpr<MaxBucketSize>() < RegionBucketIdx );
+#endif
+		checkOwnerThread();
+		if ( regionPageCache != nullptr )
+		{
+			void* ret = regionPageCache;
+			regionPageCache = *reinterpret_cast<void**>( ret );
+			return ret;
+		}
+		void* ret = pageAllocator.getPage( RegionBucketIdx );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, PageAllocatorT::addressToIdx( ret ) == RegionBucketIdx );
+		return ret;
+	}
+	// pages, from first to last, are linked through the first word; they are kept for further regions
+	void releaseRegionPages( void* first, void* last )
+	{
+		checkOwnerThread();
+		*reinterpret_cast<void**>( last ) = regionPageCache;
+		regionPageCache = first;
+		buckets[RegionBucketIdx] = nullptr; // may hold blocks of released pages
+	}
+
 	void initialize()
 	{
 		memset( buckets, 0, sizeof( void* ) * BucketCount );
+		memset( userPtrs, 0, sizeof( void* ) * UserPtrCount );
+		checkpointChainID = 0;
+		checkpointSequence = 0;
+		checkpointClearCount = 0;
+		ownerThread = std::this_thread::get_id();
+		regionPageCache = nullptr;
+#ifdef NODECPP_IIBMALLOC_PAGE_COLOURING
+		nextPageColour = 0;
+#endif
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+		if ( statsSlot == nullptr )
+			statsSlot = StatsRegistry::acquireSlot();
+		statsPublishCount = 0;
+#endif
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+		memset( &pageLocal, 0, sizeof( pageLocal ) );
+#endif
+#ifdef NODECPP_IIBMALLOC_BUCKET_STATS
+		for ( size_t i=0; i<BucketCount; ++i )
+			bucketStats[i] = BucketStats();
+		largeChunkStats = BucketStats();
+#endif
 		pageAllocator.initialize( PAGE_SIZE_EXP );
 		bulkAllocator.initialize( PAGE_SIZE_EXP );
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+		heapProfiler.initialize( PAGE_SIZE_EXP );
+#endif
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.initialize( PAGE_SIZE_EXP );
+#endif
 	}
 
 private:
+	void writeHeap( HeapImageWriter& w )
+	{
+		w.writeMeta( userPtrs, sizeof( userPtrs ) );
+		void* bucketsToWrite[BucketCount];
+		memcpy( bucketsToWrite, buckets, sizeof( buckets ) );
+		bucketsToWrite[RegionBucketIdx] = nullptr; // may point to pages already reused (see Region); cached region pages are left as used memory
+		w.writeMeta( bucketsToWrite, sizeof( bucketsToWrite ) );
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+		w.writeMeta( &pageLocal, sizeof( pageLocal ) );
+#endif
+		pageAllocator.serialize( w );
+		bulkAllocator.serialize( w );
+	}
+
+	bool writeImage( const char* fileName, uint64_t chainID, uint64_t sequence, SoftDirtyPages* dirtyPages, const void* const* pointerLocations = nullptr, size_t pointerLocationCount = 0 )
+	{
+		HeapImageWriter w;
+		if ( !w.open( fileName, heapImageLayout, chainID, sequence, dirtyPages ) )
+			return false;
+		writeHeap( w );
+		w.writePointerLocations( pointerLocations, pointerLocationCount );
+		return w.close();
+	}
+
+	template<class SourceT> // file name or stream
+	bool readImage( SourceT source, HeapRelocation* relocation = nullptr )
+	{
+		HeapImageReader r;
+		if ( !( r.open( source, heapImageLayout ) &&
+			r.readMeta( userPtrs, sizeof( userPtrs ) ) &&
+			r.readMeta( buckets, sizeof( buckets ) ) &&
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+			r.readMeta( &pageLocal, sizeof( pageLocal ) ) &&
+#endif
+			pageAllocator.deserialize( r, relocation ) &&
+			bulkAllocator.deserialize( r, relocation ) ) )
+			return false;
+		if ( relocation == nullptr )
+			return r.readPointerLocations( []( uint64_t ) {} ) && r.close();
+		relocateHeap( *relocation );
+		bool ok = true;
+		return r.readPointerLocations( [&]( uint64_t location ) { ok = ok && fixPointerAt( *relocation, location ); } ) && r.close() && ok;
+	}
+
+	// fixes allocator pointers (and user ones) after a relocating restore
+	void relocateHeap( const HeapRelocation& relocation )
+	{
+		for ( size_t i=0; i<UserPtrCount; ++i )
+			relocation.fixPointer( userPtrs[i] );
+		for ( size_t i=0; i<BucketCount; ++i )
+		{
+			relocation.fixPointer( buckets[i] );
+			for ( void* item = buckets[i]; item != nullptr; item = *reinterpret_cast<void**>( item ) )
+				relocation.fixPointer( *reinterpret_cast<void**>( item ) );
+		}
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+		relocatePageLocalLists( relocation );
+#endif
+		bulkAllocator.relocate( relocation );
+	}
+
+	// location: in the original heap
+	bool fixPointerAt( const HeapRelocation& relocation, uint64_t location )
+	{
+		void** original = reinterpret_cast<void**>( (uintptr_t)location );
+		if ( (uintptr_t)location != location || ( location & ( sizeof(void*) - 1 ) ) != 0 || !relocation.isInOriginalHeap( original ) )
+			return false;
+		relocation.fixPointer( *relocation.translate( original ) );
+		return true;
+	}
+
+	bool attachPersistentHeap( bool existing )
+	{
+		// the file is not in the reservation arena; without its range registered, its blocks would not be told from malloc()'ed ones
+		if ( !ReservationArena::registerExternalRange( persistentHeap.getRangeBegin(), persistentHeap.getRangeSize(), pageAllocator.getOwnerID() ) )
+			ReservationArena::registerOverflow();
+		pageAllocator.setPersistentSource( &persistentHeap );
+		bulkAllocator.setPersistentSource( &persistentHeap );
+		bool ok = true;
+		if ( existing )
+		{
+			FILE* stream = persistentHeap.openImageStream( false );
+			ok = stream != nullptr && readImage( stream );
+		}
+		ok = ok && persistentHeap.markInUse(); // until closed, metadata in the file is not valid
+		if ( !ok )
+			detachPersistentHeap();
+		return ok;
+	}
+
+	// forgets the heap with its content kept in the file
+	void detachPersistentHeap()
+	{
+		persistentHeap.detach();
+		resetHeap();
+		pageAllocator.setPersistentSource( nullptr );
+		bulkAllocator.setPersistentSource( nullptr );
+		ReservationArena::unregisterExternalRange( persistentHeap.getRangeBegin() );
+		persistentHeap.close();
+	}
+
+	// releases all memory; other parts of the state (stats, profiler, trace) are kept
+	void resetHeap()
+	{
+		pageAllocator.deinitialize();
+		bulkAllocator.deinitialize();
+		pageAllocator.initialize( PAGE_SIZE_EXP );
+		bulkAllocator.initialize( PAGE_SIZE_EXP );
+		memset( buckets, 0, sizeof( void* ) * BucketCount );
+		memset( userPtrs, 0, sizeof( void* ) * UserPtrCount );
+		regionPageCache = nullptr;
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+		memset( &pageLocal, 0, sizeof( pageLocal ) );
+#endif
+		checkpointSequence = 0; // a previous chain is not related to a new heap
+	}
+
 	void deinitialize()
 	{
+		closePersistentHeap();
 		pageAllocator.deinitialize();
 		bulkAllocator.deinitialize();
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+		if ( statsSlot != nullptr )
+			StatsRegistry::releaseSlot( statsSlot );
+		statsSlot = nullptr;
+#endif
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+		heapProfiler.deinitialize();
+#endif
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+		traceRecorder.deinitialize();
+#endif
 	}
 
 public:
@@ -1324,6 +2645,111 @@ public:
 	}
 };
 
+// Region (arena) for request-scoped temporaries: blocks are bump-allocated in pages of the allocator (see
+// IibAllocatorBase::getRegionPage()) and all of them are released at once by reset(), which just returns the pages
+// to the allocator. Deallocating a block of a region (including by operator delete) does nothing harmful, but does
+// not make its memory reusable either. Blocks above maxInPageSize are ordinary blocks of the allocator, which reset()
+// deallocates; they must not be deallocated otherwise. Blocks of a region are not zombieable.
+template<class AllocatorT>
+class Region
+{
+	struct LargeBlock
+	{
+		void* block;
+		LargeBlock* next;
+	};
+
+	AllocatorT& allocator;
+	void* firstPage = nullptr; // pages are linked through the first word
+	void* lastPage = nullptr;
+	uint8_t* current = nullptr;
+	uint8_t* end = nullptr;
+	LargeBlock* largeBlocks = nullptr;
+	size_t pageCount = 0;
+
+	NODECPP_NOINLINE void* allocateInNextPage( size_t sz )
+	{
+		void* page = allocator.getRegionPage();
+		*reinterpret_cast<void**>( page ) = nullptr;
+		if ( lastPage != nullptr )
+			*reinterpret_cast<void**>( lastPage ) = page;
+		else
+			firstPage = page;
+		lastPage = page;
+		++pageCount;
+		current = reinterpret_cast<uint8_t*>( page ) + IibAllocatorBase::regionPageDataOffset;
+		end = reinterpret_cast<uint8_t*>( page ) + IibAllocatorBase::regionPageSize;
+		void* ret = current;
+		current += sz;
+		return ret;
+	}
+
+	template<size_t alignment>
+	NODECPP_NOINLINE void* allocateLarge( size_t sz )
+	{
+		LargeBlock* lb = reinterpret_cast<LargeBlock*>( allocate( sizeof( LargeBlock ) ) );
+		lb->block = allocator.template allocateAligned<alignment>( sz );
+		lb->next = largeBlocks;
+		largeBlocks = lb;
+		return lb->block;
+	}
+
+public:
+	static constexpr size_t maxInPageSize = IibAllocatorBase::regionPageSize - IibAllocatorBase::regionPageDataOffset;
+
+	Region( AllocatorT& allocator_ ) : allocator( allocator_ ) {}
+	Region( const Region& ) = delete;
+	Region& operator = ( const Region& ) = delete;
+	~Region() { reset(); }
+
+	NODECPP_FORCEINLINE void* allocate( size_t sz )
+	{
+		sz = sz ? alignUpExp( sz, ALIGNMENT_EXP ) : ALIGNMENT;
+		if ( sz <= (size_t)( end - current ) )
+		{
+			void* ret = current;
+			current += sz;
+			return ret;
+		}
+		return sz <= maxInPageSize ? allocateInNextPage( sz ) : allocateLarge<ALIGNMENT>( sz );
+	}
+
+	template<size_t alignment>
+	NODECPP_FORCEINLINE void* allocateAligned( size_t sz )
+	{
+		static_assert( alignment <= AllocatorT::maximalSupportedAlignment );
+		if ( sz > maxInPageSize )
+			return allocateLarge<alignment>( sz );
+		if constexpr ( alignment > ALIGNMENT )
+		{
+			uint8_t* aligned = reinterpret_cast<uint8_t*>( alignUpExp( (uintptr_t)current, sizeToExp( alignment ) ) );
+			if ( aligned <= end ) // otherwise, a next page is taken, and it is aligned well enough
+				current = aligned;
+		}
+		void* ret = allocate( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::pedantic, ((uintptr_t)ret & (alignment - 1)) == 0, "ret = 0x{:x}, alignment = {}", (uintptr_t)ret, alignment );
+		return ret;
+	}
+
+	static void deallocate( void* ) {}
+
+	// releases all blocks of the region
+	void reset()
+	{
+		for ( LargeBlock* lb = largeBlocks; lb != nullptr; lb = lb->next )
+			allocator.deallocate( lb->block );
+		largeBlocks = nullptr;
+		if ( firstPage != nullptr )
+			allocator.releaseRegionPages( firstPage, lastPage );
+		firstPage = nullptr;
+		lastPage = nullptr;
+		current = nullptr;
+		end = nullptr;
+		pageCount = 0;
+	}
+
+	size_t getPageCount() const { return pageCount; }
+};
 
 #ifdef NODECPP_DISNABLE_SAFE_ALLOCATION_MEANS
 typedef IibAllocatorBase ThreadLocalAllocatorT;
@@ -1339,48 +2765,67 @@ extern thread_local ThreadLocalAllocatorT* g_CurrentAllocManager;
 
 #include <atomic>
 
+#ifdef NODECPP_IIBMALLOC_OUT_OF_BAND_ZOMBIE_LINKS
+constexpr size_t guaranteed_prefix_size = 0;
+#else
 constexpr size_t guaranteed_prefix_size = 8;
+#endif
 
 class SafeIibAllocator : protected IibAllocatorBase
 {
+#ifdef NODECPP_IIBMALLOC_OUT_OF_BAND_ZOMBIE_LINKS
+	using ZombieListSegmentPoolT = ZombieListSegmentPool<PageAllocatorWithCaching>;
+	using ZombieListT = OutOfBandZombieList<ZombieListSegmentPoolT>;
+#else
 	static_assert( guaranteed_prefix_size >= sizeof(void*) ); // required to keep zombie list item pointer 'next' inside a block
+	using ZombieListSegmentPoolT = NoZombieListSegmentPool;
+	using ZombieListT = IntrusiveZombieList<ZombieListSegmentPoolT>;
+#endif
 
 	static std::atomic<uint16_t> allocatorIDBase;
 	uint16_t allocatorID_;
 
 protected:
-	void** zombieBucketsFirst[BucketCount];
-	void** zombieBucketsLast[BucketCount];
-	void* zombieLargeChunks;
+	ZombieListSegmentPoolT zombieListSegmentPool;
+	ZombieListT zombieBuckets[BucketCount];
+	ZombieListT zombieLargeChunks;
+	size_t zombieBytes; // total size of blocks currently kept as zombies
+	size_t zombieQuarantineBudget; // 0: no limit (zombies are kept until killAllZombies())
+	size_t zombieReleaseCursor; // next zombie list to release from when over budget; BucketCount stands for large chunks
+	// zombies that are known to be unreachable (see markZombiesForReclamation()), but are not yet released
+	ZombieListT reclaimBuckets[BucketCount];
+	ZombieListT reclaimLargeChunks;
+	size_t reclaimCursor;
+	bool protectLargeZombies_; // all pages of a large zombie but the first one (with chunk header and, possibly, list link) are made inaccessible
+	static constexpr uintptr_t protectedLargeZombieTag = 1; // set in items of large zombie lists whose pages were actually protected (see ProtectMemory())
+	static_assert( ( protectedLargeZombieTag & zombie_list_item_tag_mask ) == protectedLargeZombieTag );
+
+	// epoch-based deferred reclamation; see epoch_reclamation.h
+	static constexpr size_t retiredListCount = 3; // blocks retired at epochs e-1, e, and e-2 or earlier (i.e. ready)
+	static constexpr size_t retireCallsPerEpochAdvance = 64;
+	using RetiredListT = OutOfBandZombieList<ZombieListSegmentPool<PageAllocatorWithCaching>>; // retired blocks may still be read, so no intrusive links
+	ZombieListSegmentPool<PageAllocatorWithCaching> retiredListSegmentPool;
+	RetiredListT retiredLists[retiredListCount];
+	uint64_t retiredListEpochs[retiredListCount] = {};
+	size_t retireCallsSinceEpochAdvance = 0;
+	EpochParticipant* epochParticipant = nullptr;
+	size_t epochNestingLevel = 0;
 
 #ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
-	class ThisAllocator
-	{
-		IibAllocatorBase* allocator;
-	public:
-		static constexpr bool objectRequired = true;
-		static constexpr size_t guaranteed_alignment = NODECPP_GUARANTEED_IIBMALLOC_ALIGNMENT;
-	public:
-		ThisAllocator( IibAllocatorBase* allocator_ ) : allocator( allocator_ ) {}
-		ThisAllocator( const ThisAllocator& other ) = default;
-		ThisAllocator& operator = ( const ThisAllocator& other ) = default;
-		ThisAllocator( ThisAllocator&& other ) = delete;
-		ThisAllocator& operator = ( ThisAllocator&& other ) = delete;
-		template<size_t alignment = 0> 
-		NODECPP_FORCEINLINE void* allocate( size_t allocSize ) { return allocator->allocateAligned<alignment>( allocSize ); }
-		template<size_t alignment = 0> 
-		NODECPP_FORCEINLINE void deallocate( void* ptr ) { allocator->deallocate( ptr ); }
-	};
-	template<class _Ty>
-	using thisallocator = ::nodecpp::selective_allocator<ThisAllocator, _Ty>; // NOTE: map::ctor perform allocations. Since mechanics of ThisAllocator assumes ptr to current allocator which is yet to be set at tome of allocator creation, this won't work. If iibmalloc is desired for such purposes further consideration is necessary
-//	using thisallocator = ::nodecpp::selective_allocator<StdRawAllocator, _Ty>;
-	using dataptrt = uint8_t*;
-	std::map<uint8_t*, size_t, std::greater<uint8_t*>, thisallocator<std::pair<const dataptrt, size_t>>> zombieMap;
+	ZombieSet<PageAllocatorWithCaching, reservation_size_exp, PAGE_SIZE_EXP, 3> zombieSet; // granule: 8 bytes (bucket sizes are multiples of 8)
 	bool doZombieEarlyDetection_ = true;
 #endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
 	
 public:
-	SafeIibAllocator() : zombieMap( thisallocator<std::pair<const dataptrt, size_t>>(ThisAllocator(this) ) ) { initialize(); }
+	SafeIibAllocator()
+	{
+		zombieListSegmentPool.initialize( PAGE_SIZE_EXP );
+		retiredListSegmentPool.initialize( PAGE_SIZE_EXP );
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		zombieSet.initialize( PAGE_SIZE_EXP );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		initialize();
+	}
 	SafeIibAllocator(const SafeIibAllocator&) = delete;
 	SafeIibAllocator(SafeIibAllocator&&) = default;
 	SafeIibAllocator& operator=(const SafeIibAllocator&) = delete;
@@ -1388,12 +2833,28 @@ public:
 	
 	auto allocatorID() { return allocatorID_; }
 
+	// true if ptr points to memory reserved by this allocator (and not by another allocator or malloc());
+	// always false for memory outside the reservation arena and its external ranges (see ReservationArena::hasOverflowed())
+	bool owns( const void* ptr ) const { return ReservationArena::ownerOf( ptr ) == allocatorID_ || persistentHeap.contains( ptr ); }
+
 	using IibAllocatorBase::maximalSupportedAlignment;
+	using IibAllocatorBase::AllocatorStats;
+
+	// Large zombies (bulk chunks of more than a page) get all pages but the first one protected from any access,
+	// so that use-after-free of a large buffer traps regardless of isPointerNotZombie() checks.
+	// Note: each protected chunk typically costs a separate kernel mapping (cf. vm.max_map_count on Linux).
+	bool protectLargeZombies( bool doIt = true )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, zombieLargeChunks.empty() && reclaimLargeChunks.empty(), "to (re)set protectLargeZombies() there must be no large zombies" );
+		bool ret = protectLargeZombies_;
+		protectLargeZombies_ = doIt;
+		return ret;
+	}
 
 	bool doZombieEarlyDetection( bool doIt = true )
 	{
 #ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, zombieMap.empty(), "to (re)set doZombieEarlyDetection() zombieMap must be empty" );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, zombieSet.empty(), "to (re)set doZombieEarlyDetection() there must be no zombies" );
 		bool ret = doZombieEarlyDetection_;
 		doZombieEarlyDetection_ = doIt;
 		return ret;
@@ -1425,6 +2886,24 @@ public:
 		IibAllocatorBase::deallocate( ptr );
 	}
 
+	template<size_t sz>
+	NODECPP_FORCEINLINE void deallocate(void* ptr )
+	{
+		IibAllocatorBase::deallocate<sz>( ptr );
+	}
+
+	template<size_t sz>
+	NODECPP_FORCEINLINE void allocateMany( void** out, size_t count )
+	{
+		IibAllocatorBase::allocateMany<sz>( out, count );
+	}
+
+	template<size_t sz, size_t alignment>
+	NODECPP_FORCEINLINE void deallocateAligned(void* ptr )
+	{
+		IibAllocatorBase::deallocateAligned<sz, alignment>( ptr );
+	}
+
 	NODECPP_FORCEINLINE size_t isPointerInBlock(void* allocatedPtr, void* ptr )
 	{
 		return ptr >= allocatedPtr && reinterpret_cast<uint8_t*>(ptr) < reinterpret_cast<uint8_t*>(allocatedPtr) + IibAllocatorBase::getAllocatedSize( ptr );
@@ -1452,99 +2931,433 @@ public:
 
 	NODECPP_FORCEINLINE void zombieableDeallocate(void* userPtr)
 	{
+		checkOwnerThread();
 		//void* ptr = reinterpret_cast<void**>(userPtr) - 1;
 		void* ptr = reinterpret_cast<uint8_t*>(userPtr) - guaranteed_prefix_size;
 		if(ptr)
 		{
-#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
-			if ( doZombieEarlyDetection_ )
-			{
-				size_t allocSize = IibAllocatorBase::getAllocatedSize(ptr);
-				zombieMap.insert( std::make_pair( reinterpret_cast<uint8_t*>(ptr), allocSize ) );
-			}
-#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
-
+			profilerRegisterDealloc( ptr );
+			traceRegisterZombie( ptr );
 			size_t offsetInPage = PageAllocatorT::getOffsetInPage( ptr );
-			constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+			constexpr size_t memForbidden = largeChunkOffset;
 			if ( offsetInPage != memForbidden ) // small and medium size
 			{
 				size_t idx = PageAllocatorT::addressToIdx( ptr );
-				if ( zombieBucketsFirst[idx] ) // LIKELY
-				{
-					if ( zombieBucketsLast[idx] )
-						*(zombieBucketsLast[idx]) = ptr;
-					zombieBucketsLast[idx] = reinterpret_cast<void**>( ptr );
-				}
-				else
-				{
-					zombieBucketsFirst[idx] = reinterpret_cast<void**>( ptr );
-					if ( zombieBucketsLast[idx] )
-						*(zombieBucketsLast[idx]) = ptr;
-					zombieBucketsLast[idx] = reinterpret_cast<void**>( ptr );
-				}
+				statsRegisterBucketDealloc( idx );
+				size_t allocSize = bucketIndexToSize( idx );
+				zombieBytes += allocSize;
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+				if ( doZombieEarlyDetection_ )
+					zombieSet.insertBucketBlock( ptr, allocSize );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+				zombieBuckets[idx].pushBack( ptr, zombieListSegmentPool );
 			}
 			else
 			{
-				*reinterpret_cast<void**>( ptr ) = zombieLargeChunks;
-				zombieLargeChunks = ptr;
+				statsRegisterLargeDealloc();
+				void* pageStart = PageAllocatorT::ptrToPageStart( ptr );
+				size_t allocSize = bulkAllocator.getAllocatedSize( pageStart );
+				zombieBytes += allocSize;
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+				if ( doZombieEarlyDetection_ )
+					zombieSet.insertBulkChunk( pageStart, allocSize );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+				void* item = ptr;
+				if ( protectLargeZombies_ && allocSize > PAGE_SIZE_BYTES && bulkAllocator.ProtectMemory( reinterpret_cast<uint8_t*>( pageStart ) + PAGE_SIZE_BYTES, allocSize - PAGE_SIZE_BYTES ) )
+					item = reinterpret_cast<void*>( (uintptr_t)ptr | protectedLargeZombieTag );
+				zombieLargeChunks.pushBack( item, zombieListSegmentPool );
 			}
+			if ( zombieQuarantineBudget != 0 && zombieBytes > zombieQuarantineBudget ) // UNLIKELY
+				releaseZombiesOverBudget();
 		}
 	}
 
-	NODECPP_FORCEINLINE size_t isZombieablePointerInBlock(void* allocatedPtr, void* ptr )
+private:
+	void releaseLargeZombie( void* item, bool updateZombieSet )
 	{
-		void* trueAllocatedPtr = reinterpret_cast<void**>(allocatedPtr) - 1;
-		return ptr >= allocatedPtr && reinterpret_cast<uint8_t*>(ptr) < reinterpret_cast<uint8_t*>(allocatedPtr) + IibAllocatorBase::getAllocatedSize( trueAllocatedPtr );
+		void* pageStart = PageAllocatorT::ptrToPageStart( item );
+		size_t allocSize = bulkAllocator.getAllocatedSize( pageStart );
+		zombieBytes -= allocSize;
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		if ( doZombieEarlyDetection_ && updateZombieSet )
+			zombieSet.eraseBulkChunk( pageStart, allocSize );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		if ( (uintptr_t)item & protectedLargeZombieTag )
+			bulkAllocator.UnprotectMemory( reinterpret_cast<uint8_t*>( pageStart ) + PAGE_SIZE_BYTES, allocSize - PAGE_SIZE_BYTES );
+		bulkAllocator.deallocate( pageStart );
 	}
 
+	// releases the oldest zombie of a given list (BucketCount stands for large chunks); returns the released block, or nullptr if the list is empty
+	void* releaseOldestZombie( ZombieListT (&bucketLists)[BucketCount], ZombieListT& largeList, size_t listIdx )
+	{
+		if ( listIdx < BucketCount )
+		{
+			void* z = bucketLists[listIdx].popFront( zombieListSegmentPool );
+			if ( z == nullptr )
+				return nullptr;
+			size_t allocSize = bucketIndexToSize( listIdx );
+			zombieBytes -= allocSize;
 #ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
-	NODECPP_FORCEINLINE bool isPointerNotZombie( void* ptr )
+			if ( doZombieEarlyDetection_ )
+				zombieSet.eraseBucketBlock( z, allocSize );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+			releaseToBucket( z, listIdx );
+			return z;
+		}
+		else
+		{
+			void* item = largeList.popFront( zombieListSegmentPool );
+			if ( item == nullptr )
+				return nullptr;
+			releaseLargeZombie( item, true );
+			return reinterpret_cast<void*>( (uintptr_t)item & ~protectedLargeZombieTag );
+		}
+	}
+
+	// lists are visited round-robin so that a single busy bucket does not get all of its zombies released first
+	NODECPP_NOINLINE void releaseZombiesOverBudget()
 	{
-		if ( doZombieEarlyDetection_ )
+		while ( zombieBytes > zombieQuarantineBudget )
+		{
+			void* z = reclaimOnePendingZombie(); // those already known to be unreachable go first
+			if ( z == nullptr )
+				break;
+			traceRegisterZombieRelease( z );
+		}
+		size_t emptyListsInRow = 0;
+		while ( zombieBytes > zombieQuarantineBudget && emptyListsInRow <= BucketCount )
 		{
-			auto iter = zombieMap.lower_bound( reinterpret_cast<uint8_t*>( ptr ) );
-			if ( iter != zombieMap.end() )
+			if ( void* z = releaseOldestZombie( zombieBuckets, zombieLargeChunks, zombieReleaseCursor ) )
 			{
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ptr >= iter->first );
-				return reinterpret_cast<uint8_t*>( ptr ) >= iter->first + iter->second;
+				traceRegisterZombieRelease( z );
+				emptyListsInRow = 0;
 			}
 			else
-				return true;
+				++emptyListsInRow;
+			zombieReleaseCursor = zombieReleaseCursor == BucketCount ? 0 : zombieReleaseCursor + 1;
 		}
-		else
-			return true;
+	}
+
+	void queueZombiesForReclamation()
+	{
+		for ( size_t idx=0; idx<BucketCount; ++idx)
+			reclaimBuckets[idx].append( zombieBuckets[idx], zombieListSegmentPool );
+		reclaimLargeChunks.append( zombieLargeChunks, zombieListSegmentPool );
+	}
+
+	// lists are drained one by one; returns the released block, or nullptr if there is nothing left to reclaim
+	void* reclaimOnePendingZombie()
+	{
+		for ( size_t i=0; i<=BucketCount; ++i )
+		{
+			if ( void* z = releaseOldestZombie( reclaimBuckets, reclaimLargeChunks, reclaimCursor ) )
+				return z;
+			reclaimCursor = reclaimCursor == BucketCount ? 0 : reclaimCursor + 1;
+		}
+		return nullptr;
+	}
+
+public:
+	// Quarantine mode: once the total size of zombies exceeds 'bytes', the oldest zombies are released (FIFO within each
+	// bucket) without waiting for killAllZombies(). Released blocks are no longer reported by isPointerNotZombie() and may be reused.
+	// 0 turns the limit off. Returns the previous value.
+	size_t setZombieQuarantineBudget( size_t bytes )
+	{
+		traceRegisterZombieQuarantineBudget( bytes );
+		size_t ret = zombieQuarantineBudget;
+		zombieQuarantineBudget = bytes;
+		if ( zombieQuarantineBudget != 0 && zombieBytes > zombieQuarantineBudget )
+			releaseZombiesOverBudget();
+		return ret;
+	}
+	size_t getZombieQuarantineBudget() const { return zombieQuarantineBudget; }
+	size_t getZombieBytes() const { return zombieBytes; }
+
+	// Epoch-based deferred reclamation (see epoch_reclamation.h); critical sections may be nested
+	NODECPP_FORCEINLINE void enterEpoch()
+	{
+		if ( epochNestingLevel++ == 0 )
+		{
+			if ( epochParticipant == nullptr ) // UNLIKELY
+				epochParticipant = EpochRegistry::acquireParticipant();
+			EpochRegistry::enter( epochParticipant );
+		}
+	}
+
+	NODECPP_FORCEINLINE void exitEpoch()
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, epochNestingLevel != 0 );
+		if ( --epochNestingLevel == 0 )
+			EpochRegistry::exit( epochParticipant );
+	}
+
+	// ptr must have been obtained with allocate()/allocateAligned() of this allocator; it is deallocated
+	// once no thread can still be reading it (i.e. after all critical sections active at the moment of the call are over)
+	void retire( void* ptr )
+	{
+		if ( ptr == nullptr )
+			return;
+		uint64_t epoch = EpochRegistry::currentEpoch();
+		size_t slot = epoch % retiredListCount;
+		if ( retiredListEpochs[slot] != epoch ) // the slot holds blocks retired at least retiredListCount epochs ago
+		{
+			releaseRetiredList( slot );
+			retiredListEpochs[slot] = epoch;
+		}
+		retiredLists[slot].pushBack( ptr, retiredListSegmentPool );
+		if ( ++retireCallsSinceEpochAdvance >= retireCallsPerEpochAdvance )
+			reclaimRetired();
+	}
+
+	// tries to advance the global epoch and deallocates retired blocks that are safe to deallocate; returns true if none is left
+	bool reclaimRetired()
+	{
+		retireCallsSinceEpochAdvance = 0;
+		EpochRegistry::tryAdvance();
+		uint64_t epoch = EpochRegistry::currentEpoch();
+		bool allReleased = true;
+		for ( size_t slot=0; slot<retiredListCount; ++slot )
+		{
+			if ( retiredLists[slot].empty() )
+				continue;
+			if ( retiredListEpochs[slot] + EpochRegistry::safeEpochDistance <= epoch )
+				releaseRetiredList( slot );
+			else
+				allReleased = false;
+		}
+		return allReleased;
+	}
+
+private:
+	void releaseRetiredList( size_t slot )
+	{
+		while ( void* ptr = retiredLists[slot].popFront( retiredListSegmentPool ) )
+			IibAllocatorBase::deallocate( ptr );
+	}
+
+public:
+
+	NODECPP_FORCEINLINE size_t isZombieablePointerInBlock(void* allocatedPtr, void* ptr )
+	{
+		void* trueAllocatedPtr = reinterpret_cast<uint8_t*>(allocatedPtr) - guaranteed_prefix_size;
+		return ptr >= allocatedPtr && reinterpret_cast<uint8_t*>(ptr) < reinterpret_cast<uint8_t*>(allocatedPtr) + IibAllocatorBase::getAllocatedSize( trueAllocatedPtr );
+	}
+
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	NODECPP_FORCEINLINE bool isPointerNotZombie( void* ptr )
+	{
+		return !doZombieEarlyDetection_ || !zombieSet.contains( ptr );
 	}
 #endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
 
 	NODECPP_FORCEINLINE void killAllZombies()
 	{
+		traceRegisterKillAllZombies();
 #ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, doZombieEarlyDetection_ || ( !doZombieEarlyDetection_ && zombieMap.empty() ) );
-		zombieMap.clear();
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, doZombieEarlyDetection_ || ( !doZombieEarlyDetection_ && zombieSet.empty() ) );
+		zombieSet.clear();
 #endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		queueZombiesForReclamation();
 		for ( size_t idx=0; idx<BucketCount; ++idx)
 		{
-			if ( zombieBucketsLast[idx] )
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+			if ( isPageLocalBucket( idx ) ) // blocks go to their pages one by one
 			{
-				*(zombieBucketsLast[idx]) = buckets[idx];
-				buckets[idx] = *(zombieBucketsFirst[idx]);
+				while ( void* z = reclaimBuckets[idx].popFront( zombieListSegmentPool ) )
+					releaseToBucket( z, idx );
+				continue;
 			}
-			zombieBucketsFirst[idx] = nullptr;
-			zombieBucketsLast[idx] = nullptr;
+#endif
+			reclaimBuckets[idx].moveToFreeList( buckets[idx], zombieListSegmentPool );
 		}
-		while ( zombieLargeChunks != nullptr )
+		while ( void* z = reclaimLargeChunks.popFront( zombieListSegmentPool ) )
+			releaseLargeZombie( z, false );
+		zombieBytes = 0;
+	}
+
+	// Incremental alternative to killAllZombies():
+	//   - markZombiesForReclamation() is called at the same point where killAllZombies() would be called;
+	//     it only moves all current zombies to a reclamation queue (a constant number of list splices)
+	//   - reclaimZombies() releases queued zombies in portions; zombies created after the mark are not affected
+	// Queued zombies are still reported by isPointerNotZombie() until actually released.
+	void markZombiesForReclamation()
+	{
+		traceRegisterMarkZombiesForReclamation();
+		queueZombiesForReclamation();
+	}
+
+	// releases at most maxItems queued zombies; returns true if the queue is empty
+	bool reclaimZombies( size_t maxItems )
+	{
+		for ( ; maxItems != 0; --maxItems )
 		{
-			void* next = *reinterpret_cast<void**>( zombieLargeChunks );
-			void* pageStart = PageAllocatorT::ptrToPageStart( zombieLargeChunks );
-			bulkAllocator.deallocate( pageStart );
-			zombieLargeChunks = next;
+			void* z = reclaimOnePendingZombie();
+			if ( z == nullptr )
+				return true;
+			traceRegisterZombieReclaim( z );
 		}
+		return !hasZombiesPendingReclamation();
+	}
+
+	// keeps releasing queued zombies for about budgetNs nanoseconds; returns true if the queue is empty
+	bool reclaimZombiesFor( uint64_t budgetNs )
+	{
+		constexpr size_t itemsPerClockCheck = 64;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds( budgetNs );
+		while ( !reclaimZombies( itemsPerClockCheck ) )
+			if ( std::chrono::steady_clock::now() >= deadline )
+				return false;
+		return true;
+	}
+
+	bool hasZombiesPendingReclamation() const
+	{
+		if ( !reclaimLargeChunks.empty() )
+			return true;
+		for ( size_t idx=0; idx<BucketCount; ++idx)
+			if ( !reclaimBuckets[idx].empty() )
+				return true;
+		return false;
 	}
 	
 	const BlockStats& getStats() const { return IibAllocatorBase::getStats(); }
+	AllocatorStats getAllocatorStats() const
+	{
+		AllocatorStats ret = IibAllocatorBase::getAllocatorStats();
+		ret.metadataTier.add( zombieListSegmentPool.getStats() );
+		ret.metadataTier.add( retiredListSegmentPool.getStats() );
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		ret.metadataTier.add( zombieSet.getStats() );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		return ret;
+	}
+
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+	using IibAllocatorBase::setHeapProfilerSamplingInterval;
+	using IibAllocatorBase::dumpHeapProfile;
+	using IibAllocatorBase::dumpHeapProfileFolded;
+#endif
+#ifdef NODECPP_IIBMALLOC_ALLOCATION_TRACE
+	using IibAllocatorBase::startAllocationTrace;
+	using IibAllocatorBase::stopAllocationTrace;
+#endif
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+	using IibAllocatorBase::getEmptyPageCount; // zombies are counted as live blocks until released
+#endif
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+	using IibAllocatorBase::publishStats; // metadata tier: without zombie and retired lists
+#endif
 	
 	void printStats() const { IibAllocatorBase::printStats(); }
 
+	using IibAllocatorBase::setUserPtr;
+	using IibAllocatorBase::getUserPtr;
+
+	// zombies and retired blocks are not a part of a heap image; so to serialize or deserialize there must be none
+	// (see killAllZombies() and reclaimRetired())
+	bool serialize( const char* fileName )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !hasZombiesOrRetiredBlocks(), "to serialize() there must be no zombies or retired blocks" );
+		return IibAllocatorBase::serialize( fileName );
+	}
+	bool serialize( const char* fileName, const void* const* pointerLocations, size_t pointerLocationCount )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !hasZombiesOrRetiredBlocks(), "to serialize() there must be no zombies or retired blocks" );
+		return IibAllocatorBase::serialize( fileName, pointerLocations, pointerLocationCount );
+	}
+	bool checkpoint( const char* fileName )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !hasZombiesOrRetiredBlocks(), "to checkpoint() there must be no zombies or retired blocks" );
+		return IibAllocatorBase::checkpoint( fileName );
+	}
+	using IibAllocatorBase::resetCheckpoints;
+	// for a heap destroyed while open, zombies and retired blocks remain allocated in the file
+	bool openPersistentHeap( const char* fileName, size_t capacity )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !hasZombiesOrRetiredBlocks(), "to openPersistentHeap() there must be no zombies or retired blocks" );
+		return IibAllocatorBase::openPersistentHeap( fileName, capacity );
+	}
+	bool openPersistentHeap( int fd, bool ownFd, size_t capacity )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !hasZombiesOrRetiredBlocks(), "to openPersistentHeap() there must be no zombies or retired blocks" );
+		return IibAllocatorBase::openPersistentHeap( fd, ownFd, capacity );
+	}
+	bool closePersistentHeap()
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !hasZombiesOrRetiredBlocks(), "to closePersistentHeap() there must be no zombies or retired blocks" );
+		return IibAllocatorBase::closePersistentHeap();
+	}
+	using IibAllocatorBase::isPersistentHeapOpen;
+	// zombies and retired blocks are kept in the image as allocated memory
+	bool startSnapshot( const char* fileName, HeapSnapshot& snapshot )
+	{
+		// protected large zombies are written, too; it is the child's copy of the pages that is unprotected
+		return IibAllocatorBase::startSnapshot( fileName, snapshot, [this]() {
+			auto unprotect = [this]( void* item ) {
+				if ( (uintptr_t)item & protectedLargeZombieTag )
+				{
+					void* pageStart = PageAllocatorT::ptrToPageStart( item );
+					bulkAllocator.UnprotectMemory( reinterpret_cast<uint8_t*>( pageStart ) + PAGE_SIZE_BYTES, bulkAllocator.getAllocatedSize( pageStart ) - PAGE_SIZE_BYTES );
+				}
+			};
+			zombieLargeChunks.forEach( unprotect );
+			reclaimLargeChunks.forEach( unprotect );
+		} );
+	}
+
+	// Detaches the allocator from the current thread (see IibAllocatorBase::detachFromThread()); must not be called
+	// inside an epoch critical section. Zombies and retired blocks go with the allocator; retired blocks that are
+	// already safe to deallocate are deallocated here. If the allocator is the current one of the thread (see
+	// setCurrneAllocator()), the thread is left without one (that is, new and delete go to malloc() and free()).
+	void detachFromThread()
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, epochNestingLevel == 0, "detachFromThread() inside an epoch critical section" );
+		reclaimRetired();
+		if ( g_CurrentAllocManager == this )
+			g_CurrentAllocManager = nullptr;
+		IibAllocatorBase::detachFromThread();
+	}
+	// Attaches a detached allocator to the current thread and, if makeCurrent, makes it the current one of the thread;
+	// returns the former current allocator of the thread (as setCurrneAllocator() does), or nullptr if !makeCurrent.
+	ThreadLocalAllocatorT* attachToThread( bool makeCurrent = true )
+	{
+		IibAllocatorBase::attachToThread();
+		if ( !makeCurrent )
+			return nullptr;
+		ThreadLocalAllocatorT* ret = g_CurrentAllocManager;
+		g_CurrentAllocManager = this;
+		return ret;
+	}
+	using IibAllocatorBase::isDetached;
+	using IibAllocatorBase::isOwnedByCurrentThread;
+
+	// for Region
+	using IibAllocatorBase::getRegionPage;
+	using IibAllocatorBase::releaseRegionPages;
+	bool deserialize( const char* fileName )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !hasZombiesOrRetiredBlocks(), "to deserialize() there must be no zombies or retired blocks" );
+		return IibAllocatorBase::deserialize( fileName );
+	}
+	bool deserializeRelocating( const char* fileName, HeapRelocation& relocation, const void* const* pointerLocations = nullptr, size_t pointerLocationCount = 0 )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !hasZombiesOrRetiredBlocks(), "to deserialize() there must be no zombies or retired blocks" );
+		return IibAllocatorBase::deserializeRelocating( fileName, relocation, pointerLocations, pointerLocationCount );
+	}
+
+	bool hasZombiesOrRetiredBlocks() const
+	{
+		if ( !zombieLargeChunks.empty() || hasZombiesPendingReclamation() )
+			return true;
+		for ( size_t idx=0; idx<BucketCount; ++idx)
+			if ( !zombieBuckets[idx].empty() )
+				return true;
+		for ( size_t i=0; i<retiredListCount; ++i)
+			if ( !retiredLists[i].empty() )
+				return true;
+		return false;
+	}
+
 	void initialize(size_t size)
 	{
 		initialize();
@@ -1556,14 +3369,22 @@ public:
 		if ( allocatorIDBase == 0 )
 			++allocatorIDBase;
 		allocatorID_ = allocatorIDBase;
+		IibAllocatorBase::setOwnerID( allocatorID_ );
 
 		for ( size_t i=0; i<BucketCount; ++i)
 		{
-			zombieBucketsFirst[i] = nullptr;
-			zombieBucketsLast[i] = nullptr;
+			zombieBuckets[i].deinitialize( zombieListSegmentPool );
+			reclaimBuckets[i].deinitialize( zombieListSegmentPool );
 		}
-		zombieLargeChunks = nullptr;
+		zombieLargeChunks.deinitialize( zombieListSegmentPool );
+		reclaimLargeChunks.deinitialize( zombieListSegmentPool );
+		reclaimCursor = 0;
+		protectLargeZombies_ = false;
+		zombieBytes = 0;
+		zombieQuarantineBudget = 0;
+		zombieReleaseCursor = 0;
 #ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		zombieSet.clear();
 		doZombieEarlyDetection_ = true;
 #endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
 	}
@@ -1571,22 +3392,88 @@ public:
 	/*void deinitialize()
 	{
 #ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, doZombieEarlyDetection_ || ( !doZombieEarlyDetection_ && zombieMap.empty() ) );
-		zombieMap.clear();
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, doZombieEarlyDetection_ || ( !doZombieEarlyDetection_ && zombieSet.empty() ) );
+		zombieSet.clear();
 #endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
 		IibAllocatorBase::deinitialize();
 	}*/
 
 	~SafeIibAllocator()
 	{
+		for ( size_t i=0; i<BucketCount; ++i)
+		{
+			zombieBuckets[i].deinitialize( zombieListSegmentPool );
+			reclaimBuckets[i].deinitialize( zombieListSegmentPool );
+		}
+		zombieLargeChunks.deinitialize( zombieListSegmentPool );
+		reclaimLargeChunks.deinitialize( zombieListSegmentPool );
+		zombieListSegmentPool.deinitialize();
+		for ( size_t i=0; i<retiredListCount; ++i)
+			retiredLists[i].deinitialize( retiredListSegmentPool );
+		retiredListSegmentPool.deinitialize();
+		if ( epochParticipant != nullptr )
+			EpochRegistry::releaseParticipant( epochParticipant );
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+		zombieSet.deinitialize();
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
 	}
 };
 
+class EpochGuard
+{
+	SafeIibAllocator& allocator;
+public:
+	EpochGuard( SafeIibAllocator& allocator_ ) : allocator( allocator_ ) { allocator.enterEpoch(); }
+	EpochGuard( const EpochGuard& ) = delete;
+	EpochGuard& operator = ( const EpochGuard& ) = delete;
+	~EpochGuard() { allocator.exitEpoch(); }
+};
+
 #endif // NODECPP_DISNABLE_SAFE_ALLOCATION_MEANS
 
+// ID of the allocator that owns the reservation ptr points into (see SafeIibAllocator::allocatorID()),
+// or ReservationArena::noOwner; constant time, can be called from any thread
+inline
+int32_t getOwnerAllocatorID( const void* ptr ) { return ReservationArena::ownerOf( ptr ); }
 
 ThreadLocalAllocatorT* setCurrneAllocator( ThreadLocalAllocatorT* allocator );
 
+// Automatic per-thread heaps. Once enabled, the first operator new on a thread without a current allocator (see
+// setCurrneAllocator()) makes one for it: an orphan, if any, or a new one. On exit of the thread the heap is detached
+// (see SafeIibAllocator::detachFromThread()) and becomes an orphan rather than destroyed, as its blocks may still be
+// in use; besides, as any block goes to free lists of the heap that deallocates it, its free lists may hold blocks of
+// other heaps, so no heap is ever unmapped. operator delete of a block of another heap (on a thread with or without a heap)
+// serves deallocation into that heap once it is an orphan (see deallocateToOrphan()).
+// The fast path of operator new is not affected; that of operator delete gets a check of the owner of the block.
+class ThreadHeaps
+{
+	static std::atomic<bool> enabled;
+
+public:
+	static void enable( bool doIt = true ) { enabled.store( doIt, std::memory_order_relaxed ); }
+	static bool isEnabled() { return enabled.load( std::memory_order_relaxed ); }
+
+	// makes a heap current for this thread and returns it; nullptr if not enabled (or called while making one)
+	static ThreadLocalAllocatorT* acquireForCurrentThread();
+	// ptr is a block of any heap; it is deallocated into its own heap if that is an orphan, otherwise it is kept
+	// until the heap becomes one; never creates a heap (and never throws)
+	static void deallocateToOrphan( void* ptr ) noexcept;
+	// true if enabled and ptr is a block of a heap other than 'heap' (then it goes to deallocateToOrphan() rather than to 'heap')
+	static bool isForeignBlock( ThreadLocalAllocatorT* heap, const void* ptr )
+	{
+		if ( !isEnabled() )
+			return false;
+		int32_t owner = getOwnerAllocatorID( ptr );
+		return owner != ReservationArena::noOwner && owner != (int32_t)( heap->allocatorID() );
+	}
+
+	// for a reclaimer (e.g. to kill zombies of orphans): takes an orphan attached to this thread (but not made current),
+	// or nullptr if there is none; it must be given back with abandon()
+	static ThreadLocalAllocatorT* adoptOrphan();
+	static void abandon( ThreadLocalAllocatorT* heap );
+	static size_t orphanCount();
+};
+
 } // namespace nodecpp::iibmalloc
 
 #else
@@ -0,0 +1,145 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Adapters for the standard library
+ *     - IibMemoryResource: std::pmr::memory_resource over a given allocator
+ *     - IibStlAllocator: stateless std::allocator-compatible template over the
+ *       current allocator of the thread (see setCurrneAllocator()); single
+ *       objects (which is what node-based containers allocate) go through
+ *       allocateAligned<sz, alignment>() and deallocateAligned<sz, alignment>(),
+ *       that is, with the bucket known at compile time
+ *     - neither needs new/delete to be intercepted
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_STL_H
+#define IIBMALLOC_STL_H
+
+#include "iibmalloc.h"
+
+#ifndef NODECPP_NOT_USING_IIBMALLOC
+
+#include <memory_resource>
+#include <new>
+
+namespace nodecpp::iibmalloc
+{
+
+template<class AllocatorT>
+class IibMemoryResource : public std::pmr::memory_resource
+{
+	AllocatorT& allocator;
+
+public:
+	IibMemoryResource( AllocatorT& allocator_ ) : allocator( allocator_ ) {}
+
+protected:
+	void* do_allocate( size_t bytes, size_t alignment ) override
+	{
+		if ( alignment <= ALIGNMENT )
+			return allocator.allocate( bytes );
+		else if ( alignment <= 16 )
+			return allocator.template allocateAligned<16>( bytes );
+		else if ( alignment <= 32 )
+			return allocator.template allocateAligned<32>( bytes );
+		throw std::bad_alloc();
+	}
+
+	void do_deallocate( void* ptr, size_t, size_t ) override
+	{
+		allocator.deallocate( ptr );
+	}
+
+	bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override
+	{
+		const IibMemoryResource* o = dynamic_cast<const IibMemoryResource*>( &other );
+		return o != nullptr && &( o->allocator ) == &allocator;
+	}
+};
+
+template<class T>
+class IibStlAllocator
+{
+	static constexpr size_t blockAlignment = alignof(T) > ALIGNMENT ? alignof(T) : ALIGNMENT;
+	static constexpr size_t blockSize = sizeof(T) > blockAlignment ? sizeof(T) : blockAlignment;
+	static_assert( blockAlignment <= ThreadLocalAllocatorT::maximalSupportedAlignment );
+
+	static ThreadLocalAllocatorT* currentAllocator()
+	{
+		ThreadLocalAllocatorT* ret = g_CurrentAllocManager;
+		if ( ret == nullptr ) // UNLIKELY
+			ret = ThreadHeaps::acquireForCurrentThread();
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ret != nullptr, "IibStlAllocator is used on a thread without an allocator" );
+		return ret;
+	}
+
+public:
+	using value_type = T;
+
+	IibStlAllocator() noexcept {}
+	template<class U>
+	IibStlAllocator( const IibStlAllocator<U>& ) noexcept {}
+
+	T* allocate( size_t n )
+	{
+		if ( n == 1 )
+			return static_cast<T*>( currentAllocator()->template allocateAligned<blockSize, blockAlignment>() );
+		if ( n > SIZE_MAX / sizeof(T) )
+			throw std::bad_array_new_length();
+		return static_cast<T*>( currentAllocator()->template allocateAligned<blockAlignment>( n * sizeof(T) ) );
+	}
+
+	// as operator delete does: never acquires a heap; without a current one, or for a block of another heap, the block goes back via ThreadHeaps
+	void deallocate( T* ptr, size_t n ) noexcept
+	{
+		ThreadLocalAllocatorT* allocator = g_CurrentAllocManager;
+		if ( allocator != nullptr && !ThreadHeaps::isForeignBlock( allocator, ptr ) )
+		{
+			if ( n == 1 )
+				allocator->template deallocateAligned<blockSize, blockAlignment>( ptr );
+			else
+				allocator->deallocate( ptr );
+		}
+		else
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ThreadHeaps::isEnabled(), "IibStlAllocator is used on a thread without an allocator" );
+			ThreadHeaps::deallocateToOrphan( ptr );
+		}
+	}
+
+	template<class U>
+	bool operator == ( const IibStlAllocator<U>& ) const noexcept { return true; }
+	template<class U>
+	bool operator != ( const IibStlAllocator<U>& ) const noexcept { return false; }
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // NODECPP_NOT_USING_IIBMALLOC
+
+#endif // IIBMALLOC_STL_H
@@ -0,0 +1,146 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Typed object pools
+ *     - ObjectPool<T> constructs objects of T in blocks of an allocator with the
+ *       bucket index known at compile time, both for allocation and for
+ *       deallocation (that is, destroy() needs no address-to-bucket dispatch)
+ *     - makeMany() pops a run of blocks of the bucket at once, then constructs
+ *       objects in them
+ *     - make<T>() and destroy() do the same with the current allocator of the
+ *       thread (see setCurrneAllocator())
+ *     - objects must be destroyed by the same kind of pool (or by destroy()):
+ *       bucket of a block is taken from T rather than from its address
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_OBJECT_POOL_H
+#define IIBMALLOC_OBJECT_POOL_H
+
+#include "iibmalloc.h"
+
+#ifndef NODECPP_NOT_USING_IIBMALLOC
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace nodecpp::iibmalloc
+{
+
+template<class T, class AllocatorT = ThreadLocalAllocatorT>
+class ObjectPool
+{
+	static constexpr size_t blockAlignment = alignof(T) > ALIGNMENT ? alignof(T) : ALIGNMENT;
+	static constexpr size_t blockSize = sizeof(T) > blockAlignment ? sizeof(T) : blockAlignment;
+	static_assert( blockAlignment <= AllocatorT::maximalSupportedAlignment );
+	static constexpr size_t requestSize = IibAllocatorBase::alignedRequestSize<blockSize, blockAlignment>();
+	static constexpr bool isBucketSized = IibAllocatorBase::isBucketSize( requestSize );
+
+	AllocatorT& allocator;
+
+public:
+	ObjectPool( AllocatorT& allocator_ ) : allocator( allocator_ ) {}
+
+	template<class ... Args>
+	NODECPP_FORCEINLINE T* make( Args&& ... args )
+	{
+		void* block = allocator.template allocateAligned<blockSize, blockAlignment>();
+		if constexpr ( std::is_nothrow_constructible_v<T, Args&&...> )
+			return new(block) T( std::forward<Args>( args )... );
+		else
+		{
+			try {
+				return new(block) T( std::forward<Args>( args )... );
+			}
+			catch (...) {
+				allocator.template deallocateAligned<blockSize, blockAlignment>( block );
+				throw;
+			}
+		}
+	}
+
+	NODECPP_FORCEINLINE void destroy( T* obj )
+	{
+		if ( obj == nullptr )
+			return;
+		obj->~T();
+		allocator.template deallocateAligned<blockSize, blockAlignment>( obj );
+	}
+
+	// constructs count objects, each with the same args, to out[]
+	template<class ... Args>
+	void makeMany( T** out, size_t count, const Args& ... args )
+	{
+		if constexpr ( isBucketSized )
+			allocator.template allocateMany<requestSize>( reinterpret_cast<void**>( out ), count );
+		else
+			for ( size_t i=0; i<count; ++i )
+				out[i] = reinterpret_cast<T*>( allocator.template allocateAligned<blockSize, blockAlignment>() );
+		size_t i = 0;
+		try {
+			for ( ; i<count; ++i )
+				out[i] = new(out[i]) T( args... );
+		}
+		catch (...) {
+			for ( size_t j=0; j<i; ++j )
+				out[j]->~T();
+			for ( size_t j=0; j<count; ++j )
+				allocator.template deallocateAligned<blockSize, blockAlignment>( out[j] );
+			throw;
+		}
+	}
+
+	void destroyMany( T* const* objs, size_t count )
+	{
+		for ( size_t i=0; i<count; ++i )
+			destroy( objs[i] );
+	}
+};
+
+// the same as ObjectPool<T>( *g_CurrentAllocManager ).make( args... )
+template<class T, class ... Args>
+NODECPP_FORCEINLINE T* make( Args&& ... args )
+{
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, g_CurrentAllocManager != nullptr );
+	return ObjectPool<T>( *g_CurrentAllocManager ).make( std::forward<Args>( args )... );
+}
+
+// obj must have been made by make<T>() or ObjectPool<T>
+template<class T>
+NODECPP_FORCEINLINE void destroy( T* obj )
+{
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, g_CurrentAllocManager != nullptr );
+	ObjectPool<T>( *g_CurrentAllocManager ).destroy( obj );
+}
+
+} // namespace nodecpp::iibmalloc
+
+#endif // NODECPP_NOT_USING_IIBMALLOC
+
+#endif // IIBMALLOC_OBJECT_POOL_H
@@ -41,6 +41,8 @@
 #define PAGE_MANAGEMENT_H
 
 #include "iibmalloc_common.h"
+#include "reservation_arena.h"
+#include "persistent_heap.h"
 #include <page_allocator.h>
 
 #define GET_PERF_DATA
@@ -56,10 +58,57 @@
 inline uint64_t NODECPP_RDTSC() { return 0; }
 #endif // GET_PERF_DATA
 
+#if defined NODECPP_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
 
 namespace nodecpp::iibmalloc
 {
 
+// access rights of already committed pages (not covered by VirtualMemory)
+struct PageProtection
+{
+#if defined NODECPP_WINDOWS
+	static bool noAccess( void* addr, size_t size ) { DWORD old; return VirtualProtect( addr, size, PAGE_NOACCESS, &old ) != 0; }
+	static bool readWrite( void* addr, size_t size ) { DWORD old; return VirtualProtect( addr, size, PAGE_READWRITE, &old ) != 0; }
+#else
+	static bool noAccess( void* addr, size_t size ) { return mprotect( addr, size, PROT_NONE ) == 0; }
+	static bool readWrite( void* addr, size_t size ) { return mprotect( addr, size, PROT_READ | PROT_WRITE ) == 0; }
+#endif
+};
+
+// address space at a given address, e.g. for restoring a serialized heap (not covered by VirtualMemory);
+// existing mappings are never replaced. Released as any other address space (VirtualMemory::deallocate())
+struct FixedAddressSpace
+{
+#if defined NODECPP_WINDOWS
+	static bool reserve( void* addr, size_t size ) { return VirtualAlloc( addr, size, MEM_RESERVE, PAGE_NOACCESS ) == addr; }
+	static bool mapFile( void* addr, size_t size, int fd, uint64_t offset ) { return false; } // not supported; callers fall back to reading
+#else
+	static bool reserve( void* addr, size_t size )
+	{
+#ifdef MAP_FIXED_NOREPLACE
+		void* ret = mmap( addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0 );
+#else
+		void* ret = mmap( addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 ); // a hint only
+#endif
+		if ( ret == MAP_FAILED )
+			return false;
+		if ( ret != addr ) // pre-4.17 Linux kernels take MAP_FIXED_NOREPLACE as a hint, too
+		{
+			munmap( ret, size );
+			return false;
+		}
+		return true;
+	}
+	// private (copy-on-write) mapping of a part of a file over a range already reserved by the caller
+	static bool mapFile( void* addr, size_t size, int fd, uint64_t offset ) { return mmap( addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset ) == addr; }
+#endif
+};
+
 /* OS specific implementations */
 struct MemoryBlockListItem
 {
@@ -223,10 +272,22 @@ struct BlockStats
 	uint64_t deallocRequestCount = 0;
 	uint64_t deallocRequestSize = 0;
 
+	// address space and protection ops (mmap(PROT_NONE)/munmap and mprotect/madvise or their equivalents)
+	uint64_t sysReserveCount = 0;
+	uint64_t sysUnreserveCount = 0;
+	uint64_t sysCommitCount = 0;
+	uint64_t sysDecommitCount = 0;
+	uint64_t sysProtectCount = 0;
+
+	uint64_t sysMapCallCount() const { return sysAllocCount + sysReserveCount; }
+	uint64_t sysUnmapCallCount() const { return sysDeallocCount + sysUnreserveCount; }
+	uint64_t sysProtectCallCount() const { return sysCommitCount + sysDecommitCount + sysProtectCount; }
+
 	void printStats() const
 	{
 		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Allocs {} ({}), ", sysAllocCount, sysAllocSize);
 		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Deallocs {} ({}), ", sysDeallocCount, sysDeallocSize);
+		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Reserve/unreserve {}/{}, commit/decommit {}/{}, protect {}", sysReserveCount, sysUnreserveCount, sysCommitCount, sysDecommitCount, sysProtectCount);
 
 		uint64_t ct = sysAllocCount - sysDeallocCount;
 		uint64_t sz = sysAllocSize - sysDeallocSize;
@@ -234,6 +295,25 @@ struct BlockStats
 		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Diff {} ({})\n", ct, sz);
 	}
 
+	void add( const BlockStats& other )
+	{
+		sysAllocCount += other.sysAllocCount;
+		sysAllocSize += other.sysAllocSize;
+		rdtscSysAllocSpent += other.rdtscSysAllocSpent;
+		sysDeallocCount += other.sysDeallocCount;
+		sysDeallocSize += other.sysDeallocSize;
+		rdtscSysDeallocSpent += other.rdtscSysDeallocSpent;
+		allocRequestCount += other.allocRequestCount;
+		allocRequestSize += other.allocRequestSize;
+		deallocRequestCount += other.deallocRequestCount;
+		deallocRequestSize += other.deallocRequestSize;
+		sysReserveCount += other.sysReserveCount;
+		sysUnreserveCount += other.sysUnreserveCount;
+		sysCommitCount += other.sysCommitCount;
+		sysDecommitCount += other.sysDecommitCount;
+		sysProtectCount += other.sysProtectCount;
+	}
+
 	void registerAllocRequest( size_t sz )
 	{
 		allocRequestSize += sz;
@@ -344,6 +424,8 @@ struct PageAllocatorWithCaching // to be further developed for practical purpose
 	std::array<MemoryBlockList, max_cached_size+1> freeBlocks;
 
 	BlockStats stats;
+	uint16_t ownerID = 0; // recorded for reservations in the process-wide arena
+	PersistentPageSource* persistentSource = nullptr; // if set, all reservations come from it (see persistent_heap.h)
 	//uintptr_t blocksBegin = 0;
 	//uintptr_t uninitializedBlocksBegin = 0;
 	//uintptr_t blocksEnd = 0;
@@ -459,8 +541,149 @@ public:
 		stats.registerSysDealloc( sz, end - start );
 	}
 
+	uint16_t getOwnerID() const { return ownerID; }
+	void setOwnerID( uint16_t id ) { ownerID = id; }
+	void setPersistentSource( PersistentPageSource* source ) { persistentSource = source; }
+
+	// Address space for sounding-address reservations and bulk blocks: taken from the process-wide arena
+	// (see reservation_arena.h) when possible, so that the owner of any pointer into it can be found.
+	// Not committed; use CommitMemory().
+	void* ReserveAddressSpace(size_t size)
+	{
+		if ( persistentSource != nullptr )
+		{
+			void* ret = persistentSource->acquire( size );
+			if ( ret == nullptr )
+				throw std::bad_alloc();
+			return ret;
+		}
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+		void* ret = ReservationArena::acquire( size, ownerID );
+		if ( ret != nullptr ) // LIKELY
+			return ret;
+		ReservationArena::registerOverflow();
+#endif
+		return AllocateAddressSpace( size );
+	}
+
+	// same as above, but committed
+	void* getFreeReservationNoCache(size_t sz)
+	{
+		if ( persistentSource != nullptr )
+		{
+			void* ret = ReserveAddressSpace( sz );
+			if ( CommitMemory( ret, sz ) == (void*)(-1) )
+			{
+				persistentSource->release( ret, sz );
+				throw std::bad_alloc();
+			}
+			return ret;
+		}
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+		void* ret = ReservationArena::acquire( sz, ownerID );
+		if ( ret != nullptr ) // LIKELY
+		{
+			if ( CommitMemory( ret, sz ) == (void*)(-1) )
+			{
+				ReservationArena::release( ret, sz );
+				throw std::bad_alloc();
+			}
+			return ret;
+		}
+		ReservationArena::registerOverflow();
+#endif
+		return getFreeBlockNoCache( sz );
+	}
+
+	// same as ReserveAddressSpace(), but at a given address (which is the only place where it can be in the arena);
+	// fails if any part of the range is already in use
+	bool ReserveAddressSpaceAt( void* addr, size_t size )
+	{
+		if ( persistentSource != nullptr )
+			return persistentSource->acquireAt( addr, size );
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+		if ( ReservationArena::contains( addr ) )
+			return ReservationArena::acquireAt( addr, size, ownerID );
+#endif
+		if ( !FixedAddressSpace::reserve( addr, size ) )
+			return false;
+		++(stats.sysReserveCount);
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+		ReservationArena::registerOverflow();
+#endif
+		return true;
+	}
+
+	// same as ReserveAddressSpace(), but at an address with the same offset within an 8 MiB slot as addr (e.g. to move
+	// a reservation of a restored heap elsewhere); returns nullptr on failure
+	void* ReserveAddressSpaceLike( const void* addr, size_t size )
+	{
+		constexpr size_t slotSize = ReservationArena::slotSize;
+		uintptr_t offset = reinterpret_cast<uintptr_t>( addr ) & ( slotSize - 1 );
+		if ( persistentSource != nullptr )
+			return offset == 0 ? persistentSource->acquire( size ) : nullptr;
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+		if ( offset == 0 )
+		{
+			void* ret = ReservationArena::acquire( size, ownerID );
+			if ( ret != nullptr ) // LIKELY
+				return ret;
+		}
+#endif
+		// a range with a room for the offset is found, released, and then reserved at the right place
+		for ( size_t attempt = 0; attempt < 8; ++attempt )
+		{
+			uint8_t* mem = reinterpret_cast<uint8_t*>( AllocateAddressSpace( size + slotSize ) );
+			if ( mem == nullptr || mem == (void*)(-1) )
+				return nullptr;
+			uint8_t* target = reinterpret_cast<uint8_t*>( ( reinterpret_cast<uintptr_t>( mem ) & ~( slotSize - 1 ) ) + offset );
+			if ( target < mem )
+				target += slotSize;
+			FreeAddressSpace( mem, size + slotSize );
+			if ( FixedAddressSpace::reserve( target, size ) )
+			{
+				++(stats.sysReserveCount);
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+				ReservationArena::registerOverflow();
+#endif
+				return target;
+			}
+		}
+		return nullptr;
+	}
+
+	// for memory obtained with either of the above
+	void freeReservationNoCache( void* block, size_t sz )
+	{
+		if ( persistentSource != nullptr && persistentSource->contains( block ) )
+		{
+			stats.registerDeallocRequest( sz );
+			persistentSource->release( block, sz );
+			return;
+		}
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+		if ( ReservationArena::contains( block ) )
+		{
+			stats.registerDeallocRequest( sz );
+			DecommitMemory( block, sz );
+			ReservationArena::release( block, sz );
+			return;
+		}
+#endif
+		freeChunkNoCache( block, sz );
+	}
+
 	const BlockStats& getStats() const { return stats; }
 
+	// bytes in cached blocks (that is, requested back, but not returned to the system)
+	size_t getCachedSize() const
+	{
+		size_t ret = 0;
+		for ( size_t ix=0; ix<=max_cached_size; ++ ix )
+			ret += ( (size_t)(freeBlocks[ix].size()) * ( ix + 1 ) ) << blockSizeExp;
+		return ret;
+	}
+
 	void printStats() const
 	{
 		stats.printStats();
@@ -468,12 +691,18 @@ public:
 
 	void* AllocateAddressSpace(size_t size)
 	{
+		++(stats.sysReserveCount);
 		return VirtualMemory::AllocateAddressSpace( size );
 	}
 	void* CommitMemory(void* addr, size_t size)
 	{
 		stats.registerAllocRequest( size );
-		void* ret = VirtualMemory::CommitMemory( addr, size);
+		++(stats.sysCommitCount);
+		void* ret;
+		if ( persistentSource != nullptr && persistentSource->contains( addr ) )
+			ret = persistentSource->commit( addr, size ) ? addr : (void*)(-1);
+		else
+			ret = VirtualMemory::CommitMemory( addr, size);
 		if (ret == (void*)(-1))
 		{
 			nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Committing failed at {} ({:x}) (0x{:x} bytes in total)", stats.allocRequestCount, stats.allocRequestCount, stats.allocRequestSize );
@@ -482,12 +711,48 @@ public:
 	}
 	void DecommitMemory(void* addr, size_t size)
 	{
-		VirtualMemory::DecommitMemory( addr, size );
+		++(stats.sysDecommitCount);
+		if ( persistentSource != nullptr && persistentSource->contains( addr ) )
+			persistentSource->decommit( addr, size );
+		else
+			VirtualMemory::DecommitMemory( addr, size );
+	}
+	// same as CommitMemory(), but the content is kept as it is in the persistent page source; false if addr is not there
+	bool CommitMemoryInPlace(void* addr, size_t size)
+	{
+		if ( persistentSource == nullptr || !persistentSource->contains( addr ) )
+			return false;
+		stats.registerAllocRequest( size );
+		++(stats.sysCommitCount);
+		return persistentSource->commit( addr, size );
+	}
+	// same as CommitMemory(), but with content of a file; returns false if not possible (then CommitMemory() and reading is an option)
+	bool MapFileAt(void* addr, size_t size, int fd, uint64_t offset)
+	{
+		if ( !FixedAddressSpace::mapFile( addr, size, fd, offset ) )
+			return false;
+		stats.registerAllocRequest( size );
+		++(stats.sysCommitCount);
+		return true;
 	}
 	void FreeAddressSpace(void* addr, size_t size)
 	{
+		++(stats.sysUnreserveCount);
 		VirtualMemory::FreeAddressSpace( addr, size );
 	}
+	// protecting a part of a mapping splits it, so this fails (ENOMEM) once the process is at its mapping count limit
+	// (vm.max_map_count on Linux); the caller is supposed to go on with the memory left accessible
+	bool ProtectMemory(void* addr, size_t size)
+	{
+		++(stats.sysProtectCount);
+		return PageProtection::noAccess( addr, size );
+	}
+	void UnprotectMemory(void* addr, size_t size)
+	{
+		++(stats.sysProtectCount);
+		bool ok = PageProtection::readWrite( addr, size );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ok, "unprotecting 0x{:x} bytes at 0x{:x} failed", size, (uintptr_t)addr );
+	}
 };
 
 } // namespace nodecpp::iibmalloc
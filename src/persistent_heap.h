@@ -0,0 +1,169 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * File-backed (persistent) page source for a per-thread heap
+ *     - all reservations of an allocator (sounding-address reservations, bulk
+ *       blocks and large chunks) are carved, in slots of 8 MiB, from a single
+ *       file (or memfd) mapped with MAP_SHARED; so the content of the heap is
+ *       always in the file
+ *     - the first slot of the file is a header region: a header followed by
+ *       allocator metadata written as a heap image (see heap_image.h) with
+ *       'inPlace' ranges, i.e. with no content, as the content is already
+ *       where it belongs
+ *     - metadata is written by IibAllocatorBase::syncPersistentHeap() (and on
+ *       closing); a file is reopened only if it has been synced after its last
+ *       modification; it is then mapped at the same address, so that all
+ *       objects and free lists are valid as they are (warm restart)
+ *     - released ranges are punched out of the file (a file is sparse, and
+ *       only committed pages take disk space)
+ *     - Linux only; there is no locking, a file is to be used by a single
+ *       allocator at a time
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_PERSISTENT_HEAP_H
+#define IIBMALLOC_PERSISTENT_HEAP_H
+
+#include "iibmalloc_common.h"
+#include <cstdio>
+
+#if defined NODECPP_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace nodecpp::iibmalloc
+{
+
+struct PersistentHeapHeader
+{
+	static constexpr uint64_t expectedMagic = 0x5041454850424949ULL; // "IIBPHEAP"
+	uint64_t magic;
+	uint32_t version;
+	uint32_t pointerSize;
+	uint64_t layout; // allocator-defined; a file is reopened only by an allocator with the same layout
+	uint64_t baseAddress; // where the file is mapped
+	uint64_t size; // of the file (and of the mapping)
+	uint64_t clean; // 1: metadata (imageSize bytes right after the header) matches the content of the file
+	uint64_t imageSize;
+};
+
+constexpr uint32_t persistent_heap_version = 1;
+
+class PersistentPageSource
+{
+public:
+	static constexpr size_t slotSizeExp = 23;
+	static constexpr size_t slotSize = ((size_t)1) << slotSizeExp;
+	static constexpr size_t headerRegionSize = slotSize; // keeps slots aligned by their size
+
+private:
+	int fd = -1;
+	bool ownsFd = false;
+	uint8_t* base = nullptr; // of the mapping, i.e. of the header region
+	size_t size = 0;
+	uint8_t* slots = nullptr; // 1 for slots in use
+	size_t slotCount = 0;
+	size_t searchStart = 0;
+	bool detached = false; // see detach()
+
+	bool map( void* addr, size_t sz );
+
+public:
+	~PersistentPageSource() { close(); }
+
+	bool isOpen() const { return base != nullptr; }
+
+	// Opens a file for a heap with a given layout; a file of zero size is initialized for a heap of (at most)
+	// capacity bytes, otherwise the file is to be a clean one, and it is mapped at its original address
+	// (and 'existing' is set; metadata is to be read with getImage()). fd is closed by close() if ownFd.
+	bool open( int fd, bool ownFd, size_t capacity, uint64_t layout, bool& existing );
+	// the same for a file name (created if not exists)
+	bool open( const char* fileName, size_t capacity, uint64_t layout, bool& existing );
+	// unmaps the file (any content still in use is lost for the process, but not for the file)
+	void close();
+
+	// from now on, released ranges are not removed from the file (to forget the heap without destroying its content)
+	void detach() { detached = true; }
+
+	NODECPP_FORCEINLINE bool contains( const void* ptr ) const
+	{
+		return reinterpret_cast<uintptr_t>( ptr ) - reinterpret_cast<uintptr_t>( base + headerRegionSize ) < ( slotCount << slotSizeExp );
+	}
+
+	// the range given out by acquire()
+	void* getRangeBegin() const { return base + headerRegionSize; }
+	size_t getRangeSize() const { return slotCount << slotSizeExp; }
+
+	// returns nullptr if there is no room; returned range is reserved but not committed
+	void* acquire( size_t sz );
+	// same as above, but at a given (slot-aligned) address; fails if any of the slots is already in use
+	bool acquireAt( void* ptr, size_t sz );
+	void release( void* ptr, size_t sz );
+
+	bool commit( void* addr, size_t sz )
+	{
+#if defined NODECPP_LINUX
+		return mprotect( addr, sz, PROT_READ | PROT_WRITE ) == 0;
+#else
+		return false;
+#endif
+	}
+	void decommit( void* addr, size_t sz )
+	{
+#if defined NODECPP_LINUX
+		if ( detached )
+			return;
+		madvise( addr, sz, MADV_REMOVE ); // frees space in the file; if not supported by the file system, just keeps it
+		mprotect( addr, sz, PROT_NONE );
+#endif
+	}
+
+	// metadata storage (in the header region) as a stream for HeapImageWriter/HeapImageReader
+	FILE* openImageStream( bool forWriting )
+	{
+#if defined NODECPP_LINUX
+		uint8_t* buff = base + sizeof(PersistentHeapHeader);
+		if ( forWriting )
+			return fmemopen( buff, headerRegionSize - sizeof(PersistentHeapHeader), "wb" );
+		return fmemopen( buff, reinterpret_cast<PersistentHeapHeader*>( base )->imageSize, "rb" );
+#else
+		return nullptr;
+#endif
+	}
+	// imageSize: of the metadata just written to the image stream; flushes the whole file, then marks it clean
+	bool markClean( size_t imageSize );
+	// marks the file as being modified (metadata is not valid until the next markClean())
+	bool markInUse();
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_PERSISTENT_HEAP_H
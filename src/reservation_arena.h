@@ -0,0 +1,129 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Process-wide reservation arena
+ *     - sounding-address reservations and bulk allocator blocks of all
+ *       allocators are carved from one large range of address space reserved
+ *       at first use, in slots of 8 MiB aligned to 8 MiB
+ *     - a flat table keeps the owner (allocator ID) of each slot, which makes
+ *       "who owns this pointer" a range check and a table load
+ *     - if the arena is exhausted (or cannot be reserved), reservations fall
+ *       back to regular address space allocation; such memory has no known
+ *       owner, and hasOverflowed() tells that not all iibmalloc memory is in
+ *       the arena
+ *     - ranges reserved elsewhere on behalf of an allocator (e.g. a mapped
+ *       persistent heap file) can be registered as external ranges; they are
+ *       then recognized by contains() and ownerOf() as well
+ *     - NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA turns the arena off
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_RESERVATION_ARENA_H
+#define IIBMALLOC_RESERVATION_ARENA_H
+
+#include "iibmalloc_common.h"
+#include <atomic>
+#include <mutex>
+
+#ifndef NODECPP_IIBMALLOC_ARENA_SIZE_EXP
+#define NODECPP_IIBMALLOC_ARENA_SIZE_EXP ( sizeof(void*) == 8 ? 40 : 28 ) // 1 TiB of address space (256 MiB for 32-bit)
+#endif
+
+namespace nodecpp::iibmalloc
+{
+
+class ReservationArena
+{
+public:
+	static constexpr size_t slotSizeExp = 23;
+	static constexpr size_t slotSize = ((size_t)1) << slotSizeExp;
+	static constexpr size_t arenaSizeExp = NODECPP_IIBMALLOC_ARENA_SIZE_EXP;
+	static_assert( arenaSizeExp > slotSizeExp && arenaSizeExp < sizeof(void*) * 8 );
+	static constexpr size_t arenaSize = ((size_t)1) << arenaSizeExp;
+	static constexpr size_t slotCount = ((size_t)1) << ( arenaSizeExp - slotSizeExp );
+	static constexpr int32_t noOwner = -1;
+	static constexpr size_t maxExternalRanges = 16;
+
+private:
+	static constexpr uint32_t slotInUse = 0x10000; // low 16 bits: owner ID
+
+	static std::atomic<uintptr_t> base; // 0 until the arena is reserved
+	static std::atomic<uint32_t> slots[slotCount];
+	static std::atomic<bool> overflowed;
+	struct ExternalRange
+	{
+		std::atomic<uintptr_t> begin;
+		std::atomic<size_t> size; // 0 for a free entry
+		std::atomic<uint32_t> ownerID;
+	};
+	static ExternalRange externalRanges[maxExternalRanges];
+	static std::atomic<size_t> externalRangeCount; // entries [0, externalRangeCount) may be in use
+	static std::mutex mx; // guards reservation of the arena and slot search
+	static size_t searchStart;
+	static bool reservationAttempted;
+
+	static bool reserveArena(); // called under mx
+	static int32_t externalOwnerOf( const void* ptr );
+
+public:
+	// returns nullptr if there is no room; returned range is reserved but not committed
+	static void* acquire( size_t size, uint16_t ownerID );
+	// same as above, but at a given (slot-aligned) address; fails if any of the slots is already in use
+	static bool acquireAt( void* ptr, size_t size, uint16_t ownerID );
+	static void release( void* ptr, size_t size );
+
+	// returns false if there is no room for one more external range
+	static bool registerExternalRange( void* ptr, size_t size, uint16_t ownerID );
+	static void unregisterExternalRange( void* ptr );
+
+	static NODECPP_FORCEINLINE bool contains( const void* ptr )
+	{
+		uintptr_t b = base.load( std::memory_order_acquire );
+		if ( b != 0 && reinterpret_cast<uintptr_t>( ptr ) - b < arenaSize )
+			return true;
+		return externalRangeCount.load( std::memory_order_acquire ) != 0 && externalOwnerOf( ptr ) != noOwner;
+	}
+
+	// allocator ID of the owner, or noOwner for memory outside the arena (including malloc'ed memory) and for free slots
+	static NODECPP_FORCEINLINE int32_t ownerOf( const void* ptr )
+	{
+		uintptr_t b = base.load( std::memory_order_acquire );
+		uintptr_t offset = reinterpret_cast<uintptr_t>( ptr ) - b;
+		if ( b == 0 || offset >= arenaSize )
+			return externalRangeCount.load( std::memory_order_acquire ) != 0 ? externalOwnerOf( ptr ) : noOwner;
+		uint32_t s = slots[ offset >> slotSizeExp ].load( std::memory_order_acquire );
+		return ( s & slotInUse ) ? (int32_t)( s & 0xFFFF ) : noOwner;
+	}
+
+	static bool hasOverflowed() { return overflowed.load( std::memory_order_relaxed ); }
+	static void registerOverflow() { overflowed.store( true, std::memory_order_relaxed ); }
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_RESERVATION_ARENA_H
@@ -0,0 +1,160 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Tracking of pages modified since a point in time (Linux soft-dirty bits)
+ *     - clear() resets soft-dirty bits of all pages of the process
+ *       (/proc/self/clear_refs); after that the kernel sets the bit of a page
+ *       on its first write (visible as bit 55 of its /proc/self/pagemap entry)
+ *     - the bits are process-wide: if several users clear them independently,
+ *       each of them must be ready to see pages modified after its own clear()
+ *       as clean; getClearCount() lets them detect this case
+ *     - on other platforms, and on kernels built without CONFIG_MEM_SOFT_DIRTY,
+ *       isSupported() is false, and all pages are reported as modified
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_SOFT_DIRTY_PAGES_H
+#define IIBMALLOC_SOFT_DIRTY_PAGES_H
+
+#include "iibmalloc_common.h"
+#include <atomic>
+
+#if defined NODECPP_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace nodecpp::iibmalloc
+{
+
+class SoftDirtyPages
+{
+	static std::atomic<uint64_t> clearCount;
+	static std::atomic<int> supported; // -1: not checked yet
+
+#if defined NODECPP_LINUX
+	static constexpr uint64_t softDirtyBit = ((uint64_t)1) << 55;
+	static constexpr size_t entriesPerRead = 512;
+	int pagemapFd = -1;
+	size_t pageSizeExp = 12;
+#endif
+
+	static bool checkSupport(); // called once
+
+public:
+	~SoftDirtyPages() { close(); }
+
+	static bool isSupported()
+	{
+		int s = supported.load( std::memory_order_acquire );
+		if ( s < 0 )
+		{
+			s = checkSupport() ? 1 : 0;
+			supported.store( s, std::memory_order_release );
+		}
+		return s == 1;
+	}
+
+	// process-wide; returns the new clear count (see getClearCount()), or 0 if not supported
+	static uint64_t clear();
+	static uint64_t getClearCount() { return clearCount.load( std::memory_order_acquire ); }
+
+	bool open()
+	{
+#if defined NODECPP_LINUX
+		if ( !isSupported() )
+			return false;
+		close();
+		pagemapFd = ::open( "/proc/self/pagemap", O_RDONLY | O_CLOEXEC );
+		long pageSize = sysconf( _SC_PAGESIZE );
+		pageSizeExp = 0;
+		while ( ( ((long)1) << pageSizeExp ) < pageSize )
+			++pageSizeExp;
+		return pagemapFd >= 0;
+#else
+		return false;
+#endif
+	}
+
+	void close()
+	{
+#if defined NODECPP_LINUX
+		if ( pagemapFd >= 0 )
+			::close( pagemapFd );
+		pagemapFd = -1;
+#endif
+	}
+
+	// calls f( start, size, isDirty ) for alternating runs of modified and not modified pages of [start, start + size);
+	// (system) pages are expected not to cross range boundaries. Returns false if bits could not be read
+	template<class F>
+	bool doForEachRun( uint8_t* start, size_t size, F&& f )
+	{
+#if defined NODECPP_LINUX
+		if ( pagemapFd < 0 )
+			return false;
+		uintptr_t firstPage = (uintptr_t)start >> pageSizeExp;
+		uintptr_t endPage = ( (uintptr_t)start + size + ( ((uintptr_t)1) << pageSizeExp ) - 1 ) >> pageSizeExp;
+		uint8_t* runStart = start;
+		bool runDirty = false;
+		uint64_t entries[entriesPerRead];
+		for ( uintptr_t page = firstPage; page < endPage; )
+		{
+			size_t cnt = endPage - page < entriesPerRead ? endPage - page : entriesPerRead;
+			ssize_t rd = pread( pagemapFd, entries, cnt * sizeof(uint64_t), (off_t)( page * sizeof(uint64_t) ) );
+			if ( rd != (ssize_t)( cnt * sizeof(uint64_t) ) )
+				return false;
+			for ( size_t i=0; i<cnt; ++i, ++page )
+			{
+				bool dirty = ( entries[i] & softDirtyBit ) != 0;
+				uint8_t* pageStart = reinterpret_cast<uint8_t*>( page << pageSizeExp );
+				if ( pageStart < start )
+					pageStart = start;
+				if ( pageStart == start )
+					runDirty = dirty;
+				else if ( dirty != runDirty )
+				{
+					f( runStart, (size_t)( pageStart - runStart ), runDirty );
+					runStart = pageStart;
+					runDirty = dirty;
+				}
+			}
+		}
+		if ( runStart < start + size )
+			f( runStart, (size_t)( start + size - runStart ), runDirty );
+		return true;
+#else
+		return false;
+#endif
+	}
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_SOFT_DIRTY_PAGES_H
@@ -0,0 +1,146 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ * Process-wide registry of allocator stats readable from any thread
+ *     - each allocator publishes a compact snapshot of its stats (committed,
+ *       in use and cached bytes plus counters of each tier) into a slot of
+ *       the registry; publishing happens on slow paths only (bucket refills,
+ *       large chunks) and on explicit SafeIibAllocator::publishStats()
+ *     - a slot is a seqlock: the owner thread never waits, and a reader
+ *       (e.g. a metrics exporter) retries if it raced with a publication
+ *     - slots are never freed (a released one is reused by a next allocator),
+ *       so a monitoring thread may walk them at any time without locking
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_STATS_REGISTRY_H
+#define IIBMALLOC_STATS_REGISTRY_H
+
+#include "iibmalloc_common.h"
+#include "page_management.h"
+#include <atomic>
+#include <cstring>
+
+namespace nodecpp::iibmalloc
+{
+
+struct PublishedTierStats
+{
+	uint64_t inUse; // bytes handed out by the tier
+	uint64_t cached; // bytes kept by the tier for reuse
+	uint64_t allocRequestCount;
+	uint64_t deallocRequestCount;
+	uint64_t sysMapCallCount;
+	uint64_t sysUnmapCallCount;
+	uint64_t sysProtectCallCount;
+
+	uint64_t committed() const { return inUse + cached; }
+
+	void set( const BlockStats& stats, uint64_t cachedBytes )
+	{
+		inUse = stats.allocRequestSize - stats.deallocRequestSize;
+		cached = cachedBytes;
+		allocRequestCount = stats.allocRequestCount;
+		deallocRequestCount = stats.deallocRequestCount;
+		sysMapCallCount = stats.sysMapCallCount();
+		sysUnmapCallCount = stats.sysUnmapCallCount();
+		sysProtectCallCount = stats.sysProtectCallCount();
+	}
+};
+
+struct PublishedStats
+{
+	uint64_t allocatorID; // as SafeIibAllocator::allocatorID(); 0 if not set
+	uint64_t publishCount; // of this allocator
+	PublishedTierStats pageTier; // pages for buckets
+	PublishedTierStats bulkTier; // chunks above MaxBucketSize
+	PublishedTierStats metadataTier; // pages for internal descriptors
+
+	uint64_t committed() const { return pageTier.committed() + bulkTier.committed() + metadataTier.committed(); }
+	uint64_t inUse() const { return pageTier.inUse + bulkTier.inUse + metadataTier.inUse; }
+	uint64_t cached() const { return pageTier.cached + bulkTier.cached + metadataTier.cached; }
+};
+static_assert( sizeof(PublishedStats) % sizeof(uint64_t) == 0 );
+
+struct StatsSlot
+{
+	static constexpr size_t wordCount = sizeof(PublishedStats) / sizeof(uint64_t);
+	std::atomic<uint64_t> sequence; // odd while being written
+	std::atomic<uint64_t> words[wordCount]; // PublishedStats
+	std::atomic<bool> inUse;
+	StatsSlot* next;
+};
+
+class StatsRegistry
+{
+	static std::atomic<StatsSlot*> slots;
+
+public:
+	static StatsSlot* acquireSlot();
+	static void releaseSlot( StatsSlot* slot );
+
+	// by the owner of the slot only
+	static void publish( StatsSlot* slot, const PublishedStats& stats )
+	{
+		uint64_t w[StatsSlot::wordCount];
+		memcpy( w, &stats, sizeof(stats) );
+		uint64_t seq = slot->sequence.load( std::memory_order_relaxed );
+		slot->sequence.store( seq + 1, std::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order_release );
+		for ( size_t i=0; i<StatsSlot::wordCount; ++i )
+			slot->words[i].store( w[i], std::memory_order_relaxed );
+		slot->sequence.store( seq + 2, std::memory_order_release );
+	}
+
+	// by any thread; returns false if there was a publication in progress each of maxAttempts times
+	static bool read( const StatsSlot* slot, PublishedStats& stats, size_t maxAttempts = 64 )
+	{
+		uint64_t w[StatsSlot::wordCount];
+		for ( size_t attempt = 0; attempt < maxAttempts; ++attempt )
+		{
+			uint64_t seq = slot->sequence.load( std::memory_order_acquire );
+			if ( seq & 1 )
+				continue;
+			for ( size_t i=0; i<StatsSlot::wordCount; ++i )
+				w[i] = slot->words[i].load( std::memory_order_relaxed );
+			std::atomic_thread_fence( std::memory_order_acquire );
+			if ( slot->sequence.load( std::memory_order_relaxed ) == seq )
+			{
+				memcpy( &stats, w, sizeof(stats) );
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// latest snapshots of live allocators (up to maxCount); returns the number of them (which may be greater than maxCount)
+	static size_t collect( PublishedStats* out, size_t maxCount );
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_STATS_REGISTRY_H
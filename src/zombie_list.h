@@ -0,0 +1,292 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Zombie lists for SafeIibAllocator
+ *     - IntrusiveZombieList: FIFO linked through the first word of a block
+ *       (which requires zombieable blocks to have a prefix, see guaranteed_prefix_size)
+ *     - OutOfBandZombieList: FIFO of pointers kept in page-sized segments
+ *       (NODECPP_IIBMALLOC_OUT_OF_BAND_ZOMBIE_LINKS); blocks are left intact
+ *       and need no prefix, so that zombieable and regular allocations use
+ *       the same size classes
+ *     - both are used via the same interface; Pool is a source of segments
+ *       (ignored by the intrusive list)
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_ZOMBIE_LIST_H
+#define IIBMALLOC_ZOMBIE_LIST_H
+
+#include "iibmalloc_common.h"
+#include "page_management.h"
+
+namespace nodecpp::iibmalloc
+{
+
+// low bits of list items that are left to list users (items are at least pointer-aligned)
+constexpr uintptr_t zombie_list_item_tag_mask = sizeof(void*) - 1;
+
+struct NoZombieListSegmentPool
+{
+	void initialize( uint8_t ) {}
+	void deinitialize() {}
+	BlockStats getStats() const { return BlockStats(); }
+};
+
+template<class Pool>
+class IntrusiveZombieList
+{
+	void* first = nullptr;
+	void* last = nullptr;
+
+	static NODECPP_FORCEINLINE void*& linkOf( void* item ) { return *reinterpret_cast<void**>( (uintptr_t)item & ~zombie_list_item_tag_mask ); }
+
+public:
+	bool empty() const { return first == nullptr; }
+
+	NODECPP_FORCEINLINE void pushBack( void* ptr, Pool& )
+	{
+		if ( last )
+			linkOf( last ) = ptr;
+		else
+			first = ptr;
+		last = ptr;
+	}
+
+	// returns nullptr if empty
+	NODECPP_FORCEINLINE void* popFront( Pool& )
+	{
+		void* ret = first;
+		if ( ret == last )
+			first = last = nullptr;
+		else
+			first = linkOf( ret );
+		return ret;
+	}
+
+	// moves all items of 'other' to the end of this list
+	void append( IntrusiveZombieList& other, Pool& )
+	{
+		if ( other.first == nullptr )
+			return;
+		if ( last )
+			linkOf( last ) = other.first;
+		else
+			first = other.first;
+		last = other.last;
+		other.first = other.last = nullptr;
+	}
+
+	// moves all items to a free list of blocks linked through their first word
+	void moveToFreeList( void*& freeList, Pool& )
+	{
+		if ( last )
+		{
+			linkOf( last ) = freeList;
+			freeList = first;
+		}
+		first = last = nullptr;
+	}
+
+	// calls f( item ) for each item, oldest first; the list is not changed
+	template<class F>
+	void forEach( F&& f ) const
+	{
+		for ( void* item = first; item != nullptr; item = item == last ? nullptr : linkOf( item ) )
+			f( item );
+	}
+
+	void initialize() { first = last = nullptr; }
+	void deinitialize( Pool& ) { first = last = nullptr; }
+};
+
+constexpr size_t zombie_list_segment_size_exp = 12;
+
+struct ZombieListSegment
+{
+	static constexpr size_t capacity = ( ( ((size_t)1) << zombie_list_segment_size_exp ) - sizeof(void*) - 2 * sizeof(uint32_t) ) / sizeof(void*);
+	ZombieListSegment* next;
+	uint32_t begin;
+	uint32_t end;
+	void* items[capacity];
+};
+static_assert( sizeof(ZombieListSegment) <= ( ((size_t)1) << zombie_list_segment_size_exp ) );
+
+template<class BasePageAllocator>
+class ZombieListSegmentPool : public BasePageAllocator
+{
+	static constexpr size_t segmentSize = ((size_t)1) << zombie_list_segment_size_exp;
+	static constexpr size_t maxCachedSegments = 16;
+	ZombieListSegment* freeSegments = nullptr;
+	size_t freeSegmentCount = 0;
+
+public:
+	NODECPP_FORCEINLINE ZombieListSegment* getSegment()
+	{
+		ZombieListSegment* ret = freeSegments;
+		if ( ret != nullptr )
+		{
+			freeSegments = ret->next;
+			--freeSegmentCount;
+		}
+		else
+			ret = reinterpret_cast<ZombieListSegment*>( this->getFreeBlockNoCache( segmentSize ) );
+		ret->next = nullptr;
+		ret->begin = 0;
+		ret->end = 0;
+		return ret;
+	}
+
+	NODECPP_FORCEINLINE void putSegment( ZombieListSegment* s )
+	{
+		if ( freeSegmentCount < maxCachedSegments )
+		{
+			s->next = freeSegments;
+			freeSegments = s;
+			++freeSegmentCount;
+		}
+		else
+			this->freeChunkNoCache( s, segmentSize );
+	}
+
+	void initialize( uint8_t blockSizeExp )
+	{
+		BasePageAllocator::initialize( blockSizeExp );
+		freeSegments = nullptr;
+		freeSegmentCount = 0;
+	}
+
+	void deinitialize()
+	{
+		while ( freeSegments != nullptr )
+		{
+			ZombieListSegment* next = freeSegments->next;
+			this->freeChunkNoCache( freeSegments, segmentSize );
+			freeSegments = next;
+		}
+		freeSegmentCount = 0;
+		BasePageAllocator::deinitialize();
+	}
+};
+
+template<class Pool>
+class OutOfBandZombieList
+{
+	ZombieListSegment* head = nullptr; // segments in the list are never empty
+	ZombieListSegment* tail = nullptr;
+
+public:
+	bool empty() const { return head == nullptr; }
+
+	NODECPP_FORCEINLINE void pushBack( void* ptr, Pool& pool )
+	{
+		if ( tail == nullptr || tail->end == ZombieListSegment::capacity ) // UNLIKELY
+		{
+			ZombieListSegment* s = pool.getSegment();
+			if ( tail )
+				tail->next = s;
+			else
+				head = s;
+			tail = s;
+		}
+		tail->items[tail->end++] = ptr;
+	}
+
+	// returns nullptr if empty
+	NODECPP_FORCEINLINE void* popFront( Pool& pool )
+	{
+		if ( head == nullptr )
+			return nullptr;
+		void* ret = head->items[head->begin++];
+		if ( head->begin == head->end )
+		{
+			ZombieListSegment* s = head;
+			head = head->next;
+			if ( head == nullptr )
+				tail = nullptr;
+			pool.putSegment( s );
+		}
+		return ret;
+	}
+
+	// moves all items of 'other' to the end of this list (a partially filled segment may end up in the middle; this is fine)
+	void append( OutOfBandZombieList& other, Pool& )
+	{
+		if ( other.head == nullptr )
+			return;
+		if ( tail )
+			tail->next = other.head;
+		else
+			head = other.head;
+		tail = other.tail;
+		other.head = other.tail = nullptr;
+	}
+
+	// moves all items to a free list of blocks linked through their first word
+	void moveToFreeList( void*& freeList, Pool& pool )
+	{
+		while ( head != nullptr )
+		{
+			for ( uint32_t i=head->begin; i<head->end; ++i )
+			{
+				*reinterpret_cast<void**>( head->items[i] ) = freeList;
+				freeList = head->items[i];
+			}
+			ZombieListSegment* next = head->next;
+			pool.putSegment( head );
+			head = next;
+		}
+		tail = nullptr;
+	}
+
+	// calls f( item ) for each item, oldest first; the list is not changed
+	template<class F>
+	void forEach( F&& f ) const
+	{
+		for ( const ZombieListSegment* s = head; s != nullptr; s = s->next )
+			for ( uint32_t i=s->begin; i<s->end; ++i )
+				f( s->items[i] );
+	}
+
+	void initialize() { head = tail = nullptr; }
+
+	// items are dropped
+	void deinitialize( Pool& pool )
+	{
+		while ( head != nullptr )
+		{
+			ZombieListSegment* next = head->next;
+			pool.putSegment( head );
+			head = next;
+		}
+		tail = nullptr;
+	}
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_ZOMBIE_LIST_H
@@ -0,0 +1,370 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Zombie set for SafeIibAllocator
+ *     - answers "is this address inside a zombie block" in O(1) with a couple
+ *       of dependent loads and no branches on the block layout
+ *     - address space is split into windows of the size of a sounding-address
+ *       reservation; windows are found via a two-level radix table, and each
+ *       touched window gets a lazily allocated (and lazily committed by the OS)
+ *       leaf with
+ *         - one bit per 8-byte granule, set for every granule of a zombie
+ *           block coming from a bucket (blocks are at most MaxBucketSize long,
+ *           so marking is a handful of word stores)
+ *         - one bit per page, set for every page of a zombie bulk chunk
+ *     - clearing (at killAllZombies()) only touches leaves and pages that have
+ *       actually been marked since the previous clearing
+ *
+ * -------------------------------------------------------------------------------*/
+
+#ifndef IIBMALLOC_ZOMBIE_SET_H
+#define IIBMALLOC_ZOMBIE_SET_H
+
+#include "iibmalloc_common.h"
+#include "page_management.h"
+
+namespace nodecpp::iibmalloc
+{
+
+// Maps an address to a per-window leaf of type LeafT; leaves and intermediate
+// tables are obtained from BasePageAllocator on first use and are zero-filled.
+template<class BasePageAllocator, class LeafT, size_t windowSizeExp, size_t pageSizeExp>
+class AddressRadixTable : public BasePageAllocator
+{
+public:
+	static constexpr size_t addressBits = sizeof(void*) == 8 ? 48 : 32;
+	static_assert( addressBits > windowSizeExp );
+	static constexpr size_t windowIndexBits = addressBits - windowSizeExp;
+	static constexpr size_t level2Bits = windowIndexBits < 12 ? windowIndexBits : 12;
+	static constexpr size_t level1Bits = windowIndexBits - level2Bits;
+	static constexpr size_t level1Size = ((size_t)1) << level1Bits;
+	static constexpr size_t level2Size = ((size_t)1) << level2Bits;
+	static constexpr size_t windowSize = ((size_t)1) << windowSizeExp;
+
+private:
+	struct Level2
+	{
+		LeafT* leaves[level2Size];
+	};
+
+	static constexpr size_t level1Bytes = alignUpExp( sizeof(Level2*) * level1Size, pageSizeExp );
+	static constexpr size_t level2Bytes = alignUpExp( sizeof(Level2), pageSizeExp );
+	static constexpr size_t leafBytes = alignUpExp( sizeof(LeafT), pageSizeExp );
+
+	Level2** root = nullptr;
+	size_t level2Count = 0;
+	size_t leafCount = 0;
+
+public:
+	static NODECPP_FORCEINLINE uintptr_t windowIndex( const void* ptr ) { return reinterpret_cast<uintptr_t>( ptr ) >> windowSizeExp; }
+	static NODECPP_FORCEINLINE size_t offsetInWindow( const void* ptr ) { return reinterpret_cast<uintptr_t>( ptr ) & ( windowSize - 1 ); }
+	static NODECPP_FORCEINLINE uint8_t* windowStart( uintptr_t idx ) { return reinterpret_cast<uint8_t*>( idx << windowSizeExp ); }
+
+	NODECPP_FORCEINLINE LeafT* find( const void* ptr ) const
+	{
+		uintptr_t idx = windowIndex( ptr );
+		if ( root == nullptr || ( idx >> windowIndexBits ) != 0 )
+			return nullptr;
+		Level2* l2 = root[ idx >> level2Bits ];
+		if ( l2 == nullptr )
+			return nullptr;
+		return l2->leaves[ idx & ( level2Size - 1 ) ];
+	}
+
+	LeafT* getOrCreate( const void* ptr )
+	{
+		uintptr_t idx = windowIndex( ptr );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( idx >> windowIndexBits ) == 0, "address 0x{:x} is out of supported range", (uintptr_t)ptr );
+		if ( root == nullptr )
+			root = reinterpret_cast<Level2**>( this->getFreeBlockNoCache( level1Bytes ) );
+		Level2*& l2 = root[ idx >> level2Bits ];
+		if ( l2 == nullptr )
+		{
+			l2 = reinterpret_cast<Level2*>( this->getFreeBlockNoCache( level2Bytes ) );
+			++level2Count;
+		}
+		LeafT*& leaf = l2->leaves[ idx & ( level2Size - 1 ) ];
+		if ( leaf == nullptr )
+		{
+			leaf = reinterpret_cast<LeafT*>( this->getFreeBlockNoCache( leafBytes ) ); // fresh pages are zero-filled
+			++leafCount;
+		}
+		return leaf;
+	}
+
+	size_t getLeafCount() const { return leafCount; }
+	size_t getReservedSize() const { return ( root ? level1Bytes : 0 ) + level2Count * level2Bytes + leafCount * leafBytes; }
+
+	template<class Functor>
+	void doForEachLeaf( Functor& f )
+	{
+		if ( root == nullptr )
+			return;
+		for ( size_t i=0; i<level1Size; ++i )
+			if ( root[i] != nullptr )
+				for ( size_t j=0; j<level2Size; ++j )
+					if ( root[i]->leaves[j] != nullptr )
+						f( root[i]->leaves[j] );
+	}
+
+	void initialize( uint8_t blockSizeExp )
+	{
+		BasePageAllocator::initialize( blockSizeExp );
+		root = nullptr;
+		level2Count = 0;
+		leafCount = 0;
+	}
+
+	void deinitialize()
+	{
+		if ( root != nullptr )
+		{
+			for ( size_t i=0; i<level1Size; ++i )
+			{
+				if ( root[i] == nullptr )
+					continue;
+				for ( size_t j=0; j<level2Size; ++j )
+					if ( root[i]->leaves[j] != nullptr )
+						this->freeChunkNoCache( root[i]->leaves[j], leafBytes );
+				this->freeChunkNoCache( root[i], level2Bytes );
+			}
+			this->freeChunkNoCache( root, level1Bytes );
+		}
+		root = nullptr;
+		level2Count = 0;
+		leafCount = 0;
+		BasePageAllocator::deinitialize();
+	}
+};
+
+template<class BasePageAllocator, size_t windowSizeExp, size_t pageSizeExp, size_t granuleSizeExp>
+class ZombieSet
+{
+	static constexpr size_t pagesPerWindow = ((size_t)1) << ( windowSizeExp - pageSizeExp );
+	static constexpr size_t granulesPerPageExp = pageSizeExp - granuleSizeExp;
+	static constexpr size_t granuleWordsPerPage = ( ((size_t)1) << granulesPerPageExp ) / 64;
+	static_assert( granuleWordsPerPage >= 1 );
+	static_assert( pagesPerWindow % 64 == 0 );
+
+	struct Window
+	{
+		uint64_t granules[pagesPerWindow * granuleWordsPerPage]; // bucket zombies
+		uint64_t pages[pagesPerWindow / 64]; // bulk zombies
+		uint64_t dirtyPages[pagesPerWindow / 64]; // pages with any bit set in 'granules'
+		Window* nextDirty;
+		bool dirty;
+		bool hasPages;
+	};
+
+	using TableT = AddressRadixTable<BasePageAllocator, Window, windowSizeExp, pageSizeExp>;
+	TableT table;
+	Window* dirtyWindows = nullptr;
+	size_t zombieCount = 0;
+
+	NODECPP_FORCEINLINE void markDirty( Window* w )
+	{
+		if ( !w->dirty )
+		{
+			w->dirty = true;
+			w->nextDirty = dirtyWindows;
+			dirtyWindows = w;
+		}
+	}
+
+	static NODECPP_FORCEINLINE void setBitRange( uint64_t* words, size_t begin, size_t end ) // [begin, end)
+	{
+		size_t wBegin = begin >> 6;
+		size_t wEnd = ( end - 1 ) >> 6;
+		uint64_t first = ~((uint64_t)0) << ( begin & 63 );
+		uint64_t last = ~((uint64_t)0) >> ( 63 - ( ( end - 1 ) & 63 ) );
+		if ( wBegin == wEnd )
+		{
+			words[wBegin] |= first & last;
+			return;
+		}
+		words[wBegin] |= first;
+		for ( size_t i=wBegin+1; i<wEnd; ++i )
+			words[i] = ~((uint64_t)0);
+		words[wEnd] |= last;
+	}
+
+	static NODECPP_FORCEINLINE void clearBitRange( uint64_t* words, size_t begin, size_t end ) // [begin, end)
+	{
+		size_t wBegin = begin >> 6;
+		size_t wEnd = ( end - 1 ) >> 6;
+		uint64_t first = ~((uint64_t)0) << ( begin & 63 );
+		uint64_t last = ~((uint64_t)0) >> ( 63 - ( ( end - 1 ) & 63 ) );
+		if ( wBegin == wEnd )
+		{
+			words[wBegin] &= ~( first & last );
+			return;
+		}
+		words[wBegin] &= ~first;
+		for ( size_t i=wBegin+1; i<wEnd; ++i )
+			words[i] = 0;
+		words[wEnd] &= ~last;
+	}
+
+	// bits are cleared, but pages/windows stay in dirty lists until the next clear()
+	template<bool perGranule>
+	void unmarkRange( uint8_t* begin, uint8_t* end )
+	{
+		while ( begin < end )
+		{
+			uint8_t* wEnd = TableT::windowStart( TableT::windowIndex( begin ) + 1 );
+			uint8_t* stop = end < wEnd ? end : wEnd;
+			Window* w = table.find( begin );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, w != nullptr );
+			size_t offBegin = TableT::offsetInWindow( begin );
+			size_t offEnd = offBegin + ( stop - begin );
+			if constexpr ( perGranule )
+				clearBitRange( w->granules, offBegin >> granuleSizeExp, ( offEnd + ( ((size_t)1) << granuleSizeExp ) - 1 ) >> granuleSizeExp );
+			else
+				clearBitRange( w->pages, offBegin >> pageSizeExp, ( offEnd + ( ((size_t)1) << pageSizeExp ) - 1 ) >> pageSizeExp );
+			begin = stop;
+		}
+	}
+
+	template<bool perGranule>
+	void markRange( uint8_t* begin, uint8_t* end )
+	{
+		while ( begin < end )
+		{
+			uint8_t* wEnd = TableT::windowStart( TableT::windowIndex( begin ) + 1 );
+			uint8_t* stop = end < wEnd ? end : wEnd;
+			Window* w = table.getOrCreate( begin );
+			markDirty( w );
+			size_t offBegin = TableT::offsetInWindow( begin );
+			size_t offEnd = offBegin + ( stop - begin );
+			size_t pageBegin = offBegin >> pageSizeExp;
+			size_t pageEnd = ( offEnd + ( ((size_t)1) << pageSizeExp ) - 1 ) >> pageSizeExp;
+			if constexpr ( perGranule )
+			{
+				setBitRange( w->granules, offBegin >> granuleSizeExp, ( offEnd + ( ((size_t)1) << granuleSizeExp ) - 1 ) >> granuleSizeExp );
+				setBitRange( w->dirtyPages, pageBegin, pageEnd );
+			}
+			else
+			{
+				setBitRange( w->pages, pageBegin, pageEnd );
+				w->hasPages = true;
+			}
+			begin = stop;
+		}
+	}
+
+public:
+	// block of a bucket; [ptr, ptr + sz) is expected to be a few pages at most
+	NODECPP_FORCEINLINE void insertBucketBlock( void* ptr, size_t sz )
+	{
+		markRange<true>( reinterpret_cast<uint8_t*>( ptr ), reinterpret_cast<uint8_t*>( ptr ) + sz );
+		++zombieCount;
+	}
+
+	// bulk chunk; pageStart and sz are expected to be page-aligned
+	NODECPP_FORCEINLINE void insertBulkChunk( void* pageStart, size_t sz )
+	{
+		markRange<false>( reinterpret_cast<uint8_t*>( pageStart ), reinterpret_cast<uint8_t*>( pageStart ) + sz );
+		++zombieCount;
+	}
+
+	// removal of individual zombies (when they are released before killAllZombies())
+	NODECPP_FORCEINLINE void eraseBucketBlock( void* ptr, size_t sz )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, zombieCount != 0 );
+		unmarkRange<true>( reinterpret_cast<uint8_t*>( ptr ), reinterpret_cast<uint8_t*>( ptr ) + sz );
+		--zombieCount;
+	}
+
+	NODECPP_FORCEINLINE void eraseBulkChunk( void* pageStart, size_t sz )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, zombieCount != 0 );
+		unmarkRange<false>( reinterpret_cast<uint8_t*>( pageStart ), reinterpret_cast<uint8_t*>( pageStart ) + sz );
+		--zombieCount;
+	}
+
+	NODECPP_FORCEINLINE bool contains( const void* ptr ) const
+	{
+		const Window* w = table.find( ptr );
+		if ( w == nullptr )
+			return false;
+		size_t off = TableT::offsetInWindow( ptr );
+		size_t g = off >> granuleSizeExp;
+		size_t p = off >> pageSizeExp;
+		return ( ( w->granules[g >> 6] >> ( g & 63 ) ) | ( w->pages[p >> 6] >> ( p & 63 ) ) ) & 1;
+	}
+
+	bool empty() const { return zombieCount == 0; }
+	size_t size() const { return zombieCount; }
+
+	void clear()
+	{
+		while ( dirtyWindows != nullptr )
+		{
+			Window* w = dirtyWindows;
+			for ( size_t i=0; i<pagesPerWindow / 64; ++i )
+			{
+				uint64_t bits = w->dirtyPages[i];
+				for ( size_t j=0; bits != 0; ++j, bits >>= 1 )
+					if ( bits & 1 )
+						memset( w->granules + ( i * 64 + j ) * granuleWordsPerPage, 0, granuleWordsPerPage * sizeof(uint64_t) );
+				w->dirtyPages[i] = 0;
+			}
+			if ( w->hasPages )
+			{
+				memset( w->pages, 0, sizeof( w->pages ) );
+				w->hasPages = false;
+			}
+			w->dirty = false;
+			dirtyWindows = w->nextDirty;
+			w->nextDirty = nullptr;
+		}
+		zombieCount = 0;
+	}
+
+	const BlockStats& getStats() const { return table.getStats(); }
+
+	size_t getReservedSize() const { return table.getReservedSize(); }
+
+	void initialize( uint8_t blockSizeExp )
+	{
+		table.initialize( blockSizeExp );
+		dirtyWindows = nullptr;
+		zombieCount = 0;
+	}
+
+	void deinitialize()
+	{
+		table.deinitialize();
+		dirtyWindows = nullptr;
+		zombieCount = 0;
+	}
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_ZOMBIE_SET_H
@@ -0,0 +1,655 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * Allocator benchmark: named workload scenarios run against iibmalloc
+ * (with and without zombie mode), new/delete, and an empty (fake) allocator,
+ * with warmup and repeat counts; results are printed as text, JSON, or CSV
+ * 
+ * Usage: benchmark_iibmalloc [--scenario <name>]... [--allocator <name>]...
+ *            [--ops <count>] [--threads <count>] [--repeat <count>] [--warmup <count>]
+ *            [--format text|json|csv] [--out <file>] [--list]
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "random_test.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+thread_local unsigned long long rnd_seed = 0;
+
+// same allocator as PerThreadAllocatorUnderTest, but with plain (non-zombieable) calls; the pair gives zombie mode overhead
+class PerThreadAllocatorNoZombiesUnderTest
+{
+	ThreadLocalAllocatorT allocManager;
+	ThreadLocalAllocatorT* formerAlloc = nullptr;
+	CommonTestResults* testRes = nullptr;
+	size_t start = 0;
+	size_t liveBytes = 0;
+
+public:
+	PerThreadAllocatorNoZombiesUnderTest( CommonTestResults* testRes_ ) { testRes = testRes_; }
+	static constexpr bool isFake() { return false; }
+
+	void init( size_t threadID )
+	{
+		start = GetMillisecondCount();
+		testRes->threadID = threadID;
+		testRes->rdtscBegin = NODECPP_RDTSC();
+		allocManager.initialize();
+		captureFootprint( testRes->footprintBegin, 0, allocManager.getAllocatorStats().total() );
+		formerAlloc = setCurrneAllocator( &allocManager );
+	}
+
+	void* allocate( size_t sz ) { return allocManager.allocate( sz ); }
+	void deallocate( void* ptr ) { allocManager.deallocate( ptr ); }
+	void registerLiveBytes( size_t bytes ) { liveBytes = bytes; }
+
+	void deinit()
+	{
+		formerAlloc = setCurrneAllocator( formerAlloc );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, formerAlloc == &allocManager );
+	}
+
+	void doWhateverAfterSetupPhase() { testRes->rdtscSetup = NODECPP_RDTSC(); captureFootprint( testRes->footprintAfterSetup, liveBytes, allocManager.getAllocatorStats().total() ); }
+	void doWhateverWithinMainLoopPhase() {}
+	void doWhateverAfterMainLoopPhase() { testRes->rdtscMainLoop = NODECPP_RDTSC(); captureFootprint( testRes->footprintAfterMainLoop, liveBytes, allocManager.getAllocatorStats().total() ); }
+	void doWhateverAfterCleanupPhase()
+	{
+		testRes->rdtscExit = NODECPP_RDTSC();
+		testRes->innerDur = GetMillisecondCount() - start;
+		captureFootprint( testRes->footprintAfterExit, 0, allocManager.getAllocatorStats().total() );
+	}
+};
+
+struct BenchParams
+{
+	size_t opCount = 4000000; // per thread and run
+	size_t threadCount = 1;
+	size_t repeatCount = 5;
+	size_t warmupCount = 1;
+};
+
+// memory is touched once on allocation and once on deallocation so that first-touch costs are not hidden
+NODECPP_FORCEINLINE void touch( void* ptr, size_t sz ) { if ( sz ) reinterpret_cast<uint8_t*>(ptr)[0] = (uint8_t)sz; }
+NODECPP_FORCEINLINE size_t peek( void* ptr, size_t sz ) { return sz ? reinterpret_cast<uint8_t*>(ptr)[0] : 0; }
+
+// every scenario receives its scratch memory allocated outside of the allocator under test and returns a value depending on the memory read;
+// it also reports the peak of bytes requested and not yet released (zombies are not counted) via registerLiveBytes()
+
+// same size, random slot replaced at each step
+template<class AllocatorUnderTest>
+size_t scenarioFixedChurn( AllocatorUnderTest& a, const BenchParams& p, void** slots, size_t* )
+{
+	constexpr size_t slotCount = 1 << 16;
+	constexpr size_t sz = 64;
+	size_t ctr = 0;
+	size_t live = 0, peakLive = 0;
+	memset( slots, 0, slotCount * sizeof(void*) );
+	for ( size_t i=0; i<p.opCount; ++i )
+	{
+		size_t idx = rng64() & ( slotCount - 1 );
+		if ( slots[idx] )
+		{
+			ctr += peek( slots[idx], sz );
+			a.deallocate( slots[idx] );
+			slots[idx] = nullptr;
+			live -= sz;
+		}
+		else
+		{
+			slots[idx] = a.allocate( sz );
+			touch( slots[idx], sz );
+			live += sz;
+			peakLive = std::max( peakLive, live );
+		}
+		if ( ( i & 0xFFFF ) == 0 )
+			a.doWhateverWithinMainLoopPhase();
+	}
+	a.registerLiveBytes( peakLive );
+	for ( size_t idx=0; idx<slotCount; ++idx )
+		if ( slots[idx] )
+			a.deallocate( slots[idx] );
+	return ctr;
+}
+
+// batches of small objects released in reverse order (stack-like lifetimes)
+template<class AllocatorUnderTest>
+size_t scenarioLifo( AllocatorUnderTest& a, const BenchParams& p, void** slots, size_t* sizes )
+{
+	constexpr size_t batch = 1024;
+	size_t ctr = 0;
+	size_t peakLive = 0;
+	for ( size_t done=0; done<p.opCount; done += 2 * batch )
+	{
+		size_t live = 0;
+		for ( size_t i=0; i<batch; ++i )
+		{
+			sizes[i] = calcSizeWithStatsAdjustment( rng64(), 8 );
+			slots[i] = a.allocate( sizes[i] );
+			touch( slots[i], sizes[i] );
+			live += sizes[i];
+		}
+		peakLive = std::max( peakLive, live );
+		for ( size_t i=batch; i>0; --i )
+		{
+			ctr += peek( slots[i-1], sizes[i-1] );
+			a.deallocate( slots[i-1] );
+		}
+		a.doWhateverWithinMainLoopPhase();
+	}
+	a.registerLiveBytes( peakLive );
+	return ctr;
+}
+
+// ring of small objects, the oldest is released when a new one is created (queue-like lifetimes)
+template<class AllocatorUnderTest>
+size_t scenarioFifo( AllocatorUnderTest& a, const BenchParams& p, void** slots, size_t* sizes )
+{
+	constexpr size_t ringSize = 1 << 14;
+	size_t ctr = 0;
+	size_t live = 0, peakLive = 0;
+	memset( slots, 0, ringSize * sizeof(void*) );
+	for ( size_t i=0; i<p.opCount / 2; ++i )
+	{
+		size_t idx = i & ( ringSize - 1 );
+		if ( slots[idx] )
+		{
+			ctr += peek( slots[idx], 1 );
+			a.deallocate( slots[idx] );
+			live -= sizes[idx];
+		}
+		size_t sz = calcSizeWithStatsAdjustment( rng64(), 8 );
+		slots[idx] = a.allocate( sz );
+		touch( slots[idx], sz );
+		sizes[idx] = sz;
+		live += sz;
+		peakLive = std::max( peakLive, live );
+		if ( ( i & 0xFFFF ) == 0 )
+			a.doWhateverWithinMainLoopPhase();
+	}
+	a.registerLiveBytes( peakLive );
+	for ( size_t idx=0; idx<ringSize; ++idx )
+		if ( slots[idx] )
+			a.deallocate( slots[idx] );
+	return ctr;
+}
+
+// bursts of messages of mixed sizes queued by a producer stage and drained by a consumer stage with a lag;
+// both stages run on the same thread as a per-thread heap does not support freeing memory of other threads
+template<class AllocatorUnderTest>
+size_t scenarioProducerConsumer( AllocatorUnderTest& a, const BenchParams& p, void** slots, size_t* sizes )
+{
+	constexpr size_t queueSize = 1 << 16;
+	size_t head = 0, tail = 0;
+	size_t ctr = 0;
+	size_t done = 0;
+	size_t live = 0, peakLive = 0;
+	while ( done < p.opCount )
+	{
+		size_t burst = 1 + ( rng64() & 1023 );
+		for ( size_t i=0; i<burst && head - tail < queueSize; ++i, ++done )
+		{
+			size_t sz = 16 + ( rng64() & 511 );
+			void* msg = a.allocate( sz );
+			touch( msg, sz );
+			sizes[ head & ( queueSize - 1 ) ] = sz;
+			slots[ head++ & ( queueSize - 1 ) ] = msg;
+			live += sz;
+		}
+		peakLive = std::max( peakLive, live );
+		size_t drain = 1 + ( rng64() & 1023 );
+		for ( size_t i=0; i<drain && tail < head; ++i, ++done )
+		{
+			live -= sizes[ tail & ( queueSize - 1 ) ];
+			void* msg = slots[ tail++ & ( queueSize - 1 ) ];
+			ctr += peek( msg, 1 );
+			a.deallocate( msg );
+		}
+		a.doWhateverWithinMainLoopPhase();
+	}
+	a.registerLiveBytes( peakLive );
+	while ( tail < head )
+		a.deallocate( slots[ tail++ & ( queueSize - 1 ) ] );
+	return ctr;
+}
+
+// buffers above MaxBucketSize (8 KiB) and up to 256 KiB served by the bulk allocator
+template<class AllocatorUnderTest>
+size_t scenarioLargeBuffers( AllocatorUnderTest& a, const BenchParams& p, void** slots, size_t* sizes )
+{
+	constexpr size_t slotCount = 1 << 8;
+	size_t ctr = 0;
+	size_t live = 0, peakLive = 0;
+	memset( slots, 0, slotCount * sizeof(void*) );
+	for ( size_t i=0; i<p.opCount; ++i )
+	{
+		size_t idx = rng64() & ( slotCount - 1 );
+		if ( slots[idx] )
+		{
+			ctr += peek( slots[idx], 1 );
+			a.deallocate( slots[idx] );
+			slots[idx] = nullptr;
+			live -= sizes[idx];
+		}
+		else
+		{
+			size_t sz = 8 * 1024 + 1 + ( rng64() % ( 248 * 1024 ) );
+			slots[idx] = a.allocate( sz );
+			touch( slots[idx], sz );
+			sizes[idx] = sz;
+			live += sz;
+			peakLive = std::max( peakLive, live );
+		}
+		if ( ( i & 0xFFF ) == 0 )
+			a.doWhateverWithinMainLoopPhase();
+	}
+	a.registerLiveBytes( peakLive );
+	for ( size_t idx=0; idx<slotCount; ++idx )
+		if ( slots[idx] )
+			a.deallocate( slots[idx] );
+	return ctr;
+}
+
+// vector-like growth: allocate twice the size, copy, release the old buffer
+template<class AllocatorUnderTest>
+size_t scenarioReallocGrowth( AllocatorUnderTest& a, const BenchParams& p, void**, size_t* )
+{
+	constexpr size_t maxSize = 64 * 1024;
+	size_t ctr = 0;
+	size_t done = 0;
+	while ( done < p.opCount )
+	{
+		size_t sz = 16;
+		uint8_t* buff = reinterpret_cast<uint8_t*>( a.allocate( sz ) );
+		memset( buff, 1, sz );
+		++done;
+		while ( sz < maxSize )
+		{
+			uint8_t* next = reinterpret_cast<uint8_t*>( a.allocate( sz * 2 ) );
+			if ( next != buff ) // fake allocator returns the same buffer
+				memcpy( next, buff, sz );
+			memset( next + sz, 1, sz );
+			a.deallocate( buff );
+			buff = next;
+			sz *= 2;
+			done += 2;
+		}
+		ctr += buff[ sz - 1 ];
+		a.deallocate( buff );
+		++done;
+		a.doWhateverWithinMainLoopPhase();
+	}
+	a.registerLiveBytes( maxSize / 2 + maxSize ); // both buffers of the last step
+	return ctr;
+}
+
+// short-lived small objects with frequent kill points; compare 'iibmalloc' vs 'iibmalloc-plain' rows for zombie mode overhead
+template<class AllocatorUnderTest>
+size_t scenarioZombieChurn( AllocatorUnderTest& a, const BenchParams& p, void** slots, size_t* sizes )
+{
+	constexpr size_t slotCount = 1 << 12;
+	size_t ctr = 0;
+	size_t live = 0, peakLive = 0;
+	memset( slots, 0, slotCount * sizeof(void*) );
+	for ( size_t i=0; i<p.opCount; ++i )
+	{
+		size_t idx = rng64() & ( slotCount - 1 );
+		if ( slots[idx] )
+		{
+			ctr += peek( slots[idx], 1 );
+			a.deallocate( slots[idx] );
+			slots[idx] = nullptr;
+			live -= sizes[idx];
+		}
+		else
+		{
+			size_t sz = calcSizeWithStatsAdjustment( rng64(), 9 );
+			slots[idx] = a.allocate( sz );
+			touch( slots[idx], sz );
+			sizes[idx] = sz;
+			live += sz;
+			peakLive = std::max( peakLive, live );
+		}
+		if ( ( i & 0x3FF ) == 0 )
+			a.doWhateverWithinMainLoopPhase();
+	}
+	a.registerLiveBytes( peakLive );
+	for ( size_t idx=0; idx<slotCount; ++idx )
+		if ( slots[idx] )
+			a.deallocate( slots[idx] );
+	return ctr;
+}
+
+enum ScenarioID { FIXED_CHURN, LIFO, FIFO, PRODUCER_CONSUMER, LARGE_BUFFERS, REALLOC_GROWTH, ZOMBIE_CHURN, SCENARIO_COUNT };
+constexpr const char* scenarioNames[SCENARIO_COUNT] = { "fixed-churn", "lifo", "fifo", "producer-consumer", "large-buffers", "realloc-growth", "zombie-churn" };
+constexpr size_t scratchSlotCount = 1 << 16; // enough for any scenario above
+
+struct Scratch
+{
+	void** slots;
+	size_t* sizes;
+};
+
+enum AllocatorID { ALLOCATOR_EMPTY, ALLOCATOR_NEW_DELETE, ALLOCATOR_IIBMALLOC, ALLOCATOR_IIBMALLOC_PLAIN, ALLOCATOR_COUNT };
+constexpr const char* allocatorNames[ALLOCATOR_COUNT] = { "empty", "new-delete", "iibmalloc", "iibmalloc-plain" };
+
+template<class AllocatorUnderTest>
+size_t runScenario( size_t scenario, AllocatorUnderTest& a, const BenchParams& p, void** slots, size_t* sizes )
+{
+	switch ( scenario )
+	{
+		case FIXED_CHURN: return scenarioFixedChurn( a, p, slots, sizes );
+		case LIFO: return scenarioLifo( a, p, slots, sizes );
+		case FIFO: return scenarioFifo( a, p, slots, sizes );
+		case PRODUCER_CONSUMER: return scenarioProducerConsumer( a, p, slots, sizes );
+		case LARGE_BUFFERS: return scenarioLargeBuffers( a, p, slots, sizes );
+		case REALLOC_GROWTH: return scenarioReallocGrowth( a, p, slots, sizes );
+		case ZOMBIE_CHURN: return scenarioZombieChurn( a, p, slots, sizes );
+		default:
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, false );
+			return 0;
+	}
+}
+
+std::atomic<size_t> resultSink;
+
+template<class AllocatorUnderTest, class TestResT>
+void runScenarioInThread( size_t scenario, const BenchParams& p, size_t threadID, TestResT* res, void** slots, size_t* sizes )
+{
+	rnd_seed = threadID; // same sequence for each allocator
+	AllocatorUnderTest a( res );
+	a.init( threadID );
+	a.doWhateverAfterSetupPhase();
+	size_t ctr = runScenario( scenario, a, p, slots, sizes );
+	a.doWhateverAfterMainLoopPhase();
+	a.deinit();
+	a.doWhateverAfterCleanupPhase();
+	resultSink += ctr; // keeps the reads above from being optimized out
+}
+
+struct RunMeasurement
+{
+	int64_t dur; // wall time in microseconds for all threads
+	size_t peakRssGrowth; // bytes over RSS at start of the run; process-wide
+	size_t peakLiveBytes; // sum of per-thread peaks of bytes requested and not yet released
+	uint64_t minorFaults; // sums over threads
+	uint64_t majorFaults;
+	uint64_t sysMapCalls; // as reported by allocator (iibmalloc only)
+	uint64_t sysUnmapCalls;
+	uint64_t sysProtectCalls;
+};
+
+template<class AllocatorUnderTest>
+RunMeasurement runOnce( size_t scenario, const BenchParams& p, std::vector<Scratch>& scratch )
+{
+	ThreadTestRes res[max_threads];
+	memset( res, 0, sizeof(res) );
+	std::thread threads[max_threads];
+	ResetPeakRss(); // once per run and before any thread starts, as peak RSS is process-wide
+	MemoryFootprint before;
+	GetMemoryFootprint( before, false );
+	int64_t start = GetMicrosecondCount();
+	for ( size_t i=0; i<p.threadCount; ++i )
+		threads[i] = std::thread( [scenario, &p, &res, &scratch, i]() { runScenarioInThread<AllocatorUnderTest>( scenario, p, i, res + i, scratch[i].slots, scratch[i].sizes ); } );
+	for ( size_t i=0; i<p.threadCount; ++i )
+		threads[i].join();
+
+	RunMeasurement m;
+	memset( &m, 0, sizeof(m) );
+	m.dur = GetMicrosecondCount() - start;
+	for ( size_t i=0; i<p.threadCount; ++i )
+	{
+		const PhaseFootprint& b = res[i].footprintBegin;
+		const PhaseFootprint& e = res[i].footprintAfterExit;
+		if ( e.mem.peakRss > before.rss )
+			m.peakRssGrowth = std::max( m.peakRssGrowth, e.mem.peakRss - before.rss );
+		m.peakLiveBytes += res[i].footprintAfterMainLoop.liveBytes;
+		m.minorFaults += e.mem.minorFaults - b.mem.minorFaults;
+		m.majorFaults += e.mem.majorFaults - b.mem.majorFaults;
+		m.sysMapCalls += e.sysMapCallCnt - b.sysMapCallCnt;
+		m.sysUnmapCalls += e.sysUnmapCallCnt - b.sysUnmapCallCnt;
+		m.sysProtectCalls += e.sysProtectCallCnt - b.sysProtectCallCnt;
+	}
+	return m;
+}
+
+RunMeasurement runOnce( size_t allocator, size_t scenario, const BenchParams& p, std::vector<Scratch>& scratch )
+{
+	switch ( allocator )
+	{
+		case ALLOCATOR_EMPTY: return runOnce<FakeAllocatorUnderTest>( scenario, p, scratch );
+		case ALLOCATOR_NEW_DELETE: return runOnce<NewDeleteUnderTest>( scenario, p, scratch );
+		case ALLOCATOR_IIBMALLOC: return runOnce<PerThreadAllocatorUnderTest>( scenario, p, scratch );
+		case ALLOCATOR_IIBMALLOC_PLAIN: return runOnce<PerThreadAllocatorNoZombiesUnderTest>( scenario, p, scratch );
+		default:
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, false );
+			return RunMeasurement();
+	}
+}
+
+struct BenchResult
+{
+	size_t scenario;
+	size_t allocator;
+	std::vector<int64_t> runs; // microseconds, warmup runs excluded
+	std::vector<RunMeasurement> measurements;
+	int64_t minDur;
+	int64_t medianDur;
+	double meanDur;
+	size_t maxPeakRssGrowth;
+	size_t peakLiveBytes;
+	double bytesPerLiveByte; // peak RSS growth per peak live byte; 0 if nothing was alive
+	double meanMinorFaults;
+	double meanMajorFaults;
+	double meanSysMapCalls;
+	double meanSysUnmapCalls;
+	double meanSysProtectCalls;
+};
+
+void computeSummary( BenchResult& r )
+{
+	r.runs.clear();
+	r.maxPeakRssGrowth = 0;
+	r.peakLiveBytes = 0;
+	r.meanMinorFaults = r.meanMajorFaults = r.meanSysMapCalls = r.meanSysUnmapCalls = r.meanSysProtectCalls = 0;
+	for ( const RunMeasurement& m : r.measurements )
+	{
+		r.runs.push_back( m.dur );
+		r.maxPeakRssGrowth = std::max( r.maxPeakRssGrowth, m.peakRssGrowth );
+		r.peakLiveBytes = std::max( r.peakLiveBytes, m.peakLiveBytes );
+		r.meanMinorFaults += m.minorFaults;
+		r.meanMajorFaults += m.majorFaults;
+		r.meanSysMapCalls += m.sysMapCalls;
+		r.meanSysUnmapCalls += m.sysUnmapCalls;
+		r.meanSysProtectCalls += m.sysProtectCalls;
+	}
+	double cnt = r.measurements.size();
+	r.meanMinorFaults /= cnt;
+	r.meanMajorFaults /= cnt;
+	r.meanSysMapCalls /= cnt;
+	r.meanSysUnmapCalls /= cnt;
+	r.meanSysProtectCalls /= cnt;
+	r.bytesPerLiveByte = r.peakLiveBytes ? r.maxPeakRssGrowth * 1. / r.peakLiveBytes : 0;
+
+	std::vector<int64_t> sorted = r.runs;
+	std::sort( sorted.begin(), sorted.end() );
+	r.minDur = sorted.front();
+	r.medianDur = sorted[ sorted.size() / 2 ];
+	r.meanDur = 0;
+	for ( auto d : sorted )
+		r.meanDur += d;
+	r.meanDur /= sorted.size();
+}
+
+double nsPerOp( int64_t dur, const BenchParams& p ) { return dur * 1000. / p.opCount; }
+
+void printResults( FILE* f, const char* format, const std::vector<BenchResult>& results, const BenchParams& p )
+{
+	if ( strcmp( format, "json" ) == 0 )
+	{
+		fprintf( f, "{\n  \"params\": {\"ops\": %zu, \"threads\": %zu, \"repeat\": %zu, \"warmup\": %zu},\n  \"results\": [\n", p.opCount, p.threadCount, p.repeatCount, p.warmupCount );
+		for ( size_t i=0; i<results.size(); ++i )
+		{
+			const BenchResult& r = results[i];
+			fprintf( f, "    {\"scenario\": \"%s\", \"allocator\": \"%s\", \"runs_us\": [", scenarioNames[r.scenario], allocatorNames[r.allocator] );
+			for ( size_t j=0; j<r.runs.size(); ++j )
+				fprintf( f, "%s%lld", j ? ", " : "", (long long)(r.runs[j]) );
+			fprintf( f, "], \"min_us\": %lld, \"median_us\": %lld, \"mean_us\": %.1f, \"median_ns_per_op\": %.3f, ", (long long)(r.minDur), (long long)(r.medianDur), r.meanDur, nsPerOp( r.medianDur, p ) );
+			fprintf( f, "\"peak_rss_growth_kb\": %zu, \"peak_live_kb\": %zu, \"bytes_per_live_byte\": %.3f, \"minor_faults\": %.1f, \"major_faults\": %.1f, \"map_calls\": %.1f, \"unmap_calls\": %.1f, \"protect_calls\": %.1f}%s\n", r.maxPeakRssGrowth >> 10, r.peakLiveBytes >> 10, r.bytesPerLiveByte, r.meanMinorFaults, r.meanMajorFaults, r.meanSysMapCalls, r.meanSysUnmapCalls, r.meanSysProtectCalls, i + 1 < results.size() ? "," : "" );
+		}
+		fprintf( f, "  ]\n}\n" );
+	}
+	else if ( strcmp( format, "csv" ) == 0 )
+	{
+		fprintf( f, "scenario,allocator,ops,threads,repeat,min_us,median_us,mean_us,median_ns_per_op,peak_rss_growth_kb,peak_live_kb,bytes_per_live_byte,minor_faults,major_faults,map_calls,unmap_calls,protect_calls\n" );
+		for ( const BenchResult& r : results )
+			fprintf( f, "%s,%s,%zu,%zu,%zu,%lld,%lld,%.1f,%.3f,%zu,%zu,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f\n", scenarioNames[r.scenario], allocatorNames[r.allocator], p.opCount, p.threadCount, r.runs.size(), (long long)(r.minDur), (long long)(r.medianDur), r.meanDur, nsPerOp( r.medianDur, p ), 
+				r.maxPeakRssGrowth >> 10, r.peakLiveBytes >> 10, r.bytesPerLiveByte, r.meanMinorFaults, r.meanMajorFaults, r.meanSysMapCalls, r.meanSysUnmapCalls, r.meanSysProtectCalls );
+	}
+	else
+	{
+		for ( const BenchResult& r : results )
+			fprintf( f, "%-18s %-16s min %10lld us, median %10lld us, mean %12.1f us, %8.3f ns/op; peak rss +%zu KB (%.3f per live byte), faults %.0f/%.0f, map/unmap/protect %.0f/%.0f/%.0f\n", scenarioNames[r.scenario], allocatorNames[r.allocator], (long long)(r.minDur), (long long)(r.medianDur), r.meanDur, nsPerOp( r.medianDur, p ), 
+				r.maxPeakRssGrowth >> 10, r.bytesPerLiveByte, r.meanMinorFaults, r.meanMajorFaults, r.meanSysMapCalls, r.meanSysUnmapCalls, r.meanSysProtectCalls );
+	}
+}
+
+bool findName( const char* name, const char* const* names, size_t count, size_t& idx )
+{
+	for ( idx=0; idx<count; ++idx )
+		if ( strcmp( name, names[idx] ) == 0 )
+			return true;
+	return false;
+}
+
+int main( int argc, char** argv )
+{
+	nodecpp::log::Log log;
+	log.level = nodecpp::log::LogLevel::info;
+	log.add( stderr ); // stdout is reserved for results
+	nodecpp::logging_impl::currentLog = &log;
+
+	BenchParams p;
+	std::vector<size_t> scenarios;
+	std::vector<size_t> allocators;
+	const char* format = "text";
+	const char* outFile = nullptr;
+
+	for ( int i=1; i<argc; ++i )
+	{
+		bool hasValue = i + 1 < argc;
+		size_t idx;
+		if ( strcmp( argv[i], "--list" ) == 0 )
+		{
+			for ( size_t j=0; j<SCENARIO_COUNT; ++j )
+				printf( "scenario: %s\n", scenarioNames[j] );
+			for ( size_t j=0; j<ALLOCATOR_COUNT; ++j )
+				printf( "allocator: %s\n", allocatorNames[j] );
+			return 0;
+		}
+		else if ( strcmp( argv[i], "--scenario" ) == 0 && hasValue && findName( argv[i+1], scenarioNames, SCENARIO_COUNT, idx ) )
+			scenarios.push_back( idx );
+		else if ( strcmp( argv[i], "--allocator" ) == 0 && hasValue && findName( argv[i+1], allocatorNames, ALLOCATOR_COUNT, idx ) )
+			allocators.push_back( idx );
+		else if ( strcmp( argv[i], "--ops" ) == 0 && hasValue )
+			p.opCount = strtoull( argv[i+1], nullptr, 10 );
+		else if ( strcmp( argv[i], "--threads" ) == 0 && hasValue )
+			p.threadCount = strtoull( argv[i+1], nullptr, 10 );
+		else if ( strcmp( argv[i], "--repeat" ) == 0 && hasValue )
+			p.repeatCount = strtoull( argv[i+1], nullptr, 10 );
+		else if ( strcmp( argv[i], "--warmup" ) == 0 && hasValue )
+			p.warmupCount = strtoull( argv[i+1], nullptr, 10 );
+		else if ( strcmp( argv[i], "--format" ) == 0 && hasValue && ( strcmp( argv[i+1], "text" ) == 0 || strcmp( argv[i+1], "json" ) == 0 || strcmp( argv[i+1], "csv" ) == 0 ) )
+			format = argv[i+1];
+		else if ( strcmp( argv[i], "--out" ) == 0 && hasValue )
+			outFile = argv[i+1];
+		else
+		{
+			nodecpp::log::default_log::info( "unexpected or invalid argument '{}'; use --list to see scenario and allocator names", argv[i] );
+			return 1;
+		}
+		++i;
+	}
+	if ( p.threadCount == 0 || p.threadCount > max_threads || p.repeatCount == 0 || p.opCount == 0 )
+	{
+		nodecpp::log::default_log::info( "invalid parameters: threads must be in [1, {}], repeat and ops must be non-zero", max_threads );
+		return 1;
+	}
+	if ( scenarios.empty() )
+		for ( size_t j=0; j<SCENARIO_COUNT; ++j )
+			scenarios.push_back( j );
+	if ( allocators.empty() )
+		for ( size_t j=0; j<ALLOCATOR_COUNT; ++j )
+			allocators.push_back( j );
+
+	std::vector<Scratch> scratch( p.threadCount );
+	for ( size_t i=0; i<p.threadCount; ++i )
+	{
+		scratch[i].slots = new void* [scratchSlotCount];
+		scratch[i].sizes = new size_t [scratchSlotCount];
+	}
+
+	std::vector<BenchResult> results;
+	for ( size_t scenario : scenarios )
+		for ( size_t allocator : allocators )
+		{
+			nodecpp::log::default_log::info( "running {} with {}...", scenarioNames[scenario], allocatorNames[allocator] );
+			BenchResult r;
+			r.scenario = scenario;
+			r.allocator = allocator;
+			for ( size_t i=0; i<p.warmupCount; ++i )
+				runOnce( allocator, scenario, p, scratch );
+			for ( size_t i=0; i<p.repeatCount; ++i )
+				r.measurements.push_back( runOnce( allocator, scenario, p, scratch ) );
+			computeSummary( r );
+			results.push_back( r );
+		}
+
+	for ( size_t i=0; i<p.threadCount; ++i )
+	{
+		delete [] scratch[i].slots;
+		delete [] scratch[i].sizes;
+	}
+
+	FILE* f = stdout;
+	if ( outFile != nullptr )
+	{
+		f = fopen( outFile, "w" );
+		if ( f == nullptr )
+		{
+			nodecpp::log::default_log::info( "failed to open {}", outFile );
+			return 1;
+		}
+	}
+	printResults( f, format, results, p );
+	if ( f != stdout )
+		fclose( f );
+	return 0;
+}
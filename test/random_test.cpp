@@ -33,6 +33,13 @@
 
 
 #include "random_test.h"
+#include "../src/iibmalloc_stl.h"
+#include "../src/object_pool.h"
+
+#include <map>
+#include <list>
+#include <vector>
+#include <stdexcept>
 
 thread_local unsigned long long rnd_seed = 0;
 
@@ -130,6 +137,8 @@ void doTest( TestStartupParamsAndResults* startupParams )
 		testParams[i].threadResPerThreadAlloc = startupParams->testRes->threadResPerThreadAlloc + i;
 	}
 
+	ResetPeakRss(); // peak RSS is process-wide; resetting it from within threads would drop peaks of those already running
+
 	// run thread
 	for ( size_t i=0; i<testThreadCount; ++i )
 	{
@@ -211,6 +220,56 @@ void runComparisonTest( TestStartupParamsAndResults& params )
 	params.startupParams.allocatorType = allocatorType; // restore
 }
 
+// large chunks are split from free chunks of bulk allocator blocks and merged back with their free neighbours
+void largeChunkSplitMergeTest()
+{
+	static constexpr size_t chunkCnt = 0x100;
+	uint8_t* ptrs[chunkCnt] = {};
+	size_t sizes[chunkCnt];
+	uint8_t fills[chunkCnt];
+
+	ThreadLocalAllocatorT allocManager;
+	for ( size_t round=0; round<12; ++round )
+	{
+		for ( size_t i=0; i<chunkCnt; ++i )
+			if ( ptrs[i] == nullptr )
+			{
+				sizes[i] = ( 3 + ( i * 7 + round * 5 ) % 29 ) * PAGE_SIZE_BYTES - 64;
+				fills[i] = (uint8_t)( i + round );
+				ptrs[i] = reinterpret_cast<uint8_t*>( allocManager.allocate( sizes[i] ) );
+				memset( ptrs[i], fills[i], sizes[i] );
+			}
+		// chunks do not overlap
+		for ( size_t i=0; i<chunkCnt; ++i )
+			for ( size_t j=0; j<sizes[i]; j+=64 )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ptrs[i][j] == fills[i] );
+		// different patterns make free chunks merge with the previous, the next, or both neighbours
+		for ( size_t i=0; i<chunkCnt; ++i )
+		{
+			bool release = round % 3 == 0 ? i % 2 == 1 : ( round % 3 == 1 ? i % 3 != 0 : ( i * 5 + round ) % 4 == 0 );
+			if ( release )
+			{
+				allocManager.deallocate( ptrs[i] );
+				ptrs[i] = nullptr;
+			}
+		}
+	}
+	for ( size_t i=0; i<chunkCnt; ++i )
+		allocManager.deallocate( ptrs[i] );
+
+	// all of it has been merged back, so chunks of the maximal size can be split from it again
+	for ( size_t i=0; i<chunkCnt; ++i )
+	{
+		ptrs[i] = reinterpret_cast<uint8_t*>( allocManager.allocate( 31 * PAGE_SIZE_BYTES ) );
+		memset( ptrs[i], (uint8_t)i, 31 * PAGE_SIZE_BYTES );
+	}
+	for ( size_t i=0; i<chunkCnt; ++i )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ptrs[i][31 * PAGE_SIZE_BYTES - 1] == (uint8_t)i );
+		allocManager.deallocate( ptrs[i] );
+	}
+}
+
 void alignedAllocTest()
 {
 	IibAllocatorBase::dbgImplementationConsistencyChecks();
@@ -244,6 +303,19 @@ void alignedAllocTest()
 		allocManager.deallocate(ptrs[i]);
 	}
 
+	// large chunks are aligned as well
+	for ( size_t i=0; i<testCnt / 16; ++i )
+	{
+		size_t sz = PAGE_SIZE_BYTES * 2 + 1 + i * 0x400;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !IibAllocatorBase::isBucketSize( sz ) );
+		ptrs[i] = allocManager.allocateAligned<32>( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( (uintptr_t)(ptrs[i]) & 31 ) == 0 );
+	}
+	for ( size_t i=0; i<testCnt / 16; ++i )
+	{
+		allocManager.deallocate(ptrs[i]);
+	}
+
 	for ( size_t i=0; i<testCnt; ++i )
 	{
 		ptrs[i] = allocManager.allocateAligned<16>(22);
@@ -300,6 +372,1288 @@ void alignedAllocTest()
 	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, formerAlloc == &allocManager );
 }
 
+void stlAdaptersTest()
+{
+	struct alignas(32) Aligned
+	{
+		uint8_t data[64];
+	};
+	constexpr size_t itemCnt = 500;
+	auto isAligned = []( const void* ptr ) { return ( (uintptr_t)ptr & ( alignof(Aligned) - 1 ) ) == 0; };
+
+	ThreadLocalAllocatorT allocManager;
+	ThreadLocalAllocatorT* formerAlloc = setCurrneAllocator( &allocManager );
+	{
+		std::map<size_t, Aligned, std::less<size_t>, IibStlAllocator<std::pair<const size_t, Aligned>>> m;
+		std::list<Aligned, IibStlAllocator<Aligned>> l;
+		std::vector<Aligned, IibStlAllocator<Aligned>> v; // grows from bucket sizes to large chunks
+		for ( size_t i=0; i<itemCnt; ++i )
+		{
+			Aligned item;
+			memset( item.data, (uint8_t)i, sizeof( item.data ) );
+			m.emplace( i, item );
+			l.push_back( item );
+			v.push_back( item );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isAligned( &( m[i] ) ) && isAligned( &( l.back() ) ) && isAligned( v.data() ) );
+		}
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !IibAllocatorBase::isBucketSize( v.capacity() * sizeof( Aligned ) ) );
+		size_t i = 0;
+		for ( const Aligned& item : l )
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, item.data[0] == (uint8_t)i && m[i].data[63] == (uint8_t)i && v[i].data[31] == (uint8_t)i );
+			++i;
+		}
+	}
+	{
+		IibMemoryResource<ThreadLocalAllocatorT> resource( allocManager );
+		std::pmr::map<size_t, Aligned> m( &resource );
+		std::pmr::list<Aligned> l( &resource );
+		std::pmr::vector<Aligned> v( &resource );
+		for ( size_t i=0; i<itemCnt; ++i )
+		{
+			Aligned item;
+			memset( item.data, (uint8_t)i, sizeof( item.data ) );
+			m.emplace( i, item );
+			l.push_back( item );
+			v.push_back( item );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isAligned( &( m[i] ) ) && isAligned( &( l.back() ) ) && isAligned( v.data() ) );
+		}
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !IibAllocatorBase::isBucketSize( v.capacity() * sizeof( Aligned ) ) );
+		size_t i = 0;
+		for ( const Aligned& item : l )
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, item.data[0] == (uint8_t)i && m[i].data[63] == (uint8_t)i && v[i].data[31] == (uint8_t)i );
+			++i;
+		}
+	}
+	formerAlloc = setCurrneAllocator( formerAlloc );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, formerAlloc == &allocManager );
+}
+
+struct PoolTestObject
+{
+	static inline size_t liveCount = 0;
+	static inline size_t throwAt = SIZE_MAX; // the constructor throws when liveCount reaches it
+	uint64_t value;
+	PoolTestObject( uint64_t value_ ) : value( value_ )
+	{
+		if ( liveCount == throwAt )
+			throw std::runtime_error( "PoolTestObject" );
+		++liveCount;
+	}
+	~PoolTestObject() { --liveCount; }
+};
+
+template<size_t sz, size_t alignment>
+struct alignas(alignment) PoolTestBlob
+{
+	uint8_t data[sz];
+};
+
+void objectPoolTest()
+{
+	constexpr size_t objCnt = 0x400;
+	ThreadLocalAllocatorT allocManager;
+	ThreadLocalAllocatorT* formerAlloc = setCurrneAllocator( &allocManager );
+
+	// make() and destroy(); a block released by destroy() is the first to be reused
+	{
+		ObjectPool<PoolTestObject> pool( allocManager );
+		PoolTestObject* objs[objCnt];
+		for ( size_t i=0; i<objCnt; ++i )
+			objs[i] = pool.make( i );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, PoolTestObject::liveCount == objCnt );
+		for ( size_t i=0; i<objCnt; ++i )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, objs[i]->value == i );
+		PoolTestObject* last = objs[objCnt - 1];
+		pool.destroy( last );
+		objs[objCnt - 1] = pool.make( 0 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, objs[objCnt - 1] == last );
+		pool.destroyMany( objs, objCnt );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, PoolTestObject::liveCount == 0 );
+
+		// with the current allocator
+		PoolTestObject* obj = make<PoolTestObject>( 17 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, obj->value == 17 && PoolTestObject::liveCount == 1 );
+		destroy( obj );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, PoolTestObject::liveCount == 0 );
+
+		// a throwing constructor leaves nothing behind
+		PoolTestObject::throwAt = 0;
+		bool thrown = false;
+		try { pool.make( 0 ); } catch ( const std::runtime_error& ) { thrown = true; }
+		PoolTestObject::throwAt = SIZE_MAX;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, thrown && PoolTestObject::liveCount == 0 );
+	}
+
+	// makeMany() of bucket-sized objects; if a constructor throws, objects made so far are destroyed, and all blocks are released
+	{
+		ObjectPool<PoolTestObject> pool( allocManager );
+		PoolTestObject* objs[objCnt];
+		pool.makeMany( objs, objCnt, 5 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, PoolTestObject::liveCount == objCnt );
+		for ( size_t i=0; i<objCnt; ++i )
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, objs[i]->value == 5 );
+			objs[i]->value = i;
+		}
+		for ( size_t i=0; i<objCnt; ++i )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, objs[i]->value == i );
+		pool.destroyMany( objs, objCnt );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, PoolTestObject::liveCount == 0 );
+
+		PoolTestObject::throwAt = objCnt / 2;
+		bool thrown = false;
+		try { pool.makeMany( objs, objCnt, 5 ); } catch ( const std::runtime_error& ) { thrown = true; }
+		PoolTestObject::throwAt = SIZE_MAX;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, thrown && PoolTestObject::liveCount == 0 );
+		PoolTestObject* obj = pool.make( 0 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, std::find( objs, objs + objCnt, obj ) != objs + objCnt );
+		pool.destroy( obj );
+	}
+
+	// objects above MaxBucketSize
+	{
+		using LargeT = PoolTestBlob<0x5000, ALIGNMENT>;
+		constexpr size_t largeCnt = 8;
+		ObjectPool<LargeT> pool( allocManager );
+		LargeT* objs[largeCnt];
+		pool.makeMany( objs, largeCnt );
+		for ( size_t i=0; i<largeCnt; ++i )
+			memset( objs[i]->data, (uint8_t)i, sizeof( objs[i]->data ) );
+		for ( size_t i=0; i<largeCnt; ++i )
+			for ( size_t j=0; j<sizeof( objs[i]->data ); ++j )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, objs[i]->data[j] == (uint8_t)i );
+		pool.destroyMany( objs, largeCnt );
+	}
+
+	// over-aligned objects, of bucket sizes and above
+	{
+		using AlignedT = PoolTestBlob<40, 32>;
+		ObjectPool<AlignedT> pool( allocManager );
+		AlignedT* objs[objCnt];
+		pool.makeMany( objs, objCnt / 2 );
+		for ( size_t i=objCnt / 2; i<objCnt; ++i )
+			objs[i] = pool.make();
+		for ( size_t i=0; i<objCnt; ++i )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( (uintptr_t)( objs[i] ) & 31 ) == 0 );
+		pool.destroyMany( objs, objCnt );
+
+		using LargeAlignedT = PoolTestBlob<0x5000, 32>;
+		ObjectPool<LargeAlignedT> largePool( allocManager );
+		LargeAlignedT* large[2];
+		largePool.makeMany( large, 2 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( (uintptr_t)( large[0] ) & 31 ) == 0 && ( (uintptr_t)( large[1] ) & 31 ) == 0 );
+		largePool.destroyMany( large, 2 );
+	}
+
+	formerAlloc = setCurrneAllocator( formerAlloc );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, formerAlloc == &allocManager );
+}
+
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+void zombieSetTest()
+{
+	ThreadLocalAllocatorT allocManager;
+	constexpr size_t smallCnt = 0x400;
+	constexpr size_t smallSz = 100;
+	constexpr size_t largeCnt = 8;
+	constexpr size_t largeSz = 100000;
+	uint8_t* small[smallCnt];
+	uint8_t* large[largeCnt];
+	for ( size_t i=0; i<smallCnt; ++i )
+		small[i] = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( smallSz ) );
+	for ( size_t i=0; i<largeCnt; ++i )
+		large[i] = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( largeSz ) );
+	for ( size_t i=0; i<smallCnt; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( small[i] ) );
+
+	// every other block becomes a zombie; neighbours must not be affected
+	for ( size_t i=0; i<smallCnt; i+=2 )
+		allocManager.zombieableDeallocate( small[i] );
+	for ( size_t i=0; i<largeCnt; i+=2 )
+		allocManager.zombieableDeallocate( large[i] );
+	for ( size_t i=0; i<smallCnt; ++i )
+	{
+		bool isZombie = i % 2 == 0;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( small[i] ) != isZombie );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( small[i] + smallSz / 2 ) != isZombie );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( small[i] + smallSz - 1 ) != isZombie );
+	}
+	for ( size_t i=0; i<largeCnt; ++i )
+	{
+		bool isZombie = i % 2 == 0;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( large[i] ) != isZombie );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( large[i] + largeSz / 2 ) != isZombie ); // on a page other than the chunk header
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( large[i] + largeSz - 1 ) != isZombie );
+	}
+	int dummy = 0;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( &dummy ) ); // not from this heap at all
+
+	allocManager.killAllZombies();
+	for ( size_t i=0; i<smallCnt; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( small[i] + smallSz / 2 ) );
+	for ( size_t i=0; i<largeCnt; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( large[i] + largeSz / 2 ) );
+
+	// released memory may be reused; a fresh block is never reported as a zombie
+	for ( size_t i=0; i<smallCnt; i+=2 )
+	{
+		small[i] = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( smallSz ) );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( small[i] ) );
+	}
+	for ( size_t i=0; i<smallCnt; ++i )
+		allocManager.zombieableDeallocate( small[i] );
+	for ( size_t i=1; i<largeCnt; i+=2 )
+		allocManager.zombieableDeallocate( large[i] );
+	allocManager.killAllZombies();
+}
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+
+void zombieQuarantineTest()
+{
+	ThreadLocalAllocatorT allocManager;
+	constexpr size_t smallSz = 100;
+	constexpr size_t cnt = 10;
+	constexpr size_t keptCnt = 4;
+
+	allocManager.zombieableDeallocate( allocManager.zombieableAllocate( smallSz ) );
+	size_t unit = allocManager.getZombieBytes(); // as rounded up to bucket size
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, unit >= smallSz );
+	allocManager.killAllZombies();
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() == 0 );
+
+	size_t budget = keptCnt * unit;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.setZombieQuarantineBudget( budget ) == 0 );
+	uint8_t* ptrs[cnt];
+	for ( size_t i=0; i<cnt; ++i )
+		ptrs[i] = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( smallSz ) );
+	for ( size_t i=0; i<cnt; ++i )
+	{
+		allocManager.zombieableDeallocate( ptrs[i] );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() == std::min( i + 1, keptCnt ) * unit );
+	}
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	// oldest go first
+	for ( size_t i=0; i<cnt; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( ptrs[i] + 1 ) == ( i < cnt - keptCnt ) );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+
+	// released blocks are reused, zombies are not
+	uint8_t* reused = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( smallSz ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, std::find( ptrs, ptrs + cnt - keptCnt, reused ) != ptrs + cnt - keptCnt );
+	allocManager.zombieableDeallocate( reused );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() == budget );
+
+	// a large chunk above the budget cannot be kept at all
+	uint8_t* large = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( 100000 ) );
+	allocManager.zombieableDeallocate( large );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() <= budget );
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( large + 50000 ) );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+
+	// lowering the budget releases immediately; 0 turns the limit off
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.setZombieQuarantineBudget( unit ) == budget );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() <= unit );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.setZombieQuarantineBudget( 0 ) == unit );
+	size_t before = allocManager.getZombieBytes();
+	for ( size_t i=0; i<cnt; ++i )
+		allocManager.zombieableDeallocate( allocManager.zombieableAllocate( smallSz ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() == before + cnt * unit );
+
+	allocManager.killAllZombies();
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() == 0 );
+}
+
+void zombieReclamationTest()
+{
+	ThreadLocalAllocatorT allocManager;
+	constexpr size_t smallSz = 100;
+	constexpr size_t markedCnt = 16;
+	constexpr size_t laterCnt = 8;
+	constexpr size_t step = 3;
+	uint8_t* marked[markedCnt];
+	uint8_t* later[laterCnt];
+
+	for ( size_t i=0; i<markedCnt; ++i )
+		marked[i] = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( smallSz ) );
+	for ( size_t i=0; i<markedCnt; ++i )
+		allocManager.zombieableDeallocate( marked[i] );
+	size_t unit = allocManager.getZombieBytes() / markedCnt;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.hasZombiesPendingReclamation() );
+	allocManager.markZombiesForReclamation();
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.hasZombiesPendingReclamation() );
+
+	// zombies created after the mark are not affected
+	for ( size_t i=0; i<laterCnt; ++i )
+		later[i] = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( i == 0 ? 100000 : smallSz ) );
+	for ( size_t i=0; i<laterCnt; ++i )
+		allocManager.zombieableDeallocate( later[i] );
+	size_t zombieBytes = allocManager.getZombieBytes();
+
+	// partial draining stops at maxItems
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.reclaimZombies( step ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() == zombieBytes - step * unit );
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	size_t releasedCnt = 0;
+	for ( size_t i=0; i<markedCnt; ++i )
+		if ( allocManager.isPointerNotZombie( marked[i] ) )
+			++releasedCnt;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, releasedCnt == step );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.reclaimZombies( 0 ) );
+
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.reclaimZombies( markedCnt ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.hasZombiesPendingReclamation() );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() == zombieBytes - markedCnt * unit );
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	for ( size_t i=0; i<markedCnt; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( marked[i] ) );
+	for ( size_t i=0; i<laterCnt; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.isPointerNotZombie( later[i] ) );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+
+	// the second mark picks up the rest, including the large chunk
+	allocManager.markZombiesForReclamation();
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.reclaimZombies( laterCnt ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getZombieBytes() == 0 );
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	for ( size_t i=0; i<laterCnt; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isPointerNotZombie( later[i] ) );
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	allocManager.killAllZombies();
+}
+
+void retireTest()
+{
+	ThreadLocalAllocatorT allocManager;
+	constexpr size_t sz = 48;
+	constexpr size_t reclaimAttempts = 8; // an epoch may advance at each attempt; far more than needed
+
+	std::atomic<int> readerState = 0; // 1: in critical section; 2: asked to leave; 3: left
+	std::thread reader( [&readerState]() {
+		ThreadLocalAllocatorT readerAlloc;
+		readerAlloc.enterEpoch();
+		readerState = 1;
+		while ( readerState != 2 )
+			std::this_thread::yield();
+		readerAlloc.exitEpoch();
+		readerState = 3;
+	} );
+	while ( readerState != 1 )
+		std::this_thread::yield();
+
+	uint8_t* retired = reinterpret_cast<uint8_t*>( allocManager.allocate( sz ) );
+	memset( retired, 0x5a, sz );
+	allocManager.retire( retired );
+	for ( size_t i=0; i<reclaimAttempts; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.reclaimRetired() );
+	// still not released, thus neither reused nor modified
+	void* other[reclaimAttempts];
+	for ( size_t i=0; i<reclaimAttempts; ++i )
+	{
+		other[i] = allocManager.allocate( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, other[i] != retired );
+	}
+	for ( size_t i=0; i<sz; ++i )
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, retired[i] == 0x5a );
+	for ( size_t i=0; i<reclaimAttempts; ++i )
+		allocManager.deallocate( other[i] );
+
+	readerState = 2;
+	while ( readerState != 3 )
+		std::this_thread::yield();
+	reader.join();
+
+	bool released = false;
+	for ( size_t i=0; i<reclaimAttempts && !released; ++i )
+		released = allocManager.reclaimRetired();
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, released );
+	void* reused = allocManager.allocate( sz ); // free lists are LIFO
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reused == retired );
+	allocManager.deallocate( reused );
+}
+
+#ifdef NODECPP_IIBMALLOC_OUT_OF_BAND_ZOMBIE_LINKS
+// with no prefix, a zombieable block of a bucket size takes a block of exactly that bucket
+void outOfBandZombieLinksTest()
+{
+	static_assert( guaranteed_prefix_size == 0 );
+	ThreadLocalAllocatorT allocManager;
+	for ( size_t sz : { 32, 64, 128, 256, 1024 } )
+	{
+		void* ptr = allocManager.zombieableAllocate( sz );
+		uint8_t* bytes = reinterpret_cast<uint8_t*>(ptr);
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.isZombieablePointerInBlock( ptr, bytes + sz - 1 ) );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.isZombieablePointerInBlock( ptr, bytes + sz ), "{}", sz );
+		allocManager.zombieableDeallocate( ptr );
+
+		// a freed block of the same size is reused as is (free lists are LIFO)...
+		void* plain = allocManager.allocate( sz );
+		allocManager.deallocate( plain );
+		ptr = allocManager.zombieableAllocate( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ptr == plain, "{}", sz );
+
+		// ...and a zombie, once released, returns to that same bucket intact
+		memset( ptr, 0x5a, sz );
+		allocManager.zombieableDeallocate( ptr );
+		for ( size_t i=0; i<sz; ++i )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<uint8_t*>(ptr)[i] == 0x5a );
+		allocManager.killAllZombies();
+		plain = allocManager.allocate( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, plain == ptr, "{}", sz );
+		allocManager.deallocate( plain );
+	}
+}
+#endif // NODECPP_IIBMALLOC_OUT_OF_BAND_ZOMBIE_LINKS
+
+// a list of blocks of all kinds (bucket blocks, bulk chunks, separately reserved large chunks) with known contents
+struct ImageTestNode
+{
+	ImageTestNode* next;
+	size_t sz;
+	uint8_t fill;
+};
+constexpr size_t imageTestNodeCount = 64;
+constexpr const char* imageTestFileName = "test_iibmalloc_heap.img";
+
+ImageTestNode* buildImageTestList( ThreadLocalAllocatorT& allocManager )
+{
+	constexpr size_t sizes[] = { sizeof(ImageTestNode), 100, 3000, 20000, 300000, 9 << 20 };
+	ImageTestNode* head = nullptr;
+	void* garbage[imageTestNodeCount];
+	for ( size_t i=0; i<imageTestNodeCount; ++i )
+	{
+		size_t sz = sizes[ i % (sizeof(sizes)/sizeof(sizes[0])) ];
+		ImageTestNode* node = reinterpret_cast<ImageTestNode*>( allocManager.allocate( sz ) );
+		node->next = head;
+		node->sz = sz;
+		node->fill = (uint8_t)( i + 1 );
+		memset( node + 1, node->fill, sz - sizeof(ImageTestNode) );
+		head = node;
+		garbage[i] = allocManager.allocate( sz ); // so that the heap has free blocks in between
+	}
+	for ( size_t i=0; i<imageTestNodeCount; ++i )
+		allocManager.deallocate( garbage[i] );
+	return head;
+}
+
+// adds delta to the contents of each node
+void modifyImageTestList( ImageTestNode* head, uint8_t delta )
+{
+	for ( ImageTestNode* node = head; node != nullptr; node = node->next )
+	{
+		node->fill += delta;
+		memset( node + 1, node->fill, node->sz - sizeof(ImageTestNode) );
+	}
+}
+
+void verifyImageTestList( const ImageTestNode* head, uint8_t delta = 0 )
+{
+	size_t cnt = 0;
+	for ( const ImageTestNode* node = head; node != nullptr; node = node->next, ++cnt )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, node->fill == (uint8_t)( imageTestNodeCount - cnt + delta ) );
+		const uint8_t* data = reinterpret_cast<const uint8_t*>( node + 1 );
+		for ( size_t i=0; i<node->sz - sizeof(ImageTestNode); ++i )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, data[i] == node->fill );
+	}
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, cnt == imageTestNodeCount );
+}
+
+void freeImageTestList( ThreadLocalAllocatorT& allocManager, ImageTestNode* head )
+{
+	while ( head != nullptr )
+	{
+		ImageTestNode* next = head->next;
+		allocManager.deallocate( head );
+		head = next;
+	}
+}
+
+void serializeTest()
+{
+	ImageTestNode* head;
+	void* tail;
+	{
+		ThreadLocalAllocatorT allocManager;
+		head = buildImageTestList( allocManager );
+		tail = allocManager.allocate( 64 );
+		allocManager.setUserPtr( 0, head );
+		allocManager.setUserPtr( 1, tail );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.serialize( imageTestFileName ) );
+	}
+
+	ThreadLocalAllocatorT allocManager;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.deserialize( imageTestFileName ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 0 ) == head );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 1 ) == tail );
+	verifyImageTestList( head );
+
+	// the restored heap is fully functional
+	void* more[imageTestNodeCount];
+	for ( size_t i=0; i<imageTestNodeCount; ++i )
+	{
+		more[i] = allocManager.allocate( 1000 );
+		memset( more[i], 0xff, 1000 );
+	}
+	verifyImageTestList( head );
+	for ( size_t i=0; i<imageTestNodeCount; ++i )
+		allocManager.deallocate( more[i] );
+	allocManager.deallocate( tail );
+	freeImageTestList( allocManager, head );
+	remove( imageTestFileName );
+}
+
+void regionTest()
+{
+	using RegionT = Region<ThreadLocalAllocatorT>;
+	constexpr size_t sz = 13 * ALIGNMENT; // so that blocks go one right after another
+	constexpr size_t blocksPerPage = RegionT::maxInPageSize / sz;
+	constexpr size_t pageCnt = 3;
+	constexpr size_t blockCnt = blocksPerPage * pageCnt;
+	uint8_t* blocks[blockCnt];
+	auto verifyBlocks = [&]( size_t skip ) {
+		for ( size_t i=0; i<blockCnt; ++i )
+			for ( size_t j=( i == skip ? sizeof(void*) : 0 ); j<sz; ++j )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, blocks[i][j] == (uint8_t)i );
+	};
+
+	{
+		ThreadLocalAllocatorT allocManager;
+		ThreadLocalAllocatorT* formerAlloc = setCurrneAllocator( &allocManager );
+		RegionT region( allocManager );
+
+		// blocks are bump-allocated, a page after a page
+		for ( size_t i=0; i<blockCnt; ++i )
+		{
+			blocks[i] = reinterpret_cast<uint8_t*>( region.allocate( sz ) );
+			memset( blocks[i], (uint8_t)i, sz );
+			if ( i % blocksPerPage != 0 )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, blocks[i] == blocks[i - 1] + sz );
+		}
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, region.getPageCount() == pageCnt );
+		void* aligned = region.allocateAligned<32>( 40 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( (uintptr_t)aligned & 31 ) == 0 );
+
+		// large blocks are ordinary blocks of the allocator
+		size_t pageCntBeforeLarge = region.getPageCount();
+		uint8_t* large = reinterpret_cast<uint8_t*>( region.allocate( RegionT::maxInPageSize + 1 ) );
+		memset( large, 0x5a, RegionT::maxInPageSize + 1 );
+		void* largeAligned = region.allocateAligned<32>( 0x10000 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( (uintptr_t)largeAligned & 31 ) == 0 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, region.getPageCount() <= pageCntBeforeLarge + 1 ); // a page for the list of large blocks at most
+
+		// deallocating a block of a region makes nothing reusable, and modifies nothing but (with operator delete) its first word
+		region.deallocate( blocks[0] );
+		::operator delete( blocks[1] );
+		void* others[blockCnt];
+		for ( size_t i=0; i<blockCnt; ++i )
+		{
+			others[i] = allocManager.allocate( sz );
+			memset( others[i], 0xff, sz );
+		}
+		for ( size_t i=0; i<blockCnt; ++i )
+			for ( size_t j=0; j<blockCnt; ++j )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, others[i] != blocks[j] );
+		verifyBlocks( 1 );
+		for ( size_t i=0; i<blockCnt; ++i )
+			allocManager.deallocate( others[i] );
+
+		// reset() releases large blocks and keeps pages for next regions, which take them in the same order
+		region.reset();
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, region.getPageCount() == 0 );
+		for ( size_t i=0; i<blockCnt; ++i )
+		{
+			uint8_t* block = reinterpret_cast<uint8_t*>( region.allocate( sz ) );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, block == blocks[i] );
+			memset( block, (uint8_t)i, sz );
+		}
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, region.getPageCount() == pageCnt );
+
+		// a heap is serialized with a live region
+		allocManager.setUserPtr( 0, blocks[0] );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.serialize( imageTestFileName ) );
+		formerAlloc = setCurrneAllocator( formerAlloc );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, formerAlloc == &allocManager );
+	}
+
+	// blocks of the region are restored as used memory, and a new region does not take their pages
+	ThreadLocalAllocatorT allocManager;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.deserialize( imageTestFileName ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 0 ) == blocks[0] );
+	verifyBlocks( blockCnt );
+	{
+		RegionT region( allocManager );
+		for ( size_t i=0; i<blockCnt; ++i )
+		{
+			uint8_t* block = reinterpret_cast<uint8_t*>( region.allocate( sz ) );
+			for ( size_t j=0; j<blockCnt; ++j )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, block != blocks[j] );
+			memset( block, 0xff, sz );
+		}
+		verifyBlocks( blockCnt );
+	}
+	remove( imageTestFileName );
+}
+
+void checkpointTest()
+{
+	const char* fileNames[] = { "test_iibmalloc_heap.0.img", "test_iibmalloc_heap.1.img", "test_iibmalloc_heap.2.img" };
+	ImageTestNode* head;
+	void* extra[3];
+	{
+		ThreadLocalAllocatorT allocManager;
+		head = buildImageTestList( allocManager );
+		allocManager.setUserPtr( 0, head );
+		for ( size_t k=0; k<3; ++k )
+		{
+			if ( k == 1 )
+				modifyImageTestList( head, 1 ); // all pages modified
+			// at k == 2 only a few pages are modified; with soft-dirty bits the rest is taken from previous checkpoints
+			extra[k] = allocManager.allocate( 64 );
+			allocManager.setUserPtr( 1, extra[k] );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.checkpoint( fileNames[k] ) );
+		}
+		// an image written by serialize() is not a part of any chain
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.serialize( imageTestFileName ) );
+	}
+
+	// a chain must be complete and in order
+	const char* gapped[] = { fileNames[0], fileNames[2] };
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !compactHeapImages( gapped, 2, imageTestFileName ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !compactHeapImages( fileNames + 1, 2, imageTestFileName ) );
+	const char* foreign[] = { imageTestFileName, fileNames[1] };
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !compactHeapImages( foreign, 2, imageTestFileName ) );
+
+	// a prefix of a chain gives the state at its last checkpoint
+	for ( size_t count=1; count<=3; ++count )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, compactHeapImages( fileNames, count, imageTestFileName ) );
+		ThreadLocalAllocatorT allocManager;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.deserialize( imageTestFileName ) );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 0 ) == head );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 1 ) == extra[count - 1] );
+		verifyImageTestList( head, count == 1 ? 0 : 1 );
+		for ( size_t k=0; k<count; ++k )
+			allocManager.deallocate( extra[k] );
+		freeImageTestList( allocManager, head );
+	}
+
+	for ( size_t k=0; k<3; ++k )
+		remove( fileNames[k] );
+	remove( imageTestFileName );
+}
+
+void relocatingTest()
+{
+	ThreadLocalAllocatorT original;
+	ImageTestNode* head = buildImageTestList( original );
+	void* tail = original.allocate( 64 );
+	original.setUserPtr( 0, head );
+	original.setUserPtr( 1, tail );
+	// locations of 'next' pointers: of the first half recorded with the image, of the rest given on restoring
+	const void* recorded[imageTestNodeCount];
+	const void* given[imageTestNodeCount];
+	size_t recordedCount = 0, givenCount = 0;
+	for ( ImageTestNode* node = head; node != nullptr; node = node->next )
+		if ( recordedCount < imageTestNodeCount / 2 )
+			recorded[recordedCount++] = &node->next;
+		else
+			given[givenCount++] = &node->next;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, original.serialize( imageTestFileName, recorded, recordedCount ) );
+
+	// the original heap is still there, so the image cannot be restored at its addresses
+	ThreadLocalAllocatorT allocManager;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.deserialize( imageTestFileName ) );
+	HeapRelocation relocation;
+	const void* bad = &bad;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !allocManager.deserializeRelocating( imageTestFileName, relocation, &bad, 1 ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.deserializeRelocating( imageTestFileName, relocation, given, givenCount ) );
+
+	ImageTestNode* moved = reinterpret_cast<ImageTestNode*>( allocManager.getUserPtr( 0 ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, moved != head && relocation.translate( head ) == moved );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 1 ) == relocation.translate( tail ) );
+	// all 'next' pointers are fixed: each points to the moved copy of its original target
+	ImageTestNode* node = head;
+	for ( ImageTestNode* m = moved; m != nullptr; m = m->next, node = node->next )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, node != nullptr && m == relocation.translate( node ) && m != node );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( ( reinterpret_cast<uintptr_t>( m ) - reinterpret_cast<uintptr_t>( node ) ) & ( ReservationArena::slotSize - 1 ) ) == 0 );
+	}
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, node == nullptr );
+	verifyImageTestList( moved );
+	verifyImageTestList( head );
+
+	allocManager.deallocate( allocManager.getUserPtr( 1 ) );
+	freeImageTestList( allocManager, moved );
+	original.deallocate( tail );
+	freeImageTestList( original, head );
+	remove( imageTestFileName );
+}
+
+#if defined NODECPP_LINUX
+// large zombies are written to a snapshot even if their pages are protected
+void snapshotTest()
+{
+	constexpr size_t zombieCnt = 8;
+	constexpr size_t zombieSz = 100000;
+	ImageTestNode* head;
+	uint8_t* zombies[zombieCnt];
+	{
+		ThreadLocalAllocatorT allocManager;
+		allocManager.protectLargeZombies( true );
+		head = buildImageTestList( allocManager );
+		allocManager.setUserPtr( 0, head );
+		for ( size_t i=0; i<zombieCnt; ++i )
+		{
+			zombies[i] = reinterpret_cast<uint8_t*>( allocManager.zombieableAllocate( zombieSz ) );
+			memset( zombies[i], (uint8_t)i, zombieSz );
+		}
+		for ( size_t i=0; i<zombieCnt; ++i )
+		{
+			allocManager.zombieableDeallocate( zombies[i] );
+			if ( i == zombieCnt / 2 )
+				allocManager.markZombiesForReclamation(); // some of them are pending reclamation
+		}
+		HeapSnapshot snapshot;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.startSnapshot( imageTestFileName, snapshot ) );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, snapshot.wait() );
+		allocManager.killAllZombies();
+	}
+
+	// zombies are restored as allocated memory
+	ThreadLocalAllocatorT allocManager;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.deserialize( imageTestFileName ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 0 ) == head );
+	verifyImageTestList( head );
+	for ( size_t i=0; i<zombieCnt; ++i )
+	{
+		for ( size_t j=0; j<zombieSz; ++j )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, zombies[i][j] == (uint8_t)i );
+		allocManager.zombieableDeallocate( zombies[i] );
+	}
+	allocManager.killAllZombies();
+	freeImageTestList( allocManager, head );
+	remove( imageTestFileName );
+}
+
+void persistentHeapTest()
+{
+	const char* fileName = "test_iibmalloc_heap.pheap";
+	bool overflowed = ReservationArena::hasOverflowed();
+	remove( fileName );
+	ImageTestNode* head;
+	{
+		ThreadLocalAllocatorT allocManager;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.openPersistentHeap( fileName, ((size_t)1) << 30 ) );
+		head = buildImageTestList( allocManager );
+		allocManager.setUserPtr( 0, head );
+		// blocks in the file are known as iibmalloc ones without giving up the arena check for all other pointers
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ReservationArena::ownerOf( head ) == allocManager.allocatorID() );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ReservationArena::hasOverflowed() == overflowed );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.closePersistentHeap() );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !ReservationArena::contains( head ) );
+	}
+
+	ThreadLocalAllocatorT allocManager;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.openPersistentHeap( fileName, 0 ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 0 ) == head );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ReservationArena::ownerOf( head ) == allocManager.allocatorID() );
+	verifyImageTestList( head );
+	// the reopened heap is fully functional; changes survive one more round
+	modifyImageTestList( head, 1 );
+	void* tail = allocManager.allocate( 1000 );
+	allocManager.setUserPtr( 1, tail );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.closePersistentHeap() );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.openPersistentHeap( fileName, 0 ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getUserPtr( 0 ) == head && allocManager.getUserPtr( 1 ) == tail );
+	verifyImageTestList( head, 1 );
+	allocManager.deallocate( tail );
+	freeImageTestList( allocManager, head );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.closePersistentHeap() );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ReservationArena::hasOverflowed() == overflowed );
+	remove( fileName );
+}
+#endif // NODECPP_LINUX
+
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+size_t countPagesInRow( void* const* ptrs, size_t cnt )
+{
+	size_t pageCnt = 1;
+	for ( size_t i=1; i<cnt; ++i )
+		if ( ( (uintptr_t)( ptrs[i] ) & ~( PAGE_SIZE_BYTES - 1 ) ) != ( (uintptr_t)( ptrs[i - 1] ) & ~( PAGE_SIZE_BYTES - 1 ) ) )
+			++pageCnt;
+	return pageCnt;
+}
+
+void pageLocalTest()
+{
+	constexpr size_t sizes[] = { 16, 64, 200, 700 };
+	constexpr size_t blockCnt = 0x1000;
+	void* ptrs[blockCnt];
+	ThreadLocalAllocatorT allocManager;
+	for ( size_t sz : sizes )
+	{
+		// blocks come page by page, each page filled up before the next one is taken
+		for ( size_t i=0; i<blockCnt; ++i )
+			ptrs[i] = allocManager.allocate( sz );
+		size_t pageCnt = countPagesInRow( ptrs, blockCnt );
+		size_t emptyAtPeak = allocManager.getEmptyPageCount();
+
+		// when everything is freed, all pages but the current one are known to be empty
+		for ( size_t i=0; i<blockCnt; ++i )
+			allocManager.deallocate( ptrs[i] );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtPeak + pageCnt - 1 );
+
+		// and they are reused with no new pages taken
+		for ( size_t i=0; i<blockCnt; ++i )
+			ptrs[i] = allocManager.allocate( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtPeak );
+
+		// holes in partially used pages are filled before any empty page is taken
+		for ( size_t i=0; i<blockCnt; i+=2 )
+			allocManager.deallocate( ptrs[i] );
+		for ( size_t i=0; i<blockCnt; i+=2 )
+			ptrs[i] = allocManager.allocate( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtPeak );
+		for ( size_t i=0; i<blockCnt; ++i )
+			allocManager.deallocate( ptrs[i] );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtPeak + pageCnt - 1 );
+
+		// zombies keep their pages in use; once released, in any way, they are back at their pages
+		for ( size_t i=0; i<blockCnt; ++i )
+			ptrs[i] = allocManager.zombieableAllocate( sz );
+		size_t zombiePageCnt = countPagesInRow( ptrs, blockCnt );
+		size_t emptyAtZombiePeak = allocManager.getEmptyPageCount();
+		for ( size_t i=0; i<blockCnt; ++i )
+			allocManager.zombieableDeallocate( ptrs[i] );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtZombiePeak );
+		allocManager.killAllZombies();
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtZombiePeak + zombiePageCnt - 1 );
+
+		for ( size_t i=0; i<blockCnt; ++i )
+			ptrs[i] = allocManager.zombieableAllocate( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtZombiePeak );
+		for ( size_t i=0; i<blockCnt; ++i )
+			allocManager.zombieableDeallocate( ptrs[i] );
+		allocManager.markZombiesForReclamation();
+		while ( !allocManager.reclaimZombies( 64 ) )
+			;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtZombiePeak + zombiePageCnt - 1 );
+
+		for ( size_t i=0; i<blockCnt; ++i )
+			ptrs[i] = allocManager.zombieableAllocate( sz );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtZombiePeak );
+		allocManager.setZombieQuarantineBudget( 1 ); // every zombie is released right away
+		for ( size_t i=0; i<blockCnt; ++i )
+			allocManager.zombieableDeallocate( ptrs[i] );
+		allocManager.setZombieQuarantineBudget( 0 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.getEmptyPageCount() == emptyAtZombiePeak + zombiePageCnt - 1 );
+	}
+}
+#endif // NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+
+// an allocator handed over to another thread is owned (see NODECPP_IIBMALLOC_OWNER_THREAD_CHECK) and is current there
+void handoverTest()
+{
+	constexpr size_t blockCnt = 0x100;
+	constexpr size_t largeSz = 0x100000;
+	char* blocks[blockCnt];
+	char* large;
+
+	ThreadLocalAllocatorT allocManager;
+	ThreadLocalAllocatorT* formerAlloc = setCurrneAllocator( &allocManager );
+	for ( size_t i=0; i<blockCnt; ++i )
+	{
+		blocks[i] = new char[ 16 + i ];
+		memset( blocks[i], (uint8_t)i, 16 + i );
+	}
+	large = new char[largeSz];
+	memset( large, 0x5a, largeSz );
+	allocManager.detachFromThread();
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, g_CurrentAllocManager == nullptr && allocManager.isDetached() );
+
+	std::thread receiver( [&]() {
+		ThreadLocalAllocatorT* former = allocManager.attachToThread();
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, former == nullptr && g_CurrentAllocManager == &allocManager && allocManager.isOwnedByCurrentThread() );
+		for ( size_t i=0; i<blockCnt; ++i )
+		{
+			for ( size_t j=0; j<16 + i; ++j )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (uint8_t)( blocks[i][j] ) == (uint8_t)i );
+			delete [] blocks[i];
+		}
+		for ( size_t j=0; j<largeSz; ++j )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (uint8_t)( large[j] ) == 0x5a );
+		delete [] large;
+		for ( size_t i=0; i<blockCnt; ++i )
+		{
+			blocks[i] = new char[ 16 + i ];
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, getOwnerAllocatorID( blocks[i] ) == (int32_t)( allocManager.allocatorID() ) );
+			memset( blocks[i], (uint8_t)( i + 1 ), 16 + i );
+		}
+		allocManager.detachFromThread();
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, g_CurrentAllocManager == nullptr && allocManager.isDetached() );
+	} );
+	receiver.join();
+
+	// and back, this time not as the current one
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.attachToThread( false ) == nullptr );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, g_CurrentAllocManager == nullptr && allocManager.isOwnedByCurrentThread() );
+	for ( size_t i=0; i<blockCnt; ++i )
+	{
+		for ( size_t j=0; j<16 + i; ++j )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (uint8_t)( blocks[i][j] ) == (uint8_t)( i + 1 ) );
+		allocManager.deallocate( blocks[i] );
+	}
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, setCurrneAllocator( formerAlloc ) == nullptr );
+}
+
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+// snapshots of an allocator are read by another thread while it allocates; a released slot is not reported
+void statsRegistryTest()
+{
+	constexpr size_t chunkSz = 0x10000;
+	constexpr size_t chunkCnt = 64;
+	constexpr size_t roundCnt = 64;
+	constexpr size_t minReadCnt = 1000; // the owner keeps allocating until the reader has read at least as many snapshots
+	constexpr size_t maxSnapshots = 256;
+	PublishedStats snapshots[maxSnapshots];
+	auto find = [&snapshots]( size_t cnt, uint64_t allocatorID ) -> const PublishedStats* {
+		for ( size_t i=0; i<cnt && i<maxSnapshots; ++i )
+			if ( snapshots[i].allocatorID == allocatorID )
+				return snapshots + i;
+		return nullptr;
+	};
+
+	std::atomic<uint64_t> ownerID = 0;
+	std::atomic<int> ownerState = 0; // 1: allocating; 2: done, with the allocator destroyed
+	std::atomic<size_t> readCnt = 0;
+	std::thread owner( [&ownerID, &ownerState, &readCnt]() {
+		{
+			ThreadLocalAllocatorT allocManager;
+			void* chunks[chunkCnt];
+			allocManager.publishStats();
+			ownerID = allocManager.allocatorID();
+			ownerState = 1;
+			for ( size_t round=0; round<roundCnt || readCnt < minReadCnt; ++round )
+			{
+				for ( size_t i=0; i<chunkCnt; ++i )
+					chunks[i] = allocManager.allocate( chunkSz );
+				for ( size_t i=0; i<chunkCnt; ++i )
+					allocManager.deallocate( chunks[i] );
+			}
+		}
+		ownerState = 2;
+	} );
+	while ( ownerState == 0 )
+		std::this_thread::yield();
+
+	// each snapshot is of the same moment: bytes in use are exactly as many chunks as there are live ones
+	uint64_t lastPublishCount = 0;
+	uint64_t bytesPerChunk = 0;
+	size_t observedWithChunks = 0;
+	while ( ownerState != 2 )
+	{
+		size_t cnt = StatsRegistry::collect( snapshots, maxSnapshots );
+		const PublishedStats* ps = find( cnt, ownerID );
+		if ( ps == nullptr )
+			continue; // just released
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ps->publishCount >= lastPublishCount );
+		lastPublishCount = ps->publishCount;
+		++readCnt;
+		uint64_t live = ps->bulkTier.allocRequestCount - ps->bulkTier.deallocRequestCount;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, live <= chunkCnt );
+		if ( live == 0 )
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ps->bulkTier.inUse == 0 );
+			continue;
+		}
+		if ( bytesPerChunk == 0 )
+			bytesPerChunk = ps->bulkTier.inUse / live;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, bytesPerChunk >= chunkSz && ps->bulkTier.inUse == live * bytesPerChunk );
+		++observedWithChunks;
+	}
+	owner.join();
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, readCnt >= minReadCnt && lastPublishCount > 1 );
+	nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "stats registry: {} snapshots read, {} with live chunks", (size_t)readCnt, observedWithChunks );
+
+	size_t cnt = StatsRegistry::collect( snapshots, maxSnapshots );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, find( cnt, ownerID ) == nullptr );
+
+	// the released slot goes to a next allocator, with the snapshot of that one only
+	ThreadLocalAllocatorT allocManager;
+	allocManager.publishStats();
+	cnt = StatsRegistry::collect( snapshots, maxSnapshots );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, find( cnt, ownerID ) == nullptr );
+	const PublishedStats* ps = find( cnt, allocManager.allocatorID() );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ps != nullptr && ps->publishCount >= 1 && ps->bulkTier.inUse == 0 );
+}
+#endif // NODECPP_IIBMALLOC_STATS_REGISTRY
+
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+// operator delete on a thread with a heap of its own returns blocks of other heaps to their owners rather than to its heap
+void threadHeapsForeignDeleteTest()
+{
+	char* exited = nullptr; // of a heap that is an orphan by the time of delete
+	char* exitedLarge = nullptr;
+	char* running = nullptr; // of a heap that is still in use by its thread by the time of delete
+	int32_t exitedID = ReservationArena::noOwner;
+	int32_t runningID = ReservationArena::noOwner;
+
+	// enabled from within the thread, so that this one stays with no heap
+	std::thread deleter( [&]() {
+		ThreadHeaps::enable();
+		char* own = new char[32]; // the thread gets its heap before any other one is orphaned (to be adopted)
+		int32_t ownID = getOwnerAllocatorID( own );
+
+		std::atomic<int> runnerState = 0; // 1: allocated; 2: asked to exit
+		std::thread runner( [&]() {
+			running = new char[32];
+			runnerState = 1;
+			while ( runnerState != 2 )
+				std::this_thread::yield();
+		} );
+		while ( runnerState != 1 )
+			std::this_thread::yield();
+		runningID = getOwnerAllocatorID( running );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, runningID != ReservationArena::noOwner && runningID != ownID );
+
+		std::vector<uint64_t, IibStlAllocator<uint64_t>> exitedVector;
+		std::thread( [&]() {
+			exited = new char[32];
+			exitedLarge = new char[0x100000];
+			exitedVector.resize( 0x10000 );
+		} ).join();
+		exitedID = getOwnerAllocatorID( exited );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, exitedID != ReservationArena::noOwner && exitedID != ownID && exitedID != runningID );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, getOwnerAllocatorID( exitedLarge ) == exitedID );
+		delete [] exited;
+		delete [] exitedLarge;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, getOwnerAllocatorID( exitedVector.data() ) == exitedID );
+		exitedVector = std::vector<uint64_t, IibStlAllocator<uint64_t>>();
+		char* again = new char[32];
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, again != exited );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, getOwnerAllocatorID( again ) == ownID );
+		delete [] again;
+
+		delete [] running; // waits for the heap to become an orphan
+		runnerState = 2;
+		runner.join();
+
+		delete [] own;
+	} );
+	deleter.join();
+
+	// each block is back in its own heap, and is the first to be reused there
+	ThreadLocalAllocatorT* orphans[3];
+	size_t orphanCnt = 0;
+	while ( orphanCnt < 3 && ( orphans[orphanCnt] = ThreadHeaps::adoptOrphan() ) != nullptr )
+		++orphanCnt;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, orphanCnt == 3 );
+	size_t found = 0;
+	for ( size_t i=0; i<orphanCnt; ++i )
+	{
+		char* expected = nullptr;
+		if ( (int32_t)( orphans[i]->allocatorID() ) == exitedID )
+			expected = exited;
+		else if ( (int32_t)( orphans[i]->allocatorID() ) == runningID )
+			expected = running;
+		if ( expected == nullptr )
+			continue;
+		++found;
+		void* ptr = orphans[i]->allocate( 32 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ptr == expected );
+		orphans[i]->deallocate( ptr );
+	}
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, found == 2 );
+	for ( size_t i=0; i<orphanCnt; ++i )
+		ThreadHeaps::abandon( orphans[i] );
+	ThreadHeaps::enable( false );
+}
+#endif // NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+struct HeapProfileTotals
+{
+	uint64_t liveCnt = 0;
+	uint64_t liveBytes = 0;
+	uint64_t allocCnt = 0;
+	uint64_t allocBytes = 0;
+};
+
+// header and stack lines of dumpPprof() output; stack lines must sum up to the header
+HeapProfileTotals parsePprofHeapProfile( const char* fileName, size_t expectedInterval, size_t& stackCnt )
+{
+	FILE* f = fopen( fileName, "r" );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, f != nullptr );
+	HeapProfileTotals header, sum;
+	unsigned long long v[4];
+	size_t interval = 0;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, fscanf( f, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n", v, v + 1, v + 2, v + 3, &interval ) == 5 );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, interval == expectedInterval );
+	header = { v[0], v[1], v[2], v[3] };
+	stackCnt = 0;
+	bool mappedLibraries = false;
+	char line[4096];
+	while ( fgets( line, sizeof(line), f ) != nullptr )
+	{
+		if ( strcmp( line, "MAPPED_LIBRARIES:\n" ) == 0 )
+		{
+			mappedLibraries = true;
+			break;
+		}
+		if ( line[0] == '\n' )
+			continue;
+		int frameStart = 0;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, sscanf( line, "%llu: %llu [%llu: %llu] @%n", v, v + 1, v + 2, v + 3, &frameStart ) == 4 && frameStart > 0 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, strncmp( line + frameStart, " 0x", 3 ) == 0 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, v[0] <= v[2] && v[1] <= v[3] );
+		sum.liveCnt += v[0];
+		sum.liveBytes += v[1];
+		sum.allocCnt += v[2];
+		sum.allocBytes += v[3];
+		++stackCnt;
+	}
+	fclose( f );
+#if defined(NODECPP_LINUX) || defined(NODECPP_ANDROID)
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, mappedLibraries );
+#endif
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, sum.liveCnt == header.liveCnt && sum.liveBytes == header.liveBytes && sum.allocCnt == header.allocCnt && sum.allocBytes == header.allocBytes );
+	return header;
+}
+
+// sum of bytes over the lines of dumpFolded() output, each being 'frame;frame;... bytes'
+uint64_t parseFoldedHeapProfile( const char* fileName )
+{
+	FILE* f = fopen( fileName, "r" );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, f != nullptr );
+	uint64_t sum = 0;
+	char line[0x10000];
+	while ( fgets( line, sizeof(line), f ) != nullptr )
+	{
+		const char* lastSpace = strrchr( line, ' ' );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, lastSpace != nullptr && lastSpace != line );
+		unsigned long long bytes = 0;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, sscanf( lastSpace, " %llu", &bytes ) == 1 && bytes != 0 );
+		sum += bytes;
+	}
+	fclose( f );
+	return sum;
+}
+
+NODECPP_NOINLINE void heapProfilerTestAllocate( ThreadLocalAllocatorT& allocManager, void** ptrs, size_t cnt, size_t sz )
+{
+	for ( size_t i=0; i<cnt; ++i )
+		ptrs[i] = allocManager.allocate( sz );
+}
+
+void heapProfilerTest()
+{
+	constexpr size_t interval = 4096;
+	constexpr size_t liveSz = 64;
+	constexpr size_t liveCnt = 0x4000;
+	constexpr size_t freedSz = 1024;
+	constexpr size_t freedCnt = 0x1000;
+	constexpr const char* pprofFileName = "test_iibmalloc_heap.prof";
+	constexpr const char* foldedFileName = "test_iibmalloc_heap.folded";
+
+	ThreadLocalAllocatorT allocManager;
+	allocManager.setHeapProfilerSamplingInterval( interval );
+	void** live = new void*[liveCnt];
+	void** freed = new void*[freedCnt];
+	heapProfilerTestAllocate( allocManager, live, liveCnt, liveSz );
+	for ( size_t i=0; i<freedCnt; ++i ) // a call site of its own
+		freed[i] = allocManager.allocate( freedSz );
+	for ( size_t i=0; i<freedCnt; ++i )
+		allocManager.deallocate( freed[i] );
+
+	// live samples are all of the first kind, the rest are of the second one; their numbers are about sizes over the interval
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.dumpHeapProfile( pprofFileName ) );
+	size_t stackCnt = 0;
+	HeapProfileTotals totals = parsePprofHeapProfile( pprofFileName, interval, stackCnt );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, stackCnt >= 2 );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, totals.liveBytes == totals.liveCnt * liveSz );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, totals.allocBytes - totals.liveBytes == ( totals.allocCnt - totals.liveCnt ) * freedSz );
+	constexpr size_t expectedLive = liveCnt * liveSz / interval;
+	constexpr size_t expectedFreed = freedCnt * freedSz / interval;
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, totals.liveCnt > expectedLive / 2 && totals.liveCnt < expectedLive * 2, "{} vs. {}", totals.liveCnt, expectedLive );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, totals.allocCnt - totals.liveCnt > expectedFreed / 2 && totals.allocCnt - totals.liveCnt < expectedFreed * 2, "{} vs. {}", totals.allocCnt - totals.liveCnt, expectedFreed );
+
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.dumpHeapProfileFolded( foldedFileName ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, parseFoldedHeapProfile( foldedFileName ) == totals.liveBytes );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.dumpHeapProfileFolded( foldedFileName, false ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, parseFoldedHeapProfile( foldedFileName ) == totals.allocBytes );
+
+	// with everything freed, nothing is live, and cumulative totals stay
+	for ( size_t i=0; i<liveCnt; ++i )
+		allocManager.deallocate( live[i] );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.dumpHeapProfile( pprofFileName ) );
+	HeapProfileTotals after = parsePprofHeapProfile( pprofFileName, interval, stackCnt );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, after.liveCnt == 0 && after.liveBytes == 0 && after.allocCnt == totals.allocCnt && after.allocBytes == totals.allocBytes );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, allocManager.dumpHeapProfileFolded( foldedFileName ) );
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, parseFoldedHeapProfile( foldedFileName ) == 0 );
+
+	delete [] live;
+	delete [] freed;
+	remove( pprofFileName );
+	remove( foldedFileName );
+}
+#endif // NODECPP_IIBMALLOC_HEAP_PROFILER
+
+#ifdef NODECPP_IIBMALLOC_PAGE_COLOURING
+void pageColouringTest()
+{
+	// offsets rotate over the slack, are aligned as blocks of the bucket are, and never are where a large chunk starts
+	{
+		IibAllocatorBase allocManager;
+		constexpr size_t bucketSizes[] = { 16, 24, 48, 96, 128, 384, 1536, 3072 };
+		constexpr size_t callCnt = 64;
+		for ( size_t blockSz=PAGE_SIZE_BYTES; blockSz<=4*PAGE_SIZE_BYTES; blockSz+=PAGE_SIZE_BYTES )
+			for ( size_t bucketSz : bucketSizes )
+			{
+				size_t slack = blockSz % bucketSz;
+				size_t alignment = std::min( bucketSz & ( 0 - bucketSz ), IibAllocatorBase::maximalSupportedAlignment );
+				bool seenNonZero = false;
+				for ( size_t i=0; i<callCnt; ++i )
+				{
+					size_t offset = allocManager.pageColourOffset( blockSz, bucketSz );
+					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, offset <= slack && offset % alignment == 0 && offset % ALIGNMENT == 0, "{} of {}/{}", offset, blockSz, bucketSz );
+					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, offset != IibAllocatorBase::largeChunkOffset, "{}/{}", blockSz, bucketSz );
+					seenNonZero = seenNonZero || offset != 0;
+				}
+				// at least one more offset fits besides 0 and the forbidden one
+				if ( slack >= 64 )
+					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, seenNonZero, "{}/{}", blockSz, bucketSz );
+			}
+	}
+
+	// blocks of buckets that leave slack in their runs are shifted differently in different runs, and are released normally
+	{
+		ThreadLocalAllocatorT allocManager;
+		constexpr size_t sizes[] = { 24, 48, 96, 768, 1536, 3072 };
+		constexpr size_t blockCnt = 0x800;
+		void* ptrs[blockCnt];
+		for ( size_t sz : sizes )
+		{
+			bool shifted = false;
+			for ( size_t i=0; i<blockCnt; ++i )
+			{
+				ptrs[i] = allocManager.allocate( sz );
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( (uintptr_t)( ptrs[i] ) & PAGE_SIZE_MASK ) != IibAllocatorBase::largeChunkOffset );
+				memset( ptrs[i], 0xa5, sz );
+				shifted = shifted || ( ( (uintptr_t)( ptrs[i] ) ^ (uintptr_t)( ptrs[0] ) ) & 0xff ) != 0; // blocks of these sizes are all 256-aligned but for colours
+			}
+			if ( sz >= 768 )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, shifted, "{}", sz );
+			for ( size_t i=0; i<blockCnt; ++i )
+				allocManager.deallocate( ptrs[i] );
+		}
+	}
+}
+#endif // NODECPP_IIBMALLOC_PAGE_COLOURING
+
 int main()
 {
 	nodecpp::log::Log log;
@@ -307,7 +1661,43 @@ int main()
 	log.add( stdout );
 	nodecpp::logging_impl::currentLog = &log;
 
+	largeChunkSplitMergeTest();
 	alignedAllocTest();
+	stlAdaptersTest();
+	objectPoolTest();
+#ifndef NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	zombieSetTest();
+#endif // NODECPP_DISABLE_ZOMBIE_ACCESS_EARLY_DETECTION
+	zombieQuarantineTest();
+	zombieReclamationTest();
+	retireTest();
+#ifdef NODECPP_IIBMALLOC_OUT_OF_BAND_ZOMBIE_LINKS
+	outOfBandZombieLinksTest();
+#endif
+#ifdef NODECPP_IIBMALLOC_PAGE_LOCAL_FREE_LISTS
+	pageLocalTest();
+#endif
+#ifdef NODECPP_IIBMALLOC_PAGE_COLOURING
+	pageColouringTest();
+#endif
+#ifdef NODECPP_IIBMALLOC_HEAP_PROFILER
+	heapProfilerTest();
+#endif
+	serializeTest();
+	regionTest();
+	checkpointTest();
+	relocatingTest();
+#if defined NODECPP_LINUX
+	snapshotTest();
+	persistentHeapTest();
+#endif
+	handoverTest();
+#ifdef NODECPP_IIBMALLOC_STATS_REGISTRY
+	statsRegistryTest();
+#endif
+#ifndef NODECPP_IIBMALLOC_DISABLE_RESERVATION_ARENA
+	threadHeapsForeignDeleteTest();
+#endif
 
 	TestRes* testRes = new TestRes[max_threads];
 
@@ -346,16 +1736,27 @@ int main()
 				nodecpp::log::default_log::info( "{},{},{},{},{}", threadCount, tr.durEmpty, tr.durNewDel, tr.durPerThreadAlloc, (tr.durNewDel - tr.durEmpty) * 1. / (tr.durPerThreadAlloc - tr.durEmpty) );
 			else
 				nodecpp::log::default_log::info( "{},{},{},{}", threadCount, tr.durEmpty, tr.durNewDel, tr.durPerThreadAlloc );
+			nodecpp::log::default_log::info( "bytes per live byte after main loop (empty,newdel,perthread): {:.3f},{:.3f},{:.3f}", 
+				bytesPerLiveByte( tr.threadResEmpty, threadCount ), bytesPerLiveByte( tr.threadResNewDel, threadCount ), bytesPerLiveByte( tr.threadResPerThreadAlloc, threadCount ) );
 			nodecpp::log::default_log::info( "Per-thread stats:" );
 			for ( size_t i=0;i<threadCount;++i )
 			{
 				nodecpp::log::default_log::info( "   {}:", i );
 				if ( params.startupParams.allocatorType & USE_EMPTY_TEST )
+				{
 					printThreadStats( "\t", tr.threadResEmpty[i] );
+					printThreadMemoryStats( "\t", tr.threadResEmpty[i] );
+				}
 				if ( params.startupParams.allocatorType & USE_NEW_DELETE )
+				{
 					printThreadStats( "\t", tr.threadResNewDel[i] );
+					printThreadMemoryStats( "\t", tr.threadResNewDel[i] );
+				}
 				if ( params.startupParams.allocatorType & USE_PER_THREAD_ALLOCATOR )
+				{
 					printThreadStatsEx( "\t", tr.threadResPerThreadAlloc[i] );
+					printThreadMemoryStats( "\t", tr.threadResPerThreadAlloc[i] );
+				}
 			}
 		}
 		nodecpp::log::default_log::info( "" );
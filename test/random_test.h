@@ -46,6 +46,7 @@
 #include <chrono>
 #include <random>
 #include <limits.h>
+#include <algorithm>
 
 #ifdef NODECPP_MSVC
 #include <intrin.h>
@@ -140,6 +141,15 @@ enum { USE_RANDOMPOS_RANDOMSIZE };
 enum MEM_ACCESS_TYPE { none, single, full };
 
 
+struct PhaseFootprint
+{
+	MemoryFootprint mem;
+	uint64_t sysMapCallCnt; // allocator-reported; zeros for allocators that do not report
+	uint64_t sysUnmapCallCnt;
+	uint64_t sysProtectCallCnt;
+	size_t liveBytes; // as requested by the test, not as rounded up by the allocator
+};
+
 struct CommonTestResults
 {
 	size_t threadID;
@@ -150,8 +160,38 @@ struct CommonTestResults
 	uint64_t rdtscSetup;
 	uint64_t rdtscMainLoop;
 	uint64_t rdtscExit;
+
+	PhaseFootprint footprintBegin;
+	PhaseFootprint footprintAfterSetup;
+	PhaseFootprint footprintAfterMainLoop;
+	PhaseFootprint footprintAfterExit;
 };
 
+inline void captureFootprint( PhaseFootprint& pf, size_t liveBytes )
+{
+	GetMemoryFootprint( pf.mem );
+	pf.sysMapCallCnt = 0;
+	pf.sysUnmapCallCnt = 0;
+	pf.sysProtectCallCnt = 0;
+	pf.liveBytes = liveBytes;
+}
+
+inline void captureFootprint( PhaseFootprint& pf, size_t liveBytes, const BlockStats& stats )
+{
+	captureFootprint( pf, liveBytes );
+	pf.sysMapCallCnt = stats.sysMapCallCount();
+	pf.sysUnmapCallCnt = stats.sysUnmapCallCount();
+	pf.sysProtectCallCnt = stats.sysProtectCallCount();
+}
+
+// RSS growth over test start per byte requested by the test and still alive; 0 if nothing is alive
+inline double bytesPerLiveByte( const PhaseFootprint& begin, const PhaseFootprint& at )
+{
+	if ( at.liveBytes == 0 )
+		return 0;
+	return at.mem.rss > begin.mem.rss ? ( at.mem.rss - begin.mem.rss ) * 1. / at.liveBytes : 0;
+}
+
 struct ThreadTestRes : public CommonTestResults
 {
 	size_t sysAllocCallCntAfterSetup;
@@ -210,6 +250,42 @@ void printThreadStatsEx( const char* prefix, ThreadTestRes& res )
 		res.deallocRequestCountAfterExit - res.deallocRequestCountAfterMainLoop, exitDeallocCnt, exitDeallocCntRdtsc, exitDeallocCnt ? exitDeallocCntRdtsc / exitDeallocCnt : 0 );
 }
 
+// for several threads of a test; RSS is process-wide, so growth is taken from the earliest start to the latest reading
+template<class TestResT>
+double bytesPerLiveByte( const TestResT* res, size_t threadCount )
+{
+	size_t rssBegin = SIZE_MAX;
+	size_t rssAfterMainLoop = 0;
+	size_t liveBytes = 0;
+	for ( size_t i=0; i<threadCount; ++i )
+	{
+		rssBegin = std::min( rssBegin, res[i].footprintBegin.mem.rss );
+		rssAfterMainLoop = std::max( rssAfterMainLoop, res[i].footprintAfterMainLoop.mem.rss );
+		liveBytes += res[i].footprintAfterMainLoop.liveBytes;
+	}
+	if ( liveBytes == 0 || rssAfterMainLoop <= rssBegin )
+		return 0;
+	return ( rssAfterMainLoop - rssBegin ) * 1. / liveBytes;
+}
+
+void printThreadMemoryStats( const char* prefix, CommonTestResults& res )
+{
+	const PhaseFootprint* phases[4] = { &res.footprintBegin, &res.footprintAfterSetup, &res.footprintAfterMainLoop, &res.footprintAfterExit };
+	nodecpp::log::default_log::info( "{}\trss (KB) [begin | setup | main | exit]: {} | {} | {} | {}; peak rss: {} | {} | {}", prefix, 
+		phases[0]->mem.rss >> 10, phases[1]->mem.rss >> 10, phases[2]->mem.rss >> 10, phases[3]->mem.rss >> 10, 
+		phases[1]->mem.peakRss >> 10, phases[2]->mem.peakRss >> 10, phases[3]->mem.peakRss >> 10 );
+	nodecpp::log::default_log::info( "{}\tfaults (minor/major) [setup | main | exit]: {}/{} | {}/{} | {}/{}", prefix, 
+		phases[1]->mem.minorFaults - phases[0]->mem.minorFaults, phases[1]->mem.majorFaults - phases[0]->mem.majorFaults, 
+		phases[2]->mem.minorFaults - phases[1]->mem.minorFaults, phases[2]->mem.majorFaults - phases[1]->mem.majorFaults, 
+		phases[3]->mem.minorFaults - phases[2]->mem.minorFaults, phases[3]->mem.majorFaults - phases[2]->mem.majorFaults );
+	nodecpp::log::default_log::info( "{}\tmap/unmap/protect calls [setup | main | exit]: {}/{}/{} | {}/{}/{} | {}/{}/{}", prefix, 
+		phases[1]->sysMapCallCnt - phases[0]->sysMapCallCnt, phases[1]->sysUnmapCallCnt - phases[0]->sysUnmapCallCnt, phases[1]->sysProtectCallCnt - phases[0]->sysProtectCallCnt, 
+		phases[2]->sysMapCallCnt - phases[1]->sysMapCallCnt, phases[2]->sysUnmapCallCnt - phases[1]->sysUnmapCallCnt, phases[2]->sysProtectCallCnt - phases[1]->sysProtectCallCnt, 
+		phases[3]->sysMapCallCnt - phases[2]->sysMapCallCnt, phases[3]->sysUnmapCallCnt - phases[2]->sysUnmapCallCnt, phases[3]->sysProtectCallCnt - phases[2]->sysProtectCallCnt );
+	nodecpp::log::default_log::info( "{}\tlive bytes [setup | main]: {} | {}; bytes per live byte: {:.3f} | {:.3f}", prefix, 
+		phases[1]->liveBytes, phases[2]->liveBytes, bytesPerLiveByte( *phases[0], *phases[1] ), bytesPerLiveByte( *phases[0], *phases[2] ) );
+}
+
 struct TestRes
 {
 	size_t durEmpty;
@@ -256,12 +332,15 @@ class NewDeleteUnderTest
 {
 	CommonTestResults* testRes = nullptr;
 	size_t start = 0;
+	size_t liveBytes = 0;
 
 public:
 	NewDeleteUnderTest( CommonTestResults* testRes_ ) { testRes = testRes_; }
 	static constexpr bool isFake() { return false; }
+	static constexpr bool hasZombies() { return false; }
 	void init( size_t threadID )
 	{
+		captureFootprint( testRes->footprintBegin, 0 );
 		start = GetMillisecondCount();
 		testRes->threadID = threadID; // just as received
 		testRes->rdtscBegin = NODECPP_RDTSC();
@@ -269,16 +348,18 @@ public:
 
 	void* allocate( size_t sz ) { return new uint8_t[ sz ]; }
 	void deallocate( void* ptr ) { delete [] reinterpret_cast<uint8_t*>(ptr); }
+	void registerLiveBytes( size_t bytes ) { liveBytes = bytes; }
 
 	void deinit() {}
 
-	void doWhateverAfterSetupPhase() { testRes->rdtscSetup = NODECPP_RDTSC(); }
+	void doWhateverAfterSetupPhase() { testRes->rdtscSetup = NODECPP_RDTSC(); captureFootprint( testRes->footprintAfterSetup, liveBytes ); }
 	void doWhateverWithinMainLoopPhase() {}
-	void doWhateverAfterMainLoopPhase() { testRes->rdtscMainLoop = NODECPP_RDTSC(); }
+	void doWhateverAfterMainLoopPhase() { testRes->rdtscMainLoop = NODECPP_RDTSC(); captureFootprint( testRes->footprintAfterMainLoop, liveBytes ); }
 	void doWhateverAfterCleanupPhase()
 	{
 		testRes->rdtscExit = NODECPP_RDTSC();
 		testRes->innerDur = GetMillisecondCount() - start;
+		captureFootprint( testRes->footprintAfterExit, 0 );
 	}
 };
 
@@ -288,19 +369,28 @@ class PerThreadAllocatorUnderTest
 	ThreadLocalAllocatorT* formerAlloc = nullptr;
 	ThreadTestRes* testRes = nullptr;
 	size_t start = 0;
+	size_t liveBytes = 0;
 
 public:
 	PerThreadAllocatorUnderTest( ThreadTestRes* testRes_ ) { testRes = testRes_; }
 	static constexpr bool isFake() { return false; }
+#ifndef NODECPP_DISABLE_SAFE_ALLOCATION_MEANS
+	static constexpr bool hasZombies() { return true; }
+#else
+	static constexpr bool hasZombies() { return false; }
+#endif
 
 	void init( size_t threadID )
 	{
 		start = GetMillisecondCount();
 		testRes->rdtscBegin = NODECPP_RDTSC();
 		allocManager.initialize();
+		captureFootprint( testRes->footprintBegin, 0, allocManager.getAllocatorStats().total() );
 		formerAlloc = setCurrneAllocator( &allocManager );
 	}
 
+	void registerLiveBytes( size_t bytes ) { liveBytes = bytes; }
+
 #ifndef NODECPP_DISABLE_SAFE_ALLOCATION_MEANS
 	void* allocate( size_t sz ) { 
 		void* ret = allocManager.zombieableAllocate( sz ); 
@@ -311,6 +401,16 @@ public:
 		return ret; 
 	}
 	void deallocate( void* ptr ) { allocManager.zombieableDeallocate( ptr ); }
+
+	// for replaying recorded traces (see trace_replay.cpp): recorded sizes and pointers are of plain blocks, with
+	// the zombie prefix (if any) already included, so blocks are allocated and released as such, and made zombies as such
+	void* plainAllocate( size_t sz ) { return allocManager.allocate( sz ); }
+	void plainDeallocate( void* ptr ) { allocManager.deallocate( ptr ); }
+	void zombieDeallocate( void* ptr ) { allocManager.zombieableDeallocate( reinterpret_cast<uint8_t*>( ptr ) + guaranteed_prefix_size ); }
+	void killAllZombies() { allocManager.killAllZombies(); }
+	void markZombiesForReclamation() { allocManager.markZombiesForReclamation(); }
+	void reclaimZombies( size_t maxItems ) { allocManager.reclaimZombies( maxItems ); }
+	void setZombieQuarantineBudget( size_t bytes ) { allocManager.setZombieQuarantineBudget( bytes ); }
 #else
 	void* allocate( size_t sz ) { 
 		void* ret = allocManager.allocate( sz ); 
@@ -341,6 +441,7 @@ public:
 		testRes->sysDeallocCallCntAfterSetup = allocManager.getStats().sysDeallocCount;
 		testRes->allocRequestCountAfterSetup = allocManager.getStats().allocRequestCount;
 		testRes->deallocRequestCountAfterSetup = allocManager.getStats().deallocRequestCount;
+		captureFootprint( testRes->footprintAfterSetup, liveBytes, allocManager.getAllocatorStats().total() );
 	}
 
 	void doWhateverWithinMainLoopPhase()
@@ -362,6 +463,7 @@ public:
 		testRes->sysDeallocCallCntAfterMainLoop = allocManager.getStats().sysDeallocCount;
 		testRes->allocRequestCountAfterMainLoop = allocManager.getStats().allocRequestCount;
 		testRes->deallocRequestCountAfterMainLoop = allocManager.getStats().deallocRequestCount;
+		captureFootprint( testRes->footprintAfterMainLoop, liveBytes, allocManager.getAllocatorStats().total() );
 	}
 
 	void doWhateverAfterCleanupPhase()
@@ -377,6 +479,7 @@ public:
 		testRes->allocRequestCountAfterExit = allocManager.getStats().allocRequestCount;
 		testRes->deallocRequestCountAfterExit = allocManager.getStats().deallocRequestCount;
 		testRes->innerDur = GetMillisecondCount() - start;
+		captureFootprint( testRes->footprintAfterExit, 0, allocManager.getAllocatorStats().total() );
 	}
 };
 
@@ -386,13 +489,16 @@ class FakeAllocatorUnderTest
 	size_t start = 0;
 	uint8_t* fakeBuffer = nullptr;
 	static constexpr size_t fakeBufferSize = 0x1000000;
+	size_t liveBytes = 0;
 
 public:
 	FakeAllocatorUnderTest( CommonTestResults* testRes_ ) { testRes = testRes_; }
 	static constexpr bool isFake() { return true; } // thus indicating that certain checks over allocated memory should be ommited
+	static constexpr bool hasZombies() { return false; }
 
 	void init( size_t threadID )
 	{
+		captureFootprint( testRes->footprintBegin, 0 );
 		start = GetMillisecondCount();
 		testRes->threadID = threadID; // just as received
 		testRes->rdtscBegin = NODECPP_RDTSC();
@@ -401,16 +507,18 @@ public:
 
 	void* allocate( size_t sz ) { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, sz <= fakeBufferSize ); return fakeBuffer; }
 	void deallocate( void* ptr ) {}
+	void registerLiveBytes( size_t bytes ) { liveBytes = bytes; }
 
 	void deinit() { if ( fakeBuffer ) delete [] fakeBuffer; fakeBuffer = nullptr; }
 
-	void doWhateverAfterSetupPhase() { testRes->rdtscSetup = NODECPP_RDTSC(); }
+	void doWhateverAfterSetupPhase() { testRes->rdtscSetup = NODECPP_RDTSC(); captureFootprint( testRes->footprintAfterSetup, liveBytes ); }
 	void doWhateverWithinMainLoopPhase() {}
-	void doWhateverAfterMainLoopPhase() { testRes->rdtscMainLoop = NODECPP_RDTSC(); }
+	void doWhateverAfterMainLoopPhase() { testRes->rdtscMainLoop = NODECPP_RDTSC(); captureFootprint( testRes->footprintAfterMainLoop, liveBytes ); }
 	void doWhateverAfterCleanupPhase()
 	{
 		testRes->rdtscExit = NODECPP_RDTSC();
 		testRes->innerDur = GetMillisecondCount() - start;
+		captureFootprint( testRes->footprintAfterExit, 0 );
 	}
 };
 
@@ -473,6 +581,7 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 	allocatorUnderTest.init( threadID );
 
 	size_t dummyCtr = 0;
+	size_t liveBytes = 0;
 
 	Pareto_80_20_6_Data paretoData;
 	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, maxItems <= UINT32_MAX );
@@ -505,6 +614,7 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 				size_t sz = calcSizeWithStatsAdjustment( randNumSz, maxItemSizeExp );
 				baseBuff[i*32+j].sz = sz;
 				baseBuff[i*32+j].ptr = reinterpret_cast<uint8_t*>( allocatorUnderTest.allocate( sz ) );
+				liveBytes += sz;
 				if constexpr ( doMemAccess )
 				{
 					if constexpr ( doFullAccess )
@@ -517,6 +627,7 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 				}
 			}
 	}
+	allocatorUnderTest.registerLiveBytes( liveBytes );
 	allocatorUnderTest.doWhateverAfterSetupPhase();
 
 	// main loop
@@ -550,12 +661,14 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 				}
 				allocatorUnderTest.deallocate( baseBuff[idx].ptr );
 				baseBuff[idx].ptr = 0;
+				liveBytes -= baseBuff[idx].sz;
 			}
 			else
 			{
 				size_t sz = calcSizeWithStatsAdjustment( rng64(), maxItemSizeExp );
 				baseBuff[idx].sz = sz;
 				baseBuff[idx].ptr = reinterpret_cast<uint8_t*>( allocatorUnderTest.allocate( sz ) );
+				liveBytes += sz;
 				if constexpr ( doMemAccess )
 				{
 					if constexpr ( doFullAccess )
@@ -570,6 +683,7 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 		}
 		allocatorUnderTest.doWhateverWithinMainLoopPhase();
 	}
+	allocatorUnderTest.registerLiveBytes( liveBytes );
 	allocatorUnderTest.doWhateverAfterMainLoopPhase();
 
 	// exit
@@ -39,11 +39,19 @@
 
 #if defined NODECPP_WINDOWS
 #include <Windows.h>
+#include <Psapi.h>
 #elif defined NODECPP_LINUX || defined(NODECPP_ANDROID)
 #include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 #elif defined NODECPP_MAC
 #include <mach/clock.h>
 #include <mach/mach.h>
+#include <time.h>
+#include <sys/resource.h>
 #endif
 
 
@@ -63,6 +71,10 @@ int64_t GetMicrosecondCount()
 	BOOL ok = QueryPerformanceCounter(&val);
 	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ok);
 	now = (val.QuadPart * 1000000) / frec;
+#elif defined(NODECPP_LINUX) || defined(NODECPP_ANDROID) || defined(NODECPP_MAC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 #endif
 	return now;
 }
@@ -134,3 +146,94 @@ size_t GetMillisecondCount()
 #error unknown/unsupported OS
 
 #endif
+
+
+#if defined NODECPP_WINDOWS
+
+void GetMemoryFootprint( MemoryFootprint& fp, bool )
+{
+	fp = MemoryFootprint();
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof(pmc) ) )
+	{
+		fp.rss = pmc.WorkingSetSize;
+		fp.peakRss = pmc.PeakWorkingSetSize;
+		fp.minorFaults = pmc.PageFaultCount; // soft and hard faults are not distinguished
+		fp.majorFaults = 0;
+	}
+}
+
+void ResetPeakRss() {}
+
+#elif defined(NODECPP_LINUX) || defined(NODECPP_ANDROID)
+
+static size_t readStatusValueKb( const char* buff, const char* key )
+{
+	const char* pos = strstr( buff, key );
+	return pos ? strtoull( pos + strlen( key ), nullptr, 10 ) : 0;
+}
+
+void GetMemoryFootprint( MemoryFootprint& fp, bool currentThreadFaultsOnly )
+{
+	fp = MemoryFootprint();
+	// read(2) rather than stdio to keep allocations out of the picture
+	int fd = open( "/proc/self/status", O_RDONLY );
+	if ( fd >= 0 )
+	{
+		char buff[4096];
+		ssize_t rd = read( fd, buff, sizeof(buff) - 1 );
+		close( fd );
+		if ( rd > 0 )
+		{
+			buff[rd] = 0;
+			fp.rss = readStatusValueKb( buff, "VmRSS:" ) * 1024;
+			fp.peakRss = readStatusValueKb( buff, "VmHWM:" ) * 1024;
+		}
+	}
+	struct rusage usage;
+#ifdef RUSAGE_THREAD
+	int who = currentThreadFaultsOnly ? RUSAGE_THREAD : RUSAGE_SELF;
+#else
+	int who = RUSAGE_SELF;
+#endif
+	if ( getrusage( who, &usage ) == 0 )
+	{
+		fp.minorFaults = usage.ru_minflt;
+		fp.majorFaults = usage.ru_majflt;
+	}
+}
+
+void ResetPeakRss()
+{
+	int fd = open( "/proc/self/clear_refs", O_WRONLY );
+	if ( fd >= 0 )
+	{
+		ssize_t wr = write( fd, "5", 1 ); // resets VmHWM to current RSS (Linux 4.0+)
+		(void)wr;
+		close( fd );
+	}
+}
+
+#elif defined NODECPP_MAC
+
+void GetMemoryFootprint( MemoryFootprint& fp, bool )
+{
+	fp = MemoryFootprint();
+	mach_task_basic_info info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	if ( task_info( mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count ) == KERN_SUCCESS )
+	{
+		fp.rss = info.resident_size;
+		fp.peakRss = info.resident_size_max;
+	}
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) == 0 )
+	{
+		fp.minorFaults = usage.ru_minflt;
+		fp.majorFaults = usage.ru_majflt;
+	}
+}
+
+void ResetPeakRss() {}
+
+#endif
@@ -45,4 +45,16 @@ using namespace nodecpp::iibmalloc;
 int64_t GetMicrosecondCount();
 size_t GetMillisecondCount();
 
+struct MemoryFootprint
+{
+	size_t rss; // bytes; process-wide
+	size_t peakRss; // bytes; process-wide, since start or last ResetPeakRss()
+	uint64_t minorFaults;
+	uint64_t majorFaults;
+};
+
+// faults are counted for the calling thread where OS allows (Linux), otherwise for the whole process
+void GetMemoryFootprint( MemoryFootprint& fp, bool currentThreadFaultsOnly = true );
+void ResetPeakRss(); // best effort; Linux only
+
 #endif // ALLOCATOR_TEST_COMMON_H
\ No newline at end of file
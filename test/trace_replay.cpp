@@ -0,0 +1,344 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018-2022, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * Replays allocation traces recorded with NODECPP_IIBMALLOC_ALLOCATION_TRACE
+ * (see src/allocation_trace.h) against iibmalloc, new/delete, and an empty
+ * (fake) allocator, one thread per trace file
+ * 
+ * Usage: trace_replay <trace file> [<trace file> ...]
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "random_test.h"
+#include "../src/allocation_trace.h"
+
+#include <vector>
+#include <unordered_map>
+
+thread_local unsigned long long rnd_seed = 0;
+
+using nodecpp::iibmalloc::AllocationTraceOp;
+using nodecpp::iibmalloc::AllocationTraceRecord;
+using nodecpp::iibmalloc::AllocationTraceFileHeader;
+
+struct ReplayOp
+{
+	uint64_t size;
+	uint32_t slot; // dense index replacing a recorded address
+	AllocationTraceOp op;
+};
+
+struct ReplayTrace
+{
+	std::vector<ReplayOp> ops;
+	size_t slotCount = 0;
+	size_t allocCount = 0;
+	size_t skippedCount = 0; // deallocations of blocks allocated before recording has started
+};
+
+// recorded addresses are reused by the allocator over time; map them to dense slots once, outside of timed part
+bool loadTrace( const char* fileName, ReplayTrace& trace )
+{
+	FILE* f = fopen( fileName, "rb" );
+	if ( f == nullptr )
+	{
+		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "failed to open {}", fileName );
+		return false;
+	}
+	AllocationTraceFileHeader header;
+	if ( fread( &header, sizeof(header), 1, f ) != 1 || header.magic != AllocationTraceFileHeader::expectedMagic || header.version > nodecpp::iibmalloc::allocation_trace_version || header.recordSize != sizeof(AllocationTraceRecord) )
+	{
+		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "{} is not a supported allocation trace", fileName );
+		fclose( f );
+		return false;
+	}
+
+	std::unordered_map<uint64_t, uint32_t> liveIds;
+	std::unordered_map<uint64_t, uint32_t> zombieIds; // a zombie keeps its slot until it is released or killed
+	std::vector<uint32_t> freeSlots;
+	constexpr size_t chunkSize = 4096;
+	std::vector<AllocationTraceRecord> records( chunkSize );
+	size_t rd;
+	while ( ( rd = fread( records.data(), sizeof(AllocationTraceRecord), chunkSize, f ) ) != 0 )
+		for ( size_t i=0; i<rd; ++i )
+		{
+			const AllocationTraceRecord& rec = records[i];
+			ReplayOp op;
+			op.op = rec.op();
+			op.size = rec.size();
+			op.slot = 0;
+			switch ( op.op )
+			{
+				case AllocationTraceOp::alloc:
+				{
+					if ( freeSlots.empty() )
+						op.slot = (uint32_t)(trace.slotCount++);
+					else
+					{
+						op.slot = freeSlots.back();
+						freeSlots.pop_back();
+					}
+					liveIds[rec.id] = op.slot; // if id is still listed its deallocation was not recorded; the block is just left alive
+					++(trace.allocCount);
+					break;
+				}
+				case AllocationTraceOp::dealloc:
+				case AllocationTraceOp::zombie:
+				{
+					auto it = liveIds.find( rec.id );
+					if ( it == liveIds.end() )
+					{
+						++(trace.skippedCount);
+						continue;
+					}
+					op.slot = it->second;
+					if ( op.op == AllocationTraceOp::zombie )
+						zombieIds[rec.id] = op.slot;
+					else
+						freeSlots.push_back( op.slot );
+					liveIds.erase( it );
+					break;
+				}
+				case AllocationTraceOp::release:
+				case AllocationTraceOp::reclaim:
+				{
+					auto it = zombieIds.find( rec.id );
+					if ( it == zombieIds.end() )
+					{
+						++(trace.skippedCount);
+						continue;
+					}
+					op.slot = it->second;
+					freeSlots.push_back( op.slot );
+					zombieIds.erase( it );
+					break;
+				}
+				case AllocationTraceOp::kill:
+					for ( auto& z : zombieIds )
+						freeSlots.push_back( z.second );
+					zombieIds.clear();
+					break;
+				case AllocationTraceOp::mark:
+				case AllocationTraceOp::budget:
+					break;
+				default:
+					nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "{}: unexpected record type {}", fileName, (size_t)(op.op) );
+					fclose( f );
+					return false;
+			}
+			trace.ops.push_back( op );
+		}
+	fclose( f );
+	return true;
+}
+
+// a trace is recorded at the level of IibAllocatorBase, that is, for plain blocks; allocators with zombies have
+// zombieable ones as their default, which would add the zombie prefix to recorded sizes once again
+template< class AllocatorUnderTest>
+void* replayAllocate( AllocatorUnderTest& allocatorUnderTest, size_t sz )
+{
+	if constexpr ( AllocatorUnderTest::hasZombies() )
+		return allocatorUnderTest.plainAllocate( sz );
+	else
+		return allocatorUnderTest.allocate( sz );
+}
+
+template< class AllocatorUnderTest>
+void replayDeallocate( AllocatorUnderTest& allocatorUnderTest, void* ptr )
+{
+	if constexpr ( AllocatorUnderTest::hasZombies() )
+		allocatorUnderTest.plainDeallocate( ptr );
+	else
+		allocatorUnderTest.deallocate( ptr );
+}
+
+// zombies are replayed as such by allocators that support them; other allocators keep zombie blocks alive
+// until the respective release or kill record, which is what their memory footprint would be
+template< class AllocatorUnderTest>
+void replayTrace( AllocatorUnderTest& allocatorUnderTest, const ReplayTrace& trace, size_t threadID )
+{
+	constexpr size_t fakeSizeCap = 0x1000000; // FakeAllocatorUnderTest serves everything from a single buffer of this size
+	size_t dummyCtr = 0;
+	uint8_t** slots = new uint8_t* [ trace.slotCount ];
+	memset( slots, 0, trace.slotCount * sizeof( uint8_t* ) );
+	std::vector<uint8_t> isZombie( trace.slotCount, 0 );
+	std::vector<uint32_t> zombieSlots;
+
+	allocatorUnderTest.init( threadID );
+	allocatorUnderTest.doWhateverAfterSetupPhase();
+
+	for ( const ReplayOp& op : trace.ops )
+	{
+		switch ( op.op )
+		{
+			case AllocationTraceOp::alloc:
+			{
+				size_t sz = allocatorUnderTest.isFake() && op.size > fakeSizeCap ? fakeSizeCap : op.size;
+				slots[op.slot] = reinterpret_cast<uint8_t*>( replayAllocate( allocatorUnderTest, sz ) );
+				if ( sz )
+					slots[op.slot][0] = (uint8_t)sz; // first touch, as a real user would do
+				break;
+			}
+			case AllocationTraceOp::dealloc:
+				dummyCtr += slots[op.slot][0];
+				replayDeallocate( allocatorUnderTest, slots[op.slot] );
+				slots[op.slot] = nullptr;
+				break;
+			case AllocationTraceOp::zombie:
+				dummyCtr += slots[op.slot][0];
+				if constexpr ( AllocatorUnderTest::hasZombies() )
+				{
+					allocatorUnderTest.zombieDeallocate( slots[op.slot] );
+					slots[op.slot] = nullptr;
+				}
+				else
+				{
+					isZombie[op.slot] = 1;
+					zombieSlots.push_back( op.slot );
+				}
+				break;
+			case AllocationTraceOp::release: // with the same budget the allocator releases this one on its own
+				if constexpr ( !AllocatorUnderTest::hasZombies() )
+				{
+					replayDeallocate( allocatorUnderTest, slots[op.slot] );
+					slots[op.slot] = nullptr;
+					isZombie[op.slot] = 0;
+				}
+				break;
+			case AllocationTraceOp::reclaim:
+				if constexpr ( AllocatorUnderTest::hasZombies() )
+					allocatorUnderTest.reclaimZombies( 1 );
+				else
+				{
+					replayDeallocate( allocatorUnderTest, slots[op.slot] );
+					slots[op.slot] = nullptr;
+					isZombie[op.slot] = 0;
+				}
+				break;
+			case AllocationTraceOp::kill:
+				if constexpr ( AllocatorUnderTest::hasZombies() )
+					allocatorUnderTest.killAllZombies();
+				else
+				{
+					for ( uint32_t slot : zombieSlots )
+						if ( isZombie[slot] ) // skips those released individually; a reused slot may be listed more than once
+						{
+							replayDeallocate( allocatorUnderTest, slots[slot] );
+							slots[slot] = nullptr;
+							isZombie[slot] = 0;
+						}
+					zombieSlots.clear();
+				}
+				break;
+			case AllocationTraceOp::mark:
+				if constexpr ( AllocatorUnderTest::hasZombies() )
+					allocatorUnderTest.markZombiesForReclamation();
+				break;
+			case AllocationTraceOp::budget:
+				if constexpr ( AllocatorUnderTest::hasZombies() )
+					allocatorUnderTest.setZombieQuarantineBudget( op.size );
+				break;
+			default:
+				break;
+		}
+	}
+	allocatorUnderTest.doWhateverAfterMainLoopPhase();
+
+	for ( size_t i=0; i<trace.slotCount; ++i )
+		if ( slots[i] )
+			replayDeallocate( allocatorUnderTest, slots[i] );
+
+	allocatorUnderTest.deinit();
+	allocatorUnderTest.doWhateverAfterCleanupPhase();
+	delete [] slots;
+
+	nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "about to exit thread {} ({} operations performed) [ctr = {}]...", threadID, trace.ops.size(), dummyCtr );
+}
+
+template< class AllocatorUnderTest>
+size_t runReplay( const char* name, std::vector<ReplayTrace>& traces, ThreadTestRes* res )
+{
+	nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "replaying with {}...", name );
+	std::thread threads[ max_threads ];
+	ResetPeakRss(); // process-wide, so once and before any thread starts
+	size_t start = GetMillisecondCount();
+	for ( size_t i=0; i<traces.size(); ++i )
+		threads[i] = std::thread( [&traces, res, i]() {
+			AllocatorUnderTest allocator( res + i );
+			replayTrace( allocator, traces[i], i );
+		} );
+	for ( size_t i=0; i<traces.size(); ++i )
+		threads[i].join();
+	return GetMillisecondCount() - start;
+}
+
+int main( int argc, char** argv )
+{
+	nodecpp::log::Log log;
+	log.level = nodecpp::log::LogLevel::info;
+	log.add( stdout );
+	nodecpp::logging_impl::currentLog = &log;
+
+	if ( argc < 2 || (size_t)(argc - 1) > max_threads )
+	{
+		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "usage: {} <trace file> [<trace file> ...] (up to {} files, one thread each)", argv[0], max_threads );
+		return 1;
+	}
+
+	std::vector<ReplayTrace> traces( argc - 1 );
+	for ( int i=1; i<argc; ++i )
+	{
+		if ( !loadTrace( argv[i], traces[i-1] ) )
+			return 1;
+		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "{}: {} operations, {} allocations, {} slots, {} skipped", argv[i], traces[i-1].ops.size(), traces[i-1].allocCount, traces[i-1].slotCount, traces[i-1].skippedCount );
+	}
+
+	TestRes* testRes = new TestRes;
+	memset( testRes, 0, sizeof( TestRes ) );
+
+	testRes->durEmpty = runReplay<FakeAllocatorUnderTest>( "empty allocator", traces, testRes->threadResEmpty );
+	testRes->durNewDel = runReplay<NewDeleteUnderTest>( "new/delete", traces, testRes->threadResNewDel );
+	testRes->durPerThreadAlloc = runReplay<PerThreadAllocatorUnderTest>( "per-thread allocator", traces, testRes->threadResPerThreadAlloc );
+
+	nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Per-thread stats:" );
+	for ( size_t i=0; i<traces.size(); ++i )
+	{
+		nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "   {}:", i );
+		printThreadStats( "\t", testRes->threadResEmpty[i] );
+		printThreadMemoryStats( "\t", testRes->threadResEmpty[i] );
+		printThreadStats( "\t", testRes->threadResNewDel[i] );
+		printThreadMemoryStats( "\t", testRes->threadResNewDel[i] );
+		printThreadStatsEx( "\t", testRes->threadResPerThreadAlloc[i] );
+		printThreadMemoryStats( "\t", testRes->threadResPerThreadAlloc[i] );
+	}
+	nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "Replay summary (threads,empty,newdel,perthread,ratio):" );
+	nodecpp::log::default_log::info( nodecpp::log::ModuleID(nodecpp::iibmalloc_module_id), "{},{},{},{},{}", traces.size(), testRes->durEmpty, testRes->durNewDel, testRes->durPerThreadAlloc, (testRes->durNewDel - testRes->durEmpty) * 1. / (testRes->durPerThreadAlloc - testRes->durEmpty) );
+
+	delete testRes;
+	return 0;
+}